@@ -0,0 +1,509 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ecrt.h>
+#include "autotune.h"
+#include "cia402.h"
+#include "pdo_ring.h"
+#include "rxpdo_channel.h"
+#include "sdo_engine.h"
+
+#define AUTOTUNE_MODE 9
+// The ring is drained at this interval like by the gui
+#define AUTOTUNE_POLL_NS 10000000L
+#define AUTOTUNE_ENABLE_POLLS 500
+#define AUTOTUNE_SDO_POLLS 200
+// Cycles recorded before the step
+#define AUTOTUNE_PRE_CYCLES 20
+// Integration steps of the model per cycle
+#define AUTOTUNE_SUBSTEPS 10
+#define AUTOTUNE_MAX_DEAD_CYCLES 4
+#define AUTOTUNE_REFINE_ROUNDS 24
+// Searched range of the crossover a and the integral time b relative to the small time constants
+#define AUTOTUNE_A_MIN 1.5
+#define AUTOTUNE_A_MAX 20.0
+#define AUTOTUNE_A_FACTOR 1.1
+#define AUTOTUNE_B_MIN 2.0
+#define AUTOTUNE_B_MAX 2000.0
+#define AUTOTUNE_B_FACTOR 1.2
+// The overshoot limit of the design is reduced by this factor whenever the drive exceeded it
+#define AUTOTUNE_MARGIN 0.7
+
+typedef struct
+{
+	double demand[AUTOTUNE_MAX_SAMPLES];	// Velocity demand written in the cycle
+	double actual[AUTOTUNE_MAX_SAMPLES];	// Actual velocity read in the cycle
+	unsigned int count;
+	unsigned int step_index;				// First cycle of the new demand
+}autotune_response_t;
+
+// Only used by the tuning thread
+static autotune_response_t response, prediction;
+static double simulated[AUTOTUNE_MAX_SAMPLES];
+static txpdo_queue_data_t batch[64];
+
+/****************************************************************************/
+
+static void autotune_sleep(void)
+{
+	struct timespec period = {0, AUTOTUNE_POLL_NS};
+
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &period, NULL);
+}
+
+// Drains the ring at least once and for at least the given number of cycles, appends the samples
+// of the axis to the response if any. Returns false if the axis left operation enabled.
+static bool autotune_collect(autotune_t* tune, autotune_response_t* r, unsigned int cycles)
+{
+	unsigned int n, done = 0;
+
+	for (;;)
+	{
+		while ((n = txpdo_ring_pop_batch(tune->ring, batch, 64)) > 0)
+		{
+			for (unsigned int i = 0; i < n; i++)
+			{
+				if (batch[i].cia402_state[tune->axis] != CIA402_OPERATION_ENABLED)
+				{
+					fprintf(stderr, "autotune: axis %u left operation enabled, statusword 0x%04x\n",
+							tune->axis + 1, batch[i].statusword[tune->axis]);
+					return false;
+				}
+				if (r && (r->count < AUTOTUNE_MAX_SAMPLES))
+				{
+					r->demand[r->count] = batch[i].velocity_demand[tune->axis];
+					r->actual[r->count] = batch[i].velocity[tune->axis];
+					r->count++;
+				}
+			}
+			done += n;
+		}
+		if (done >= cycles)
+		{
+			return true;
+		}
+		autotune_sleep();
+	}
+}
+
+// Publishes the command and waits for operation enabled and a settled velocity
+static bool autotune_enable(autotune_t* tune)
+{
+	bool enabled = false;
+	unsigned int n;
+
+	rxpdo_channel_publish(tune->channel, &tune->command);
+	for (unsigned int polls = 0; polls < AUTOTUNE_ENABLE_POLLS; polls++)
+	{
+		while ((n = txpdo_ring_pop_batch(tune->ring, batch, 64)) > 0)
+		{
+			enabled = (batch[n - 1].cia402_state[tune->axis] == CIA402_OPERATION_ENABLED) &&
+					(batch[n - 1].mode_of_operation[tune->axis] == AUTOTUNE_MODE);
+		}
+		if (enabled)
+		{
+			return autotune_collect(tune, NULL, lround(AUTOTUNE_HOLD_MS * 1e-3 / tune->period_s));
+		}
+		autotune_sleep();
+	}
+	fprintf(stderr, "autotune: axis %u not enabled in cyclic synchronous velocity mode\n", tune->axis + 1);
+	return false;
+}
+
+// Uploads or downloads an object of the axis and waits for the result
+static bool autotune_transfer(autotune_t* tune, uint16_t index, bool write, uint32_t* value)
+{
+	int entry = sdo_engine_watch(tune->sdo, tune->axis, index, 0, AUTOTUNE_GAIN_SIZE);
+	sdo_result_t result;
+	uint32_t errors;
+	bool queued;
+
+	if ((entry < 0) || !sdo_engine_result(tune->sdo, entry, &result))
+	{
+		return false;
+	}
+	errors = result.errors;
+	queued = write ? sdo_engine_write(tune->sdo, tune->axis, index, 0, AUTOTUNE_GAIN_SIZE, *value) :
+			sdo_engine_read(tune->sdo, tune->axis, index, 0, AUTOTUNE_GAIN_SIZE);
+	if (!queued)
+	{
+		return false;
+	}
+	for (unsigned int polls = 0; polls < AUTOTUNE_SDO_POLLS; polls++)
+	{
+		autotune_sleep();
+		autotune_collect(tune, NULL, 0);
+		if (sdo_engine_result(tune->sdo, entry, &result) && (result.pending == 0))
+		{
+			if ((result.errors != errors) || (result.state != SDO_ENTRY_VALID))
+			{
+				break;
+			}
+			*value = result.value;
+			return true;
+		}
+	}
+	fprintf(stderr, "autotune: SDO %s of 0x%04x of axis %u failed\n", write ? "download" : "upload", index,
+			tune->axis + 1);
+	return false;
+}
+
+// Writes the object values of the gains and reads them back
+static bool autotune_write_gains(autotune_t* tune, uint32_t kp, uint32_t ti)
+{
+	uint32_t value;
+
+	value = kp;
+	if (!autotune_transfer(tune, tune->kp_index, true, &value) ||
+			!autotune_transfer(tune, tune->kp_index, false, &value) || (value != kp))
+	{
+		return false;
+	}
+	value = ti;
+	if (!autotune_transfer(tune, tune->ti_index, true, &value) ||
+			!autotune_transfer(tune, tune->ti_index, false, &value) || (value != ti))
+	{
+		return false;
+	}
+	return true;
+}
+
+// Records the response to a step of the demand and steps back afterwards
+static bool autotune_measure(autotune_t* tune, autotune_response_t* r)
+{
+	unsigned int hold_cycles = lround(AUTOTUNE_HOLD_MS * 1e-3 / tune->period_s);
+	int32_t base = tune->command.velocity_setpoint[tune->axis];
+	bool ok;
+
+	r->count = 0;
+	autotune_collect(tune, NULL, 0);
+	if (!autotune_collect(tune, r, AUTOTUNE_PRE_CYCLES))
+	{
+		return false;
+	}
+	tune->command.velocity_setpoint[tune->axis] = base + tune->step;
+	rxpdo_channel_publish(tune->channel, &tune->command);
+	ok = autotune_collect(tune, r, hold_cycles);
+	tune->command.velocity_setpoint[tune->axis] = base;
+	rxpdo_channel_publish(tune->channel, &tune->command);
+	if (!ok || !autotune_collect(tune, NULL, hold_cycles))
+	{
+		return false;
+	}
+	for (r->step_index = 0; (r->step_index < r->count) && (r->demand[r->step_index] == base); r->step_index++);
+	if (r->step_index + hold_cycles / 2 > r->count)
+	{
+		fprintf(stderr, "autotune: step of axis %u not found in the response\n", tune->axis + 1);
+		return false;
+	}
+	return true;
+}
+
+// Overshoot as share of the step and time until the velocity stays within the settling band
+static void autotune_metrics(const autotune_response_t* r, const double* actual, double period_s,
+		double* overshoot, double* settling_s)
+{
+	double initial = r->demand[0], target = r->demand[r->count - 1];
+	double step = fabs(target - initial), sign = (target >= initial) ? 1.0 : -1.0;
+	double peak = 0.0;
+	unsigned int last = r->step_index;
+
+	for (unsigned int k = r->step_index; k < r->count; k++)
+	{
+		double deviation = (actual[k] - target) * sign;
+
+		if (deviation > peak)
+		{
+			peak = deviation;
+		}
+		if (fabs(actual[k] - target) > AUTOTUNE_SETTLING_BAND * step)
+		{
+			last = k + 1;
+		}
+	}
+	*overshoot = (step > 0.0) ? peak / step : 0.0;
+	*settling_s = (last == r->count) ? INFINITY : (last - r->step_index) * period_s;
+}
+
+// Response of the model with the gains to the demand of r, starting at rest at the first actual
+// velocity. The PI controller, the load and the lag are integrated like in the drive.
+static void autotune_simulate(const autotune_model_t* model, double kp, double ti_s, double period_s,
+		const autotune_response_t* r, double* out)
+{
+	double h = period_s / AUTOTUNE_SUBSTEPS;
+	double velocity = r->actual[0], measured = r->actual[0], integral = 0.0;
+
+	for (unsigned int k = 0; k < r->count; k++)
+	{
+		double demand = r->demand[(k >= model->dead_cycles) ? k - model->dead_cycles : 0];
+
+		for (unsigned int s = 0; s < AUTOTUNE_SUBSTEPS; s++)
+		{
+			double error = demand - velocity;
+			double torque = kp * (error + integral);
+
+			integral += error * h / ti_s;
+			velocity += torque / model->inertia * h;
+			measured += (velocity - measured) * h / (model->lag_s + h);
+		}
+		// An unstable model is not integrated further, its cost is huge anyway
+		if (!isfinite(measured) || (fabs(measured) > 1e12))
+		{
+			for (; k < r->count; k++)
+			{
+				out[k] = 1e12;
+			}
+			return;
+		}
+		out[k] = measured;
+	}
+}
+
+static double autotune_cost(autotune_model_t* model, double kp, double ti_s, double period_s,
+		const autotune_response_t* r)
+{
+	double cost = 0.0;
+
+	autotune_simulate(model, kp, ti_s, period_s, r, simulated);
+	for (unsigned int k = 0; k < r->count; k++)
+	{
+		cost += (simulated[k] - r->actual[k]) * (simulated[k] - r->actual[k]);
+	}
+	return cost;
+}
+
+// Least squares fit of the model to the response to the gains kp and ti_s. A coarse grid of
+// inertia, lag and dead time is searched first, inertia and lag are refined by a pattern search.
+static void autotune_fit(autotune_t* tune, const autotune_response_t* r, double kp, double ti_s)
+{
+	autotune_model_t model, best = {1.0, 0.0, 0, 0.0};
+	double best_cost = INFINITY, cost, inertia_factor = 1.25, lag_step;
+
+	for (model.dead_cycles = 0; model.dead_cycles <= AUTOTUNE_MAX_DEAD_CYCLES; model.dead_cycles++)
+	{
+		for (model.inertia = 0.01; model.inertia <= 100.0; model.inertia *= inertia_factor)
+		{
+			for (unsigned int l = 0; l < 20; l++)
+			{
+				model.lag_s = l ? 1e-4 * pow(1.3, l - 1) : 0.0;
+				if ((cost = autotune_cost(&model, kp, ti_s, tune->period_s, r)) < best_cost)
+				{
+					best_cost = cost;
+					best = model;
+				}
+			}
+		}
+	}
+	lag_step = fmax(0.3 * best.lag_s, 1e-4);
+	for (unsigned int round = 0; round < AUTOTUNE_REFINE_ROUNDS; round++)
+	{
+		autotune_model_t candidates[4] = {best, best, best, best};
+		bool improved = false;
+
+		candidates[0].inertia *= inertia_factor;
+		candidates[1].inertia /= inertia_factor;
+		candidates[2].lag_s += lag_step;
+		candidates[3].lag_s = fmax(candidates[3].lag_s - lag_step, 0.0);
+		for (unsigned int c = 0; c < 4; c++)
+		{
+			if ((cost = autotune_cost(&candidates[c], kp, ti_s, tune->period_s, r)) < best_cost)
+			{
+				best_cost = cost;
+				best = candidates[c];
+				improved = true;
+			}
+		}
+		if (!improved)
+		{
+			inertia_factor = sqrt(inertia_factor);
+			lag_step *= 0.5;
+		}
+	}
+	best.residual = sqrt(best_cost / r->count);
+	tune->model = best;
+}
+
+// Sum of the small time constants of the loop: measurement lag, dead time and the hold of the
+// demand over one cycle. The gains are searched relative to it like in the symmetric optimum.
+static double autotune_t_sigma(const autotune_t* tune)
+{
+	return tune->model.lag_s + (tune->model.dead_cycles + 0.5) * tune->period_s;
+}
+
+// Searches the gains kp = inertia / (a * t_sigma) and ti = b * t_sigma giving the shortest
+// settling time of the model within the overshoot limit, the lower overshoot on equal settling
+// time. The symmetric optimum is the line b = a^2. Returns false if no gains keep the limit.
+static bool autotune_design(autotune_t* tune, const autotune_response_t* r, double overshoot_limit,
+		double* overshoot, double* settling_s)
+{
+	double t_sigma = autotune_t_sigma(tune);
+	bool found = false;
+
+	// The measured step is simulated from rest
+	prediction.count = r->count;
+	prediction.step_index = r->step_index;
+	for (unsigned int k = 0; k < r->count; k++)
+	{
+		prediction.demand[k] = r->demand[k] - r->demand[0];
+		prediction.actual[k] = 0.0;
+	}
+	*overshoot = INFINITY;
+	*settling_s = INFINITY;
+	for (double a = AUTOTUNE_A_MIN; a <= AUTOTUNE_A_MAX; a *= AUTOTUNE_A_FACTOR)
+	{
+		for (double b = AUTOTUNE_B_MIN; b <= AUTOTUNE_B_MAX; b *= AUTOTUNE_B_FACTOR)
+		{
+			double kp = tune->model.inertia / (a * t_sigma), ti_s = b * t_sigma, o, s;
+
+			autotune_simulate(&tune->model, kp, ti_s, tune->period_s, &prediction, simulated);
+			autotune_metrics(&prediction, simulated, tune->period_s, &o, &s);
+			if ((o <= overshoot_limit) && ((s < *settling_s) || ((s == *settling_s) && (o < *overshoot))))
+			{
+				*overshoot = o;
+				*settling_s = s;
+				tune->kp = kp;
+				tune->ti_s = ti_s;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+// Ends the tuning with the exit status of the process, main stops the cycle and shuts down
+static void autotune_stop(autotune_t* tune, int status)
+{
+	tune->status = status;
+	atomic_store(tune->stop, true);
+}
+
+// Writes the gains found at the start back unless the targets were met and ends the tuning
+static void autotune_finish(autotune_t* tune, uint32_t kp, uint32_t ti)
+{
+	if (!tune->met && !autotune_write_gains(tune, kp, ti))
+	{
+		fprintf(stderr, "autotune: restoring the gains kp %.0f 1/s ti %.0f us failed\n", kp / tune->kp_scale,
+				ti / tune->ti_scale);
+	}
+	if (tune->met)
+	{
+		printf("autotune: targets met after %u iterations: kp %.0f 1/s ti %.0f us, overshoot %.1f %% settling %.1f ms\n",
+				tune->iterations, tune->kp, tune->ti_s * 1e6, tune->overshoot * 100.0, tune->settling_s * 1e3);
+	}
+	else
+	{
+		printf("autotune: targets not met after %u iterations, gains kp %.0f 1/s ti %.0f us restored\n",
+				tune->iterations, kp / tune->kp_scale, ti / tune->ti_scale);
+	}
+	autotune_stop(tune, tune->met ? 0 : 1);
+}
+
+/****************************************************************************/
+
+void* autotune_thread(void* arg)
+{
+	autotune_t* tune = (autotune_t*)arg;
+	double overshoot_limit = tune->overshoot_max;
+	uint32_t kp_initial = 0, ti_initial = 0;
+
+	// Cyclic synchronous velocity with the setpoint generator bypassed, so the step is written
+	// within one cycle. The fit uses the demand as written anyway.
+	tune->command.mode_of_operation[tune->axis] = AUTOTUNE_MODE;
+	tune->command.enable[tune->axis] = 1;
+	tune->command.profile_bypass[tune->axis] = 1;
+	tune->met = false;
+
+	if (!autotune_enable(tune) || !autotune_transfer(tune, tune->kp_index, false, &kp_initial) ||
+			!autotune_transfer(tune, tune->ti_index, false, &ti_initial))
+	{
+		autotune_stop(tune, 1);
+		return NULL;
+	}
+	if ((kp_initial == 0) || (ti_initial == 0))
+	{
+		fprintf(stderr, "autotune: gains 0x%04x %u 0x%04x %u of axis %u are no PI controller\n", tune->kp_index,
+				kp_initial, tune->ti_index, ti_initial, tune->axis + 1);
+		autotune_stop(tune, 1);
+		return NULL;
+	}
+	tune->kp = kp_initial / tune->kp_scale;
+	tune->ti_s = ti_initial / tune->ti_scale * 1e-6;
+	printf("autotune: axis %u step %d, targets overshoot %.1f %% settling %.1f ms, gains kp %.0f 1/s ti %.0f us\n",
+			tune->axis + 1, tune->step, tune->overshoot_max * 100.0, tune->settling_max_s * 1e3, tune->kp,
+			tune->ti_s * 1e6);
+
+	for (tune->iterations = 0; tune->iterations <= AUTOTUNE_ITERATIONS; tune->iterations++)
+	{
+		double overshoot, settling_s;
+		uint32_t kp, ti;
+
+		if (!autotune_measure(tune, &response))
+		{
+			autotune_finish(tune, kp_initial, ti_initial);
+			return NULL;
+		}
+		autotune_metrics(&response, response.actual, tune->period_s, &tune->overshoot, &tune->settling_s);
+		printf("autotune: %u kp %6.0f 1/s ti %7.0f us: overshoot %5.1f %% settling %6.1f ms\n", tune->iterations,
+				tune->kp, tune->ti_s * 1e6, tune->overshoot * 100.0, tune->settling_s * 1e3);
+		if ((tune->overshoot <= tune->overshoot_max) && (tune->settling_s <= tune->settling_max_s))
+		{
+			tune->met = true;
+			break;
+		}
+		if (tune->iterations == AUTOTUNE_ITERATIONS)
+		{
+			break;
+		}
+		// The model is not exact, a design exceeding the overshoot on the drive is done again with margin
+		if ((tune->iterations > 0) && (tune->overshoot > tune->overshoot_max))
+		{
+			overshoot_limit *= AUTOTUNE_MARGIN;
+		}
+
+		// The model is fitted to the latest response and the gains it was measured with
+		autotune_fit(tune, &response, tune->kp, tune->ti_s);
+		if (!autotune_design(tune, &response, overshoot_limit, &overshoot, &settling_s))
+		{
+			printf("autotune: no gains keep the overshoot with the model\n");
+			break;
+		}
+		// Rounded to the resolution of the objects
+		kp = lround(fmax(tune->kp * tune->kp_scale, 1.0));
+		ti = lround(fmax(tune->ti_s * 1e6 * tune->ti_scale, 1.0));
+		tune->kp = kp / tune->kp_scale;
+		tune->ti_s = ti / tune->ti_scale * 1e-6;
+		printf("autotune: model inertia %.3f lag %.2f ms dead %u cycles residual %.1f predicts overshoot %.1f %% settling %.1f ms\n",
+				tune->model.inertia, tune->model.lag_s * 1e3, tune->model.dead_cycles, tune->model.residual,
+				overshoot * 100.0, settling_s * 1e3);
+		if (settling_s > tune->settling_max_s)
+		{
+			printf("autotune: settling time not reachable with the model\n");
+			break;
+		}
+		if (!autotune_write_gains(tune, kp, ti))
+		{
+			break;
+		}
+	}
+	autotune_finish(tune, kp_initial, ti_initial);
+	return NULL;
+}
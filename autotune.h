@@ -0,0 +1,100 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "servo_gui.h"
+
+// Automatic tuning of the velocity loop of one axis. It runs in place of the gui thread:
+// a velocity step is commanded in cyclic synchronous velocity mode, the velocity demand and
+// the actual velocity 0x606c of every cycle are taken from the ring and a model of the plant
+// (load inertia, lag of the velocity measurement and dead time in cycles) is fitted to the
+// response with the gains currently set in the drive. The gains are designed for the model by
+// the symmetric optimum with a damping factor chosen by simulating the closed loop, written
+// by SDO and verified by a further step. This repeats with the model refitted to every new
+// response until the overshoot and settling time targets are met.
+//
+// The drive is expected to implement the velocity loop as PI controller with the proportional
+// gain relative to the nominal motor inertia and the integral time, both in vendor specific
+// objects of 32 bit. Their indices and scaling are set by the caller from the manual of the
+// drive, only the simulation has defaults: the objects below in 1/s and us. The gains are not
+// stored in the EEPROM.
+#define AUTOTUNE_SIM_KP_INDEX 0x2101
+#define AUTOTUNE_SIM_TI_INDEX 0x2102
+#define AUTOTUNE_GAIN_SIZE 4
+
+#define AUTOTUNE_STEP_DEFAULT 2000
+#define AUTOTUNE_OVERSHOOT_PERCENT_DEFAULT 20
+#define AUTOTUNE_SETTLING_MS_DEFAULT 100
+// Duration of a step, the response must have settled within
+#define AUTOTUNE_HOLD_MS 400
+// The settling time ends when the actual velocity stays within this share of the step
+#define AUTOTUNE_SETTLING_BAND 0.05
+#define AUTOTUNE_ITERATIONS 8
+// Samples of a response including the cycles before the step
+#define AUTOTUNE_MAX_SAMPLES 8192
+
+// Plant seen by the velocity loop
+typedef struct
+{
+	double inertia;				// Load inertia relative to the nominal motor inertia
+	double lag_s;				// Time constant of the velocity measurement
+	unsigned int dead_cycles;	// Cycles from writing the demand until the drive acts on it
+	double residual;			// RMS of the difference of model and response [units/s]
+}autotune_model_t;
+
+struct txpdo_ring;
+struct rxpdo_channel;
+struct sdo_engine;
+
+typedef struct
+{
+	// Set by the caller
+	unsigned int axis;
+	uint16_t kp_index;
+	uint16_t ti_index;
+	double kp_scale;			// Object value per 1/s of the proportional gain
+	double ti_scale;			// Object value per us of the integral time
+	int32_t step;				// Velocity step from the velocity of the command [units/s]
+	double overshoot_max;		// Share of the step
+	double settling_max_s;
+	double period_s;
+	rxpdo_queue_data_t command;	// Command of all axes, the tuned one is switched to mode 9
+	struct txpdo_ring* ring;
+	struct rxpdo_channel* channel;
+	struct sdo_engine* sdo;
+	atomic_bool* stop;			// Set when the tuning ended, the cycle stops then
+	// Results
+	autotune_model_t model;
+	double kp;
+	double ti_s;
+	double overshoot;
+	double settling_s;
+	unsigned int iterations;
+	bool met;
+	int status;					// Exit status of the process, 0 if the targets were met
+}autotune_t;
+
+// Thread function, tunes the axis and sets the stop flag when done, with status 0 if the targets
+// were met. Otherwise the gains found at the start are written back.
+void* autotune_thread(void* arg);
+
+#endif /* AUTOTUNE_H_ */
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Measures how the execution time of the cyclic task scales with the number of axes.
+# arg1:  path of ECT60ctrl (built with ENABLE_SIMULATION=1 on a build machine)
+# arg2:  seconds per run (default 10)
+# arg3:  list of axis counts (default "1 2 4 8 16")
+# arg4:  cycle frequency in Hz (default 1000)
+#
+# With the simulation, the execution time includes the simulated frame exchange and drive models.
+
+EXE=${1:-./ECT60ctrl}
+SECONDS_PER_RUN=${2:-10}
+AXES=${3:-"1 2 4 8 16"}
+FREQ=${4:-1000}
+
+for n in $AXES
+do
+	$EXE -n $n -f $FREQ -F -b $SECONDS_PER_RUN | grep "^bench:.* exec "
+done
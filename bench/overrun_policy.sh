@@ -0,0 +1,53 @@
+#!/bin/bash
+# Checks the overrun policies against execution time spikes injected by the simulation.
+# arg1:  path of ECT60ctrl (built with ENABLE_SIMULATION=1)
+# arg2:  spike in us (default 3500, 3 missed deadlines at 1 kHz)
+# arg3:  frames between two spikes (default 1000)
+#
+# skip:        no missed cycle is run late, the skipped cycles are logged
+# catchup,n:   at most n cycles are run back to back after a spike, then the rest is skipped
+# stop:        all axes are disabled after the first overrun
+# The late frames and the longest lag of a frame behind its application time are printed by the
+# simulation, host wakeup jitter above one period adds to them for every policy.
+
+EXE=${1:-./ECT60ctrl}
+export ECT60_SIM_SPIKE_US=${2:-3500}
+export ECT60_SIM_SPIKE_EVERY=${3:-1000}
+CATCH_UP=2
+FAILED=0
+
+run()
+{
+	$EXE -n 1 -b 5 -o $1 -s "" 2>&1
+}
+
+fail()
+{
+	echo "FAILED: $1"
+	FAILED=1
+}
+
+for policy in skip catchup,$CATCH_UP stop
+do
+	out=$(run $policy)
+	echo "== $policy"
+	echo "$out" | grep -E "^bench: deadline|^Simulated frames"
+	misses=$(echo "$out" | sed -n 's/^bench: deadline misses \([0-9]*\).*/\1/p')
+	[ "${misses:-0}" -gt 0 ] || fail "$policy: no overrun detected"
+	case $policy in
+	skip)
+		echo "$out" | grep -q "catching up" && fail "skip: cycles caught up"
+		;;
+	catchup*)
+		# Longest run of consecutive cycles caught up
+		longest=$(echo "$out" | sed -n 's/.*cycle \([0-9]*\) overrun: .*catching up/\1/p' |
+			awk 'BEGIN {run = 0; max = 0} {run = ($1 == last + 1) ? run + 1 : 1; last = $1; if (run > max) max = run} END {print max}')
+		[ "$longest" -le $CATCH_UP ] || fail "catchup: $longest cycles caught up back to back"
+		;;
+	stop)
+		echo "$out" | grep -q "^cia402: .*Operation enabled" && fail "stop: axis still enabled"
+		echo "$out" | grep -q "axes stopped" || fail "stop: not logged"
+		;;
+	esac
+done
+exit $FAILED
@@ -0,0 +1,161 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Micro-benchmark of the process data access of one cycle: the former access through the offset
+// of every entry by EC_READ_*/EC_WRITE_* against one copy of the domain into the image of
+// pdo_layout.h and one copy back. Both read the inputs the cycle reads, write the outputs it
+// writes and read the inputs and outputs recorded and published. The domain has the layout the
+// master reports, the time per cycle is the minimum over the runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ecrt.h"
+#include "pdo_layout.h"
+
+#define MAX_AXES 16
+#define RUNS 5
+
+static uint8_t domain[MAX_AXES * sizeof(pdo_axis_t)];
+static pdo_axis_t image[MAX_AXES];
+
+// Offsets as registered, not known to the compiler
+#define OFFSETS(name, index, subindex, type) unsigned int name[MAX_AXES];
+static struct {
+    PDO_ENTRIES(OFFSETS)
+} offsets;
+
+// Values of the cycle logic
+static struct {
+    int32_t velocity[MAX_AXES];
+    int8_t mode[MAX_AXES];
+    uint16_t statusword[MAX_AXES];
+    uint32_t digital_inputs[MAX_AXES];
+    unsigned int digital_outputs[MAX_AXES];
+} values;
+
+#define BARRIER() __asm__ volatile("" ::: "memory")
+
+static void scattered_cycle(unsigned int axes, unsigned int cycle)
+{
+    unsigned int a;
+
+    for (a = 0; a < axes; a++)
+        values.velocity[a] = EC_READ_S32(domain + offsets.velocity_actual[a]);
+    for (a = 0; a < axes; a++)
+        values.mode[a] = EC_READ_S8(domain + offsets.mode_display[a]);
+    for (a = 0; a < axes; a++)
+        values.statusword[a] = EC_READ_U16(domain + offsets.statusword[a]);
+    BARRIER();
+    for (a = 0; a < axes; a++)
+        EC_WRITE_U16(domain + offsets.controlword[a], values.statusword[a] ^ 0x000f);
+    for (a = 0; a < axes; a++)
+        EC_WRITE_U8(domain + offsets.mode_of_operation[a], values.mode[a]);
+    for (a = 0; a < axes; a++)
+        EC_WRITE_S32(domain + offsets.profile_acceleration[a], cycle);
+    for (a = 0; a < axes; a++)
+        EC_WRITE_S32(domain + offsets.profile_deceleration[a], cycle);
+    for (a = 0; a < axes; a++)
+        EC_WRITE_S32(domain + offsets.target_velocity[a], values.velocity[a] + cycle);
+    BARRIER();
+    for (a = 0; a < axes; a++)
+        values.digital_inputs[a] = EC_READ_U32(domain + offsets.digital_inputs[a]);
+    for (a = 0; a < axes; a++)
+        values.digital_outputs[a] = EC_READ_U16(domain + offsets.digital_outputs[a]);
+}
+
+static void image_cycle(unsigned int axes, unsigned int cycle)
+{
+    unsigned int a;
+
+    memcpy(image, domain, axes * sizeof(pdo_axis_t));
+    for (a = 0; a < axes; a++) {
+        values.velocity[a] = image[a].in.velocity_actual;
+        values.mode[a] = image[a].in.mode_display;
+        values.statusword[a] = image[a].in.statusword;
+    }
+    BARRIER();
+    for (a = 0; a < axes; a++)
+        image[a].out.controlword = values.statusword[a] ^ 0x000f;
+    for (a = 0; a < axes; a++) {
+        image[a].out.mode_of_operation = values.mode[a];
+        image[a].out.profile_acceleration = cycle;
+        image[a].out.profile_deceleration = cycle;
+    }
+    for (a = 0; a < axes; a++)
+        image[a].out.target_velocity = values.velocity[a] + cycle;
+    memcpy(domain, image, axes * sizeof(pdo_axis_t));
+    BARRIER();
+    for (a = 0; a < axes; a++) {
+        values.digital_inputs[a] = image[a].in.digital_inputs;
+        values.digital_outputs[a] = image[a].out.digital_outputs;
+    }
+}
+
+static double ns_per_cycle(void (*cycle)(unsigned int, unsigned int), unsigned int axes, unsigned int cycles)
+{
+    double best = 0.0;
+
+    for (int r = 0; r < RUNS; r++) {
+        struct timespec start, end;
+        double ns;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (unsigned int c = 0; c < cycles; c++) {
+            cycle(axes, c);
+            BARRIER();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / cycles;
+        if ((r == 0) || (ns < best))
+            best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int axes_counts[] = {1, 2, 4, 8, 16};
+    unsigned int cycles = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+
+    if (cycles < 1) {
+        fprintf(stderr, "Usage: %s [cycles]\n", argv[0]);
+        return -1;
+    }
+    for (unsigned int a = 0; a < MAX_AXES; a++) {
+        unsigned int base = a * sizeof(pdo_axis_t);
+
+#define OFFSET_TX(name, index, subindex, type) offsets.name[a] = base + PDO_TX_OFFSET(name);
+#define OFFSET_RX(name, index, subindex, type) offsets.name[a] = base + PDO_RX_OFFSET(name);
+        PDO_TX_ENTRIES(OFFSET_TX)
+        PDO_RX_ENTRIES(OFFSET_RX)
+    }
+    for (unsigned int i = 0; i < sizeof(domain); i++)
+        domain[i] = i * 7;
+
+    printf("%u cycles, min of %d runs, pdo_axis_t %zu bytes\n", cycles, RUNS, sizeof(pdo_axis_t));
+    printf("axes  scattered ns  image ns  ratio\n");
+    for (unsigned int i = 0; i < sizeof(axes_counts)/sizeof(axes_counts[0]); i++) {
+        unsigned int axes = axes_counts[i];
+        double scattered = ns_per_cycle(scattered_cycle, axes, cycles);
+        double bulk = ns_per_cycle(image_cycle, axes, cycles);
+
+        printf("%4u  %12.1f  %8.1f  %5.2f\n", axes, scattered, bulk, scattered / bulk);
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Compares builds of ECT60ctrl by replaying one captured session through each of them.
+# arg1:  captured session (ECT60ctrl -C file)
+# arg2…: paths of ECT60ctrl builds, the first one is the baseline
+#
+# Every build must write the same outputs as captured, its logic time is printed next to the
+# time captured. Exits with 1 if any build writes different outputs.
+
+SESSION=$1
+shift
+FAILED=0
+
+for exe in "$@"
+do
+	echo "== $exe"
+	out=$($exe -P $SESSION) || FAILED=1
+	echo "$out" | grep "^replay:"
+done
+exit $FAILED
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Compares the send time of the classic and the send-first cycle layout in the simulation.
+# arg1:  path of ECT60ctrl (built with ENABLE_SIMULATION=1)
+# arg2:  number of axes (default 16, more axes make the cycle logic longer)
+# arg3:  seconds per layout (default 5)
+#
+# The send time is taken from the wakeup to ecrt_master_send(), its spread is the send jitter.
+# In send-first layout the cycle logic runs after the send, so the send time must not grow with
+# the logic, at the cost of one cycle more delay of the outputs seen in the tracking error. The
+# wakeup latency of the host adds to both layouts alike, run it on an isolated cpu with -c.
+
+EXE=${1:-./ECT60ctrl}
+AXES=${2:-16}
+DURATION=${3:-5}
+
+for layout in classic sendfirst
+do
+	out=$($EXE -n $AXES -b $DURATION -L $layout -m 9 -v 1000 -s "" 2>&1)
+	echo "== $layout"
+	echo "$out" | grep -E "^bench: .*(exec|send) |^bench: layout|^tracking: axis  1 "
+done
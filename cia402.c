@@ -0,0 +1,36 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cia402.h"
+
+/****************************************************************************/
+
+const char* cia402_state_name(cia402_state_t state)
+{
+	static const char* names[CIA402_STATES] = {
+		[CIA402_NOT_READY_TO_SWITCH_ON] = "Not ready",
+		[CIA402_SWITCH_ON_DISABLED] = "Switch on disabled",
+		[CIA402_READY_TO_SWITCH_ON] = "Ready to switch on",
+		[CIA402_SWITCHED_ON] = "Switched on",
+		[CIA402_OPERATION_ENABLED] = "Operation enabled",
+		[CIA402_QUICK_STOP_ACTIVE] = "Quick stop active",
+		[CIA402_FAULT_REACTION_ACTIVE] = "Fault reaction",
+		[CIA402_FAULT] = "Fault"
+	};
+
+	return (state < CIA402_STATES) ? names[state] : "Unknown";
+}
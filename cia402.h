@@ -0,0 +1,154 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CIA402_H_
+#define CIA402_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CiA402 power state machine of a drive. The state is decoded from the statusword every
+// cycle and the controlword leading to the requested state with the fewest transitions is
+// returned. A fault is reset automatically as long as the axis is requested to be enabled.
+
+// Controlword commands
+#define CIA402_CW_DISABLE_VOLTAGE	0x0000
+#define CIA402_CW_SHUTDOWN			0x0006
+#define CIA402_CW_SWITCH_ON			0x0007
+#define CIA402_CW_ENABLE_OPERATION	0x000f
+#define CIA402_CW_FAULT_RESET		0x0080
+
+// Statusword bit of a fault
+#define CIA402_SW_FAULT				0x0008
+
+// Cycles the fault reset bit is held before it is released for another rising edge
+#define CIA402_FAULT_RESET_CYCLES 100
+
+typedef enum
+{
+	CIA402_NOT_READY_TO_SWITCH_ON = 0,
+	CIA402_SWITCH_ON_DISABLED,
+	CIA402_READY_TO_SWITCH_ON,
+	CIA402_SWITCHED_ON,
+	CIA402_OPERATION_ENABLED,
+	CIA402_QUICK_STOP_ACTIVE,
+	CIA402_FAULT_REACTION_ACTIVE,
+	CIA402_FAULT,
+	CIA402_STATES
+}cia402_state_t;
+
+typedef struct
+{
+	cia402_state_t state;
+	uint16_t controlword;			// Controlword written in the last cycle
+	unsigned int reset_cycles;		// Cycles the fault reset bit is held
+	uint64_t enable_start_ns;		// Time enabling was started, 0 if not enabling
+	uint32_t enable_time_ns;		// Duration of the last enabling until operation enabled
+	uint32_t transitions;
+	uint32_t faults;
+}cia402_axis_t;
+
+static inline cia402_state_t cia402_decode(uint16_t statusword)
+{
+	switch (statusword & 0x006f)
+	{
+	case 0x0021: return CIA402_READY_TO_SWITCH_ON;
+	case 0x0023: return CIA402_SWITCHED_ON;
+	case 0x0027: return CIA402_OPERATION_ENABLED;
+	case 0x0007: return CIA402_QUICK_STOP_ACTIVE;
+	}
+	switch (statusword & 0x004f)
+	{
+	case 0x0040: return CIA402_SWITCH_ON_DISABLED;
+	case 0x000f: return CIA402_FAULT_REACTION_ACTIVE;
+	case 0x0008: return CIA402_FAULT;
+	}
+	return CIA402_NOT_READY_TO_SWITCH_ON;
+}
+
+// Called by cyclic_task for every axis. Returns the controlword to write in this cycle.
+static inline uint16_t cia402_step(cia402_axis_t* axis, uint16_t statusword, bool enable, uint64_t now_ns)
+{
+	cia402_state_t state = cia402_decode(statusword);
+	uint16_t controlword;
+
+	if (state != axis->state)
+	{
+		axis->transitions++;
+		if (state == CIA402_FAULT)
+			axis->faults++;
+		axis->state = state;
+	}
+
+	switch (state)
+	{
+	case CIA402_SWITCH_ON_DISABLED:
+		controlword = CIA402_CW_SHUTDOWN;
+		break;
+	case CIA402_READY_TO_SWITCH_ON:
+	case CIA402_SWITCHED_ON:
+		// Switch on and enable operation are passed in one step
+		controlword = enable ? CIA402_CW_ENABLE_OPERATION : CIA402_CW_SHUTDOWN;
+		break;
+	case CIA402_OPERATION_ENABLED:
+		controlword = enable ? CIA402_CW_ENABLE_OPERATION : CIA402_CW_SHUTDOWN;
+		break;
+	case CIA402_FAULT:
+		// The reset is triggered by the rising edge of the fault reset bit
+		if (enable && (axis->reset_cycles < CIA402_FAULT_RESET_CYCLES))
+		{
+			controlword = CIA402_CW_FAULT_RESET;
+			axis->reset_cycles++;
+		}
+		else
+		{
+			controlword = CIA402_CW_DISABLE_VOLTAGE;
+			axis->reset_cycles = 0;
+		}
+		break;
+	default:
+		// Not ready, fault reaction and quick stop are left by the drive or to switch on disabled
+		controlword = CIA402_CW_DISABLE_VOLTAGE;
+		break;
+	}
+	if (state != CIA402_FAULT)
+	{
+		axis->reset_cycles = 0;
+	}
+
+	// Time to operation enabled, measured from the first cycle enabling is requested in another state
+	if (enable && (state != CIA402_OPERATION_ENABLED) && (axis->enable_start_ns == 0))
+	{
+		axis->enable_start_ns = now_ns;
+	}
+	else if ((state == CIA402_OPERATION_ENABLED) && axis->enable_start_ns)
+	{
+		axis->enable_time_ns = now_ns - axis->enable_start_ns;
+		axis->enable_start_ns = 0;
+	}
+	else if (!enable)
+	{
+		axis->enable_start_ns = 0;
+	}
+
+	axis->controlword = controlword;
+	return controlword;
+}
+
+const char* cia402_state_name(cia402_state_t state);
+
+#endif /* CIA402_H_ */
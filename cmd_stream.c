@@ -0,0 +1,328 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmd_stream.h"
+
+/****************************************************************************/
+
+static cmd_stream_t* served_stream;
+static int server_fd = -1;
+
+// Counters of a single writer are incremented by a plain load/store pair
+static inline void cmd_stream_add(atomic_ulong* counter, unsigned long value)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void cmd_stream_max(atomic_ulong* max, unsigned long value)
+{
+	if (value > atomic_load_explicit(max, memory_order_relaxed))
+	{
+		atomic_store_explicit(max, value, memory_order_relaxed);
+	}
+}
+
+static uint64_t cmd_stream_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+unsigned int cmd_stream_depth(cmd_stream_t* stream)
+{
+	return atomic_load_explicit(&stream->head, memory_order_acquire) -
+			atomic_load_explicit(&stream->tail, memory_order_acquire);
+}
+
+const char* cmd_stream_state_name(cmd_stream_state_t state)
+{
+	static const char* names[CMD_STREAM_STATES] = {"idle", "active", "underrun", "stopped", "ended"};
+
+	return (state < CMD_STREAM_STATES) ? names[state] : "?";
+}
+
+/****************************************************************************/
+
+// Queues all entries of a batch or none. The head is published once, so the cycle never sees a
+// part of a batch.
+static cmd_stream_status_t cmd_stream_queue(cmd_stream_t* stream, const cmd_stream_batch_t* batch,
+		const cmd_stream_entry_t* entries, uint64_t now_ns)
+{
+	unsigned int head = atomic_load_explicit(&stream->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&stream->tail, memory_order_acquire);
+
+	if ((head - tail) + batch->count > CMD_STREAM_QUEUE_SIZE)
+	{
+		return CMD_STREAM_FULL;
+	}
+	for (unsigned int i = 0; i < batch->count; i++)
+	{
+		cmd_stream_slot_t* slot = &stream->slots[(head + i) & CMD_STREAM_QUEUE_MASK];
+
+		slot->entry = entries[i];
+		slot->sent_ns = batch->sent_ns;
+		slot->queued_ns = now_ns;
+		slot->start_ns = batch->start_ns;
+		slot->flags = (i == 0) ? CMD_STREAM_SLOT_FIRST : 0;
+		if ((i == batch->count - 1u) && (batch->flags & CMD_STREAM_FLAG_END))
+		{
+			slot->flags |= CMD_STREAM_SLOT_END;
+		}
+	}
+	atomic_store_explicit(&stream->head, head + batch->count, memory_order_release);
+	return CMD_STREAM_OK;
+}
+
+// Entries command the axes in use only, in a mode the cycle supports
+static bool cmd_stream_entries_valid(const cmd_stream_t* stream, const cmd_stream_entry_t* entries, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (entries[i].enable_mask >> stream->axes)
+		{
+			return false;
+		}
+		for (unsigned int a = 0; a < stream->axes; a++)
+		{
+			if ((entries[i].mode_of_operation[a] != CMD_STREAM_MODE_PROFILE_VELOCITY) &&
+					(entries[i].mode_of_operation[a] != CMD_STREAM_MODE_CYCLIC_SYNC_VELOCITY))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Serves one client after the other, every message is one batch and answered by an ack
+static void* cmd_stream_thread(void* arg)
+{
+	static union
+	{
+		cmd_stream_batch_t batch;
+		uint8_t bytes[sizeof(cmd_stream_batch_t) + CMD_STREAM_BATCH_MAX * sizeof(cmd_stream_entry_t)];
+	}message;
+	cmd_stream_t* stream = arg;
+	cmd_stream_stats_t* stats = &stream->stats;
+
+	while (1)
+	{
+		int fd = accept(server_fd, NULL, NULL);
+		ssize_t len;
+
+		if (fd == -1)
+		{
+			continue;
+		}
+		while ((len = recv(fd, &message, sizeof(message), 0)) > 0)
+		{
+			uint64_t now_ns = cmd_stream_now_ns();
+			cmd_stream_ack_t ack = {.magic = CMD_STREAM_MAGIC, .period_ns = stream->period_ns};
+			const cmd_stream_entry_t* entries = (const cmd_stream_entry_t*)(message.bytes + sizeof(cmd_stream_batch_t));
+
+			if ((len < (ssize_t)sizeof(cmd_stream_batch_t)) || (message.batch.magic != CMD_STREAM_MAGIC) ||
+					(message.batch.version != CMD_STREAM_VERSION) || (message.batch.count > CMD_STREAM_BATCH_MAX) ||
+					(len != (ssize_t)(sizeof(cmd_stream_batch_t) + message.batch.count * sizeof(cmd_stream_entry_t))))
+			{
+				ack.status = CMD_STREAM_INVALID;
+			}
+			else if (!cmd_stream_entries_valid(stream, entries, message.batch.count))
+			{
+				ack.status = CMD_STREAM_INVALID;
+			}
+			else if (message.batch.count)
+			{
+				ack.status = cmd_stream_queue(stream, &message.batch, entries, now_ns);
+			}
+			if (ack.status != CMD_STREAM_OK)
+			{
+				cmd_stream_add(&stats->rejected, 1);
+			}
+			else if (message.batch.count)
+			{
+				cmd_stream_add(&stats->batches, 1);
+				// The clock of the client is the same, a batch sent before it was queued is measured
+				if ((message.batch.sent_ns != 0) && (message.batch.sent_ns <= now_ns))
+				{
+					cmd_stream_add(&stats->transport_count, 1);
+					cmd_stream_add(&stats->transport_sum_ns, now_ns - message.batch.sent_ns);
+					cmd_stream_max(&stats->transport_max_ns, now_ns - message.batch.sent_ns);
+				}
+			}
+			ack.depth = cmd_stream_depth(stream);
+			ack.free = CMD_STREAM_QUEUE_SIZE - ack.depth;
+			ack.state = atomic_load_explicit(&stats->state, memory_order_relaxed);
+			ack.applied = atomic_load_explicit(&stats->applied, memory_order_relaxed);
+			ack.underrun_cycles = atomic_load_explicit(&stats->underrun_cycles, memory_order_relaxed);
+			if (send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+			{
+				break;
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+int cmd_stream_serve(cmd_stream_t* stream, const char* path, uint32_t period_ns, unsigned int axes)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	pthread_t thread;
+
+	memset(stream, 0, sizeof(cmd_stream_t));
+	stream->period_ns = period_ns;
+	stream->axes = axes;
+	stream->underrun_stop_cycles = (CMD_STREAM_UNDERRUN_STOP_MS * 1000000ULL) / period_ns;
+	atomic_init(&stream->stats.depth_min, UINT_MAX);
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "command stream socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	server_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (server_fd == -1)
+	{
+		perror("socket of command stream failed");
+		return -1;
+	}
+	// A socket left by a previous run is replaced
+	unlink(path);
+	if ((bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) || (listen(server_fd, 4) == -1))
+	{
+		perror("bind of command stream socket failed");
+		close(server_fd);
+		return -1;
+	}
+	if (pthread_create(&thread, NULL, &cmd_stream_thread, stream) != 0)
+	{
+		close(server_fd);
+		return -1;
+	}
+	pthread_detach(thread);
+	served_stream = stream;
+	return 0;
+}
+
+cmd_stream_t* cmd_stream_served(void)
+{
+	return served_stream;
+}
+
+/****************************************************************************/
+
+static void cmd_stream_set_state(cmd_stream_t* stream, cmd_stream_state_t state)
+{
+	atomic_store_explicit(&stream->stats.state, state, memory_order_relaxed);
+}
+
+const cmd_stream_entry_t* cmd_stream_cycle(cmd_stream_t* stream, uint32_t gui_sequence, uint64_t now_ns)
+{
+	cmd_stream_stats_t* stats = &stream->stats;
+	cmd_stream_state_t state = atomic_load_explicit(&stats->state, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&stream->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&stream->head, memory_order_acquire);
+	cmd_stream_slot_t* slot;
+	unsigned int depth;
+
+	// A new command of the gui takes over the axes
+	if (!stream->gui_seen || (gui_sequence != stream->gui_sequence))
+	{
+		if (stream->gui_seen && (state != CMD_STREAM_IDLE))
+		{
+			cmd_stream_add(&stats->aborts, 1);
+			atomic_store_explicit(&stream->tail, head, memory_order_release);
+			cmd_stream_set_state(stream, CMD_STREAM_IDLE);
+			state = CMD_STREAM_IDLE;
+			tail = head;
+		}
+		stream->gui_seen = true;
+		stream->gui_sequence = gui_sequence;
+	}
+
+	if (head == tail)
+	{
+		switch (state)
+		{
+		case CMD_STREAM_IDLE:
+			return NULL;
+		case CMD_STREAM_ACTIVE:
+			cmd_stream_add(&stats->underrun_runs, 1);
+			stream->underrun_length = 0;
+			cmd_stream_set_state(stream, CMD_STREAM_UNDERRUN);
+			// fall through
+		case CMD_STREAM_UNDERRUN:
+			cmd_stream_add(&stats->underrun_cycles, 1);
+			if (++stream->underrun_length >= stream->underrun_stop_cycles)
+			{
+				for (unsigned int a = 0; a < CMD_STREAM_MAX_AXES; a++)
+				{
+					stream->applied.velocity_setpoint[a] = 0;
+				}
+				cmd_stream_add(&stats->stops, 1);
+				cmd_stream_set_state(stream, CMD_STREAM_STOPPED);
+			}
+			return &stream->applied;
+		default:
+			return &stream->applied;
+		}
+	}
+
+	slot = &stream->slots[tail & CMD_STREAM_QUEUE_MASK];
+	// A new stream waits for its start time, an underrun resumes immediately
+	if ((state != CMD_STREAM_ACTIVE) && (state != CMD_STREAM_UNDERRUN) && (slot->start_ns > now_ns))
+	{
+		return (state == CMD_STREAM_IDLE) ? NULL : &stream->applied;
+	}
+	stream->last = *slot;
+	stream->applied = stream->last.entry;
+	atomic_store_explicit(&stream->tail, tail + 1, memory_order_release);
+
+	cmd_stream_add(&stats->applied, 1);
+	if ((stream->last.flags & CMD_STREAM_SLOT_FIRST) && (now_ns >= stream->last.queued_ns))
+	{
+		cmd_stream_add(&stats->queue_count, 1);
+		cmd_stream_add(&stats->queue_sum_ns, now_ns - stream->last.queued_ns);
+		cmd_stream_max(&stats->queue_max_ns, now_ns - stream->last.queued_ns);
+	}
+	if (stream->last.flags & CMD_STREAM_SLOT_END)
+	{
+		cmd_stream_set_state(stream, CMD_STREAM_ENDED);
+		return &stream->applied;
+	}
+	depth = head - (tail + 1);
+	if (depth < atomic_load_explicit(&stats->depth_min, memory_order_relaxed))
+	{
+		atomic_store_explicit(&stats->depth_min, depth, memory_order_relaxed);
+	}
+	if (depth > atomic_load_explicit(&stats->depth_max, memory_order_relaxed))
+	{
+		atomic_store_explicit(&stats->depth_max, depth, memory_order_relaxed);
+	}
+	cmd_stream_set_state(stream, CMD_STREAM_ACTIVE);
+	return &stream->applied;
+}
@@ -0,0 +1,170 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMD_STREAM_H_
+#define CMD_STREAM_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Streaming of setpoints from a local motion program. A client connects to a Unix socket of type
+// SOCK_SEQPACKET and sends batches, each one message of a cmd_stream_batch_t followed by count
+// entries. Every batch is answered by a cmd_stream_ack_t. The entries are queued in a ring
+// allocated at startup, cyclic_task applies one entry per cycle to the velocity setpoint 0x60ff,
+// mode of operation and enable request of all axes. The setpoint generator is bypassed, so the
+// trajectory is written as streamed. Only one client is served at a time.
+//
+// The first entry of a stream is applied in the first cycle whose wakeup is at or after start_ns
+// of its batch, later batches are appended. If the queue runs empty before an entry flagged as end
+// of the stream, the last entry is held and counted as underrun; after CMD_STREAM_UNDERRUN_STOP_MS
+// the setpoints are set to zero with the limits of the gui command. New entries resume the stream.
+// After the end or a stop the last setpoints are held until the next stream or a command of the
+// gui. A command of the gui aborts the stream and drops the queued entries.
+//
+// The header does not depend on the master, so clients include it alone.
+// Socket of the clients if none is given
+#define CMD_STREAM_SOCKET_DEFAULT "/tmp/ect60ctrl_cmd.sock"
+#define CMD_STREAM_MAGIC 0x45435343		// "ECSC"
+#define CMD_STREAM_VERSION 1
+// Queued entries, a power of two. 4 s at 1 kHz.
+#define CMD_STREAM_QUEUE_SIZE 4096
+#define CMD_STREAM_QUEUE_MASK (CMD_STREAM_QUEUE_SIZE - 1)
+#define CMD_STREAM_BATCH_MAX 256
+#define CMD_STREAM_UNDERRUN_STOP_MS 100
+// Must equal MAX_AXES of the application
+#define CMD_STREAM_MAX_AXES 16
+#define CMD_STREAM_CACHELINE_SIZE 64
+
+// Flags of a batch
+#define CMD_STREAM_FLAG_END 0x1			// The last entry ends the stream
+
+// Modes of operation of an entry, profile velocity and cyclic synchronous velocity
+#define CMD_STREAM_MODE_PROFILE_VELOCITY 3
+#define CMD_STREAM_MODE_CYCLIC_SYNC_VELOCITY 9
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;						// Entries following, 0 only queries the state
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t sent_ns;					// CLOCK_MONOTONIC time the batch was sent
+	uint64_t start_ns;					// Wakeup time the stream starts at, 0 immediately
+}cmd_stream_batch_t;
+
+typedef struct
+{
+	uint32_t enable_mask;				// Bit a requests operation enabled of axis a + 1, only axes in use
+	int8_t mode_of_operation[CMD_STREAM_MAX_AXES];	// 0x6060 of the axes in use, CMD_STREAM_MODE_*
+	int32_t velocity_setpoint[CMD_STREAM_MAX_AXES];	// 0x60ff
+}cmd_stream_entry_t;
+
+typedef enum
+{
+	CMD_STREAM_OK = 0,
+	CMD_STREAM_FULL,					// The batch does not fit into the queue and was dropped, retry later
+	CMD_STREAM_INVALID					// Wrong magic, version, size or an entry with a wrong mode or enable mask
+}cmd_stream_status_t;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t status;					// cmd_stream_status_t
+	uint32_t period_ns;					// Cycle period, one entry is applied per period
+	uint32_t depth;						// Entries queued including this batch
+	uint32_t free;
+	uint32_t state;						// cmd_stream_state_t
+	uint64_t applied;
+	uint64_t underrun_cycles;
+}cmd_stream_ack_t;
+
+typedef enum
+{
+	CMD_STREAM_IDLE = 0,				// The gui commands the axes
+	CMD_STREAM_ACTIVE,
+	CMD_STREAM_UNDERRUN,				// Queue empty, the last entry is held
+	CMD_STREAM_STOPPED,					// Queue empty for too long, setpoints zero with the limits of the gui
+	CMD_STREAM_ENDED,					// The last entry is held
+	CMD_STREAM_STATES
+}cmd_stream_state_t;
+
+typedef struct
+{
+	cmd_stream_entry_t entry;
+	uint64_t sent_ns;					// Of the batch
+	uint64_t queued_ns;					// Time the batch was queued
+	uint64_t start_ns;
+	uint32_t flags;						// CMD_STREAM_SLOT_*
+}cmd_stream_slot_t;
+
+#define CMD_STREAM_SLOT_FIRST 0x1		// First entry of a batch
+#define CMD_STREAM_SLOT_END 0x2
+
+// Counters written by a single thread each, read by anyone
+typedef struct
+{
+	// Socket thread
+	atomic_ulong batches;
+	atomic_ulong rejected;
+	atomic_ulong transport_count;		// Time from sending until queuing a batch
+	atomic_ulong transport_sum_ns;
+	atomic_ulong transport_max_ns;
+	// cyclic_task
+	atomic_uint state;
+	atomic_ulong applied;
+	atomic_ulong underrun_cycles;
+	atomic_ulong underrun_runs;
+	atomic_ulong stops;
+	atomic_ulong aborts;
+	atomic_ulong queue_count;			// Time from queuing a batch until applying its first entry
+	atomic_ulong queue_sum_ns;
+	atomic_ulong queue_max_ns;
+	atomic_uint depth_min;				// Fewest entries left after applying one within a stream
+	atomic_uint depth_max;
+}cmd_stream_stats_t;
+
+typedef struct cmd_stream
+{
+	// Producer cache line: written by the socket thread only
+	_Alignas(CMD_STREAM_CACHELINE_SIZE) atomic_uint head;
+	// Consumer cache line: written by cyclic_task only
+	_Alignas(CMD_STREAM_CACHELINE_SIZE) atomic_uint tail;
+	uint32_t gui_sequence;
+	bool gui_seen;
+	unsigned int underrun_length;
+	unsigned int underrun_stop_cycles;
+	cmd_stream_slot_t last;
+	cmd_stream_entry_t applied;			// Applied instead of the gui command
+	uint32_t period_ns;
+	unsigned int axes;
+	cmd_stream_stats_t stats;
+	_Alignas(CMD_STREAM_CACHELINE_SIZE) cmd_stream_slot_t slots[CMD_STREAM_QUEUE_SIZE];
+}cmd_stream_t;
+
+// Must be called before the calling thread raises its priority, the thread inherits the normal policy
+int cmd_stream_serve(cmd_stream_t* stream, const char* path, uint32_t period_ns, unsigned int axes);
+// Called by cyclic_task once per cycle with the sequence number of the gui command. Returns the
+// entry to apply instead of the gui command or NULL. Wait-free and without system call.
+const cmd_stream_entry_t* cmd_stream_cycle(cmd_stream_t* stream, uint32_t gui_sequence, uint64_t now_ns);
+// Stream served by this process or NULL
+cmd_stream_t* cmd_stream_served(void);
+unsigned int cmd_stream_depth(cmd_stream_t* stream);
+const char* cmd_stream_state_name(cmd_stream_state_t state);
+
+#endif /* CMD_STREAM_H_ */
@@ -0,0 +1,194 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "cycle_health.h"
+
+/****************************************************************************/
+
+// Interval the overrun log is checked in
+#define CYCLE_HEALTH_LOG_MS 100
+
+static cycle_health_t* served_health;
+static int server_fd = -1;
+static unsigned long events_logged;
+
+void cycle_health_init(cycle_health_t* health, uint32_t period_ns)
+{
+	memset(health, 0, sizeof(cycle_health_t));
+	health->period_ns = period_ns;
+}
+
+// Prometheus text exposition format, one metric per line
+int cycle_health_format(cycle_health_t* health, char* text, size_t size)
+{
+	const struct
+	{
+		const char* name;
+		const char* help;
+		const char* type;			// "counter" or "gauge"
+		atomic_ulong* value;
+		double scale;				// Integer value if 1.0
+	}metrics[] = {
+		{"ect60_cycles_total", "Cycles run", "counter", &health->cycles, 1.0},
+		{"ect60_wc_incomplete_cycles_total", "Cycles without complete working counter", "counter", &health->wc_incomplete_cycles, 1.0},
+		{"ect60_wc_incomplete_runs_total", "Runs of cycles without complete working counter", "counter", &health->wc_incomplete_runs, 1.0},
+		{"ect60_wc_incomplete_longest_seconds", "Longest run without complete working counter", "gauge",
+				&health->wc_incomplete_longest, health->period_ns / 1e9},
+		{"ect60_overruns_total", "Cycle periods above twice the nominal period", "counter", &health->overruns, 1.0},
+		{"ect60_overrun_longest_seconds", "Longest cycle period of an overrun", "gauge", &health->overrun_longest_ns, 1e-9},
+		{"ect60_link_drops_total", "Link drops", "counter", &health->link_drops, 1.0},
+		{"ect60_link_down_cycles_total", "Cycles with the link down", "counter", &health->link_down_cycles, 1.0},
+		{"ect60_link_down_longest_seconds", "Longest time the link was down", "gauge", &health->link_down_longest,
+				health->period_ns / 1e9},
+		{"ect60_deadline_misses_total", "Wakeups with the deadline already passed", "counter", &health->deadline_misses, 1.0},
+		{"ect60_skipped_cycles_total", "Cycles skipped after a missed deadline", "counter", &health->skipped_cycles, 1.0},
+		{"ect60_overrun_stopped", "Axes stopped by an overrun", "gauge", &health->stopped, 1.0},
+	};
+	int len = snprintf(text, size, "# HELP ect60_period_seconds Nominal cycle period\n"
+			"# TYPE ect60_period_seconds gauge\nect60_period_seconds %g\n", health->period_ns / 1e9);
+
+	for (unsigned int i = 0; (i < sizeof(metrics) / sizeof(metrics[0])) && (len < (int)size); i++)
+	{
+		unsigned long value = atomic_load_explicit(metrics[i].value, memory_order_relaxed);
+
+		len += snprintf(text + len, size - len, "# HELP %s %s\n# TYPE %s %s\n", metrics[i].name, metrics[i].help,
+				metrics[i].name, metrics[i].type);
+		if (len >= (int)size)
+			break;
+		if (metrics[i].scale == 1.0)
+			len += snprintf(text + len, size - len, "%s %lu\n", metrics[i].name, value);
+		else
+			len += snprintf(text + len, size - len, "%s %.9f\n", metrics[i].name, value * metrics[i].scale);
+	}
+	return len;
+}
+
+// Logs the overruns written since the last call
+static void cycle_health_log(cycle_health_t* health)
+{
+	static const char* actions[] = {"skipped to the next slot", "catching up", "axes stopped"};
+	unsigned long written = atomic_load_explicit(&health->events_written, memory_order_acquire);
+
+	if (written - events_logged > CYCLE_HEALTH_EVENTS)
+	{
+		syslog(LOG_WARNING, "%lu overruns not logged", written - events_logged - CYCLE_HEALTH_EVENTS);
+		events_logged = written - CYCLE_HEALTH_EVENTS;
+	}
+	for (; events_logged < written; events_logged++)
+	{
+		cycle_health_event_t* event = &health->events[events_logged % CYCLE_HEALTH_EVENTS];
+		unsigned long cycle = atomic_load_explicit(&event->cycle, memory_order_relaxed);
+		unsigned long late_ns = atomic_load_explicit(&event->late_ns, memory_order_relaxed);
+		unsigned int missed = atomic_load_explicit(&event->missed, memory_order_relaxed);
+		unsigned int action = atomic_load_explicit(&event->action, memory_order_relaxed);
+
+		// The entry may have been overwritten while it was read
+		if (atomic_load_explicit(&health->events_written, memory_order_acquire) - events_logged > CYCLE_HEALTH_EVENTS)
+		{
+			continue;
+		}
+		syslog(LOG_WARNING, "cycle %lu overrun: deadline passed by %.1f us, %u missed, %s", cycle, late_ns / 1000.0,
+				missed, (action < 3) ? actions[action] : "?");
+	}
+}
+
+// Every connection gets the current counters and is closed, e.g. by "socat - UNIX-CONNECT:path"
+static void* cycle_health_thread(void* arg)
+{
+	char text[4096];
+	struct pollfd server = {.fd = server_fd, .events = POLLIN};
+
+	(void)arg;
+	while (1)
+	{
+		int fd, len;
+
+		cycle_health_log(served_health);
+		if (poll(&server, (server_fd != -1) ? 1 : 0, CYCLE_HEALTH_LOG_MS) <= 0)
+		{
+			continue;
+		}
+		if ((fd = accept(server_fd, NULL, NULL)) == -1)
+		{
+			continue;
+		}
+		len = cycle_health_format(served_health, text, sizeof(text));
+		if (len > (int)sizeof(text) - 1)
+		{
+			len = sizeof(text) - 1;
+		}
+		if (write(fd, text, len) != len)
+		{
+			perror("cycle health write failed");
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+// Must be called before the calling thread raises its priority, the thread inherits the normal policy
+int cycle_health_serve(cycle_health_t* health, const char* path, bool log_stderr)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	pthread_t thread;
+
+	openlog("ECT60ctrl", LOG_PID | (log_stderr ? LOG_PERROR : 0), LOG_DAEMON);
+	served_health = health;
+	events_logged = atomic_load(&health->events_written);
+	if (path[0] == '\0')
+	{
+		// Only the log
+	}
+	else if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "cycle health socket path too long: %s\n", path);
+		return -1;
+	}
+	else
+	{
+		strcpy(addr.sun_path, path);
+		server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (server_fd == -1)
+		{
+			perror("socket of cycle health failed");
+			return -1;
+		}
+		// A socket left by a previous run is replaced
+		unlink(path);
+		if ((bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) || (listen(server_fd, 4) == -1))
+		{
+			perror("bind of cycle health socket failed");
+			close(server_fd);
+			return -1;
+		}
+	}
+	if (pthread_create(&thread, NULL, &cycle_health_thread, NULL) != 0)
+	{
+		close(server_fd);
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
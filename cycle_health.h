@@ -0,0 +1,144 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CYCLE_HEALTH_H_
+#define CYCLE_HEALTH_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Monotonic counters of degraded cycles, maintained by cyclic_task with relaxed atomic
+// increments and exported as text on a Unix socket for monitoring. A run is a sequence of
+// consecutive cycles with the same condition, its duration is counted in cycles.
+
+#define CYCLE_HEALTH_SOCKET_DEFAULT "/tmp/ect60ctrl.sock"
+// A period longer than this multiple of the nominal period is counted as overrun
+#define CYCLE_HEALTH_OVERRUN_FACTOR 2
+// Missed deadlines kept for the log, older ones are lost if the log falls behind
+#define CYCLE_HEALTH_EVENTS 64
+
+// Reaction of cyclic_task to a wakeup deadline already passed
+typedef enum
+{
+	CYCLE_OVERRUN_SKIP = 0,		// Continue at the next aligned slot
+	CYCLE_OVERRUN_CATCH_UP,		// Run the missed cycles back to back up to a bounded count, then skip
+	CYCLE_OVERRUN_STOP			// Disable all axes and skip
+}cycle_overrun_policy_t;
+
+typedef struct
+{
+	atomic_ulong cycle;
+	atomic_ulong late_ns;					// Time the deadline had passed
+	atomic_uint missed;						// Deadlines passed
+	atomic_uint action;						// cycle_overrun_policy_t applied
+}cycle_health_event_t;
+
+typedef struct
+{
+	_Alignas(64) atomic_ulong cycles;
+	atomic_ulong wc_incomplete_cycles;		// Cycles without complete working counter
+	atomic_ulong wc_incomplete_runs;
+	atomic_ulong wc_incomplete_longest;		// Cycles of the longest run
+	atomic_ulong overruns;					// Periods above CYCLE_HEALTH_OVERRUN_FACTOR * nominal
+	atomic_ulong overrun_longest_ns;		// Longest period of an overrun
+	atomic_ulong link_drops;
+	atomic_ulong link_down_cycles;
+	atomic_ulong link_down_longest;			// Cycles of the longest run
+	atomic_ulong deadline_misses;			// Wakeups with the deadline already passed
+	atomic_ulong skipped_cycles;			// Cycles left out to continue at an aligned slot
+	atomic_ulong stopped;					// 1 after the axes were stopped by an overrun
+	atomic_ulong events_written;
+	cycle_health_event_t events[CYCLE_HEALTH_EVENTS];
+	// Only used by the writer
+	_Alignas(64) unsigned long wc_run;
+	unsigned long link_run;
+	uint32_t period_ns;
+}cycle_health_t;
+
+// Counts a run of cycles with a condition and keeps the longest one
+static inline void cycle_health_run(bool active, unsigned long* run, atomic_ulong* cycles, atomic_ulong* runs,
+		atomic_ulong* longest)
+{
+	if (!active)
+	{
+		*run = 0;
+		return;
+	}
+	if ((*run)++ == 0)
+	{
+		atomic_fetch_add_explicit(runs, 1, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(cycles, 1, memory_order_relaxed);
+	if (*run > atomic_load_explicit(longest, memory_order_relaxed))
+	{
+		atomic_store_explicit(longest, *run, memory_order_relaxed);
+	}
+}
+
+// Called by cyclic_task every cycle after the domain was processed
+static inline void cycle_health_update(cycle_health_t* health, bool wc_complete, bool link_up)
+{
+	atomic_fetch_add_explicit(&health->cycles, 1, memory_order_relaxed);
+	cycle_health_run(!wc_complete, &health->wc_run, &health->wc_incomplete_cycles, &health->wc_incomplete_runs,
+			&health->wc_incomplete_longest);
+	cycle_health_run(!link_up, &health->link_run, &health->link_down_cycles, &health->link_drops,
+			&health->link_down_longest);
+}
+
+// Called by cyclic_task with the measured time since the start of the last cycle
+static inline void cycle_health_period(cycle_health_t* health, uint32_t period_ns)
+{
+	if (period_ns > CYCLE_HEALTH_OVERRUN_FACTOR * health->period_ns)
+	{
+		atomic_fetch_add_explicit(&health->overruns, 1, memory_order_relaxed);
+		if (period_ns > atomic_load_explicit(&health->overrun_longest_ns, memory_order_relaxed))
+		{
+			atomic_store_explicit(&health->overrun_longest_ns, period_ns, memory_order_relaxed);
+		}
+	}
+}
+
+// Called by cyclic_task for a wakeup deadline already passed. The event is logged by the health thread.
+static inline void cycle_health_overrun(cycle_health_t* health, unsigned long cycle, uint64_t late_ns, unsigned int missed,
+		unsigned int skipped, cycle_overrun_policy_t action)
+{
+	unsigned long n = atomic_load_explicit(&health->events_written, memory_order_relaxed);
+	cycle_health_event_t* event = &health->events[n % CYCLE_HEALTH_EVENTS];
+
+	atomic_fetch_add_explicit(&health->deadline_misses, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&health->skipped_cycles, skipped, memory_order_relaxed);
+	atomic_store_explicit(&event->cycle, cycle, memory_order_relaxed);
+	atomic_store_explicit(&event->late_ns, late_ns, memory_order_relaxed);
+	atomic_store_explicit(&event->missed, missed, memory_order_relaxed);
+	atomic_store_explicit(&event->action, action, memory_order_relaxed);
+	atomic_store_explicit(&health->events_written, n + 1, memory_order_release);
+	if (action == CYCLE_OVERRUN_STOP)
+	{
+		atomic_store_explicit(&health->stopped, 1, memory_order_relaxed);
+	}
+}
+
+void cycle_health_init(cycle_health_t* health, uint32_t period_ns);
+// Starts a thread logging the overruns to syslog, and to stderr if requested. If path is not
+// empty, it answers every connection to the socket at path with the counters as text.
+int cycle_health_serve(cycle_health_t* health, const char* path, bool log_stderr);
+// Writes the counters in the text format of the socket, returns the length as snprintf
+int cycle_health_format(cycle_health_t* health, char* text, size_t size);
+
+#endif /* CYCLE_HEALTH_H_ */
@@ -0,0 +1,254 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cycle_stats.h"
+
+/****************************************************************************/
+
+static void cycle_stats_window_reset(cycle_stats_window_t* window, uint64_t start_ns)
+{
+	memset(window, 0, sizeof(cycle_stats_window_t));
+	window->start_ns = start_ns;
+	for (int i = 0; i < CYCLE_STAT_COUNT; i++)
+	{
+		window->hist[i].min = UINT32_MAX;
+	}
+}
+
+static void cycle_hist_merge(cycle_hist_t* dst, const cycle_hist_t* src)
+{
+	for (unsigned int i = 0; i < CYCLE_HIST_BUCKETS; i++)
+	{
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	if (src->min < dst->min)
+	{
+		dst->min = src->min;
+	}
+	if (src->max > dst->max)
+	{
+		dst->max = src->max;
+	}
+}
+
+/****************************************************************************/
+
+// Creates the shared memory segment and prepares the first window. Must be called before
+// the real time cycle starts, so the pages are already mapped and locked by mlockall().
+int cycle_stats_create(cycle_stats_t* stats, uint32_t period_ns, uint32_t window_cycles, cycle_layout_t layout)
+{
+	cycle_stats_shm_t* shm;
+	int fd;
+
+	fd = shm_open(CYCLE_STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd == -1)
+	{
+		perror("shm_open of cycle statistics failed");
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(cycle_stats_shm_t)) == -1)
+	{
+		perror("ftruncate of cycle statistics failed");
+		close(fd);
+		return -1;
+	}
+	shm = mmap(NULL, sizeof(cycle_stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		perror("mmap of cycle statistics failed");
+		return -1;
+	}
+
+	// Invalidate the segment for readers while it is set up
+	shm->magic = 0;
+	atomic_thread_fence(memory_order_release);
+	memset(shm, 0, sizeof(cycle_stats_shm_t));
+	shm->version = CYCLE_STATS_VERSION;
+	shm->period_ns = period_ns;
+	shm->window_cycles = window_cycles;
+	shm->layout = layout;
+	atomic_init(&shm->completed, 0);
+	cycle_stats_window_reset(&shm->windows[0], 0);
+	atomic_thread_fence(memory_order_release);
+	shm->magic = CYCLE_STATS_MAGIC;
+
+	stats->shm = shm;
+	stats->current = &shm->windows[0];
+	stats->total = NULL;
+	return 0;
+}
+
+// Called by cyclic_task at the end of every window. The completed window becomes visible
+// to the readers and the oldest one is reused for the next window.
+void cycle_stats_complete_window(cycle_stats_t* stats, uint64_t now_ns)
+{
+	unsigned long completed = atomic_load_explicit(&stats->shm->completed, memory_order_relaxed);
+
+	stats->current->end_ns = now_ns;
+	if (stats->total)
+	{
+		for (int i = 0; i < CYCLE_STAT_COUNT; i++)
+		{
+			cycle_hist_merge(&stats->total->hist[i], &stats->current->hist[i]);
+		}
+		stats->total->end_ns = now_ns;
+	}
+	completed++;
+	atomic_store_explicit(&stats->shm->completed, completed, memory_order_release);
+	stats->current = &stats->shm->windows[completed % CYCLE_STATS_WINDOWS];
+	cycle_stats_window_reset(stats->current, now_ns);
+}
+
+// Merges every window completed from now on into total as well, for the statistics of a run
+// longer than the windows kept. The samples of the current window were taken before the run,
+// such as by the startup check, and are discarded. Not to be called while the cycle is running.
+void cycle_stats_start_total(cycle_stats_t* stats, cycle_stats_window_t* total, uint64_t now_ns)
+{
+	cycle_stats_window_reset(stats->current, now_ns);
+	cycle_stats_window_reset(total, now_ns);
+	stats->total = total;
+}
+
+/****************************************************************************/
+
+// Maps the shared memory segment of a running ECT60ctrl read only.
+cycle_stats_shm_t* cycle_stats_attach(void)
+{
+	cycle_stats_shm_t* shm;
+	int fd;
+
+	fd = shm_open(CYCLE_STATS_SHM_NAME, O_RDONLY, 0);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(cycle_stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		return NULL;
+	}
+	if ((shm->magic != CYCLE_STATS_MAGIC) || (shm->version != CYCLE_STATS_VERSION))
+	{
+		munmap(shm, sizeof(cycle_stats_shm_t));
+		return NULL;
+	}
+	return shm;
+}
+
+// Merges the latest completed windows into result. At most CYCLE_STATS_WINDOWS-1 windows
+// can be merged. Returns false if no window is complete yet or if the writer reused one of
+// the windows while they were copied, the caller should simply try again later then.
+bool cycle_stats_read(cycle_stats_shm_t* shm, unsigned int windows, cycle_stats_window_t* result)
+{
+	unsigned long completed, oldest;
+
+	completed = atomic_load_explicit(&shm->completed, memory_order_acquire);
+	if (completed == 0)
+	{
+		return false;
+	}
+	if (windows > CYCLE_STATS_WINDOWS - 1)
+	{
+		windows = CYCLE_STATS_WINDOWS - 1;
+	}
+	if (windows > completed)
+	{
+		windows = completed;
+	}
+	oldest = completed - windows;
+
+	cycle_stats_window_reset(result, shm->windows[oldest % CYCLE_STATS_WINDOWS].start_ns);
+	for (unsigned long n = oldest; n < completed; n++)
+	{
+		const cycle_stats_window_t* window = &shm->windows[n % CYCLE_STATS_WINDOWS];
+
+		for (int i = 0; i < CYCLE_STAT_COUNT; i++)
+		{
+			cycle_hist_merge(&result->hist[i], &window->hist[i]);
+		}
+		result->end_ns = window->end_ns;
+	}
+
+	// Window n is overwritten as soon as window n+CYCLE_STATS_WINDOWS-1 is completed
+	atomic_thread_fence(memory_order_acquire);
+	completed = atomic_load_explicit(&shm->completed, memory_order_relaxed);
+	return (completed - oldest) < CYCLE_STATS_WINDOWS;
+}
+
+// Returns the highest value equivalent to the given percentile (0..100) of the histogram.
+uint32_t cycle_hist_percentile(const cycle_hist_t* hist, double percentile)
+{
+	uint64_t target, sum = 0;
+	uint32_t upper;
+
+	if (hist->count == 0)
+	{
+		return 0;
+	}
+	target = (uint64_t)((percentile / 100.0) * hist->count + 0.5);
+	if (target == 0)
+	{
+		target = 1;
+	}
+	for (unsigned int i = 0; i < CYCLE_HIST_BUCKETS; i++)
+	{
+		sum += hist->buckets[i];
+		if (sum >= target)
+		{
+			if (i < (2 * CYCLE_HIST_SUB_COUNT))
+			{
+				upper = i;
+			}
+			else
+			{
+				unsigned int shift = (i / CYCLE_HIST_SUB_COUNT) - 1;
+				unsigned int mantissa = i - (shift * CYCLE_HIST_SUB_COUNT);
+				upper = (uint32_t)((((uint64_t)mantissa + 1) << shift) - 1);
+			}
+			// The bucket bound must not exceed the exact maximum
+			return (upper < hist->max) ? upper : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+// Number of samples in the buckets below the one of value, for a coarse distribution
+uint64_t cycle_hist_count_below(const cycle_hist_t* hist, uint32_t value)
+{
+	uint64_t sum = 0;
+
+	for (unsigned int i = 0; i < cycle_hist_bucket(value); i++)
+	{
+		sum += hist->buckets[i];
+	}
+	return sum;
+}
+
+const char* cycle_layout_name(cycle_layout_t layout)
+{
+	static const char* names[CYCLE_LAYOUTS] = {"classic", "sendfirst"};
+
+	return (layout < CYCLE_LAYOUTS) ? names[layout] : "unknown";
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CYCLE_STATS_H_
+#define CYCLE_STATS_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Name of the POSIX shared memory segment the statistics are published in
+#define CYCLE_STATS_SHM_NAME "/ect60ctrl_cycle_stats"
+#define CYCLE_STATS_MAGIC 0x45435453	// "ECTS"
+#define CYCLE_STATS_VERSION 3
+
+// Log-linear histogram of nanosecond values. Values below 2^(SUB_BITS+1) are counted
+// exactly, above every power of two range is split into 2^SUB_BITS equal buckets.
+// This gives a relative resolution of better than 1/2^SUB_BITS over the full uint32_t range.
+#define CYCLE_HIST_SUB_BITS 5
+#define CYCLE_HIST_SUB_COUNT (1U << CYCLE_HIST_SUB_BITS)
+#define CYCLE_HIST_BUCKETS ((2 * CYCLE_HIST_SUB_COUNT) + ((31 - CYCLE_HIST_SUB_BITS) * CYCLE_HIST_SUB_COUNT))
+
+// Number of windows kept in the shared memory. One is written by the real time thread,
+// the others are complete and may be read and merged to rolling statistics.
+#define CYCLE_STATS_WINDOWS 8
+
+typedef enum
+{
+	CYCLE_STAT_LATENCY = 0,		// Wakeup latency
+	CYCLE_STAT_PERIOD,			// Time between two cycle starts
+	CYCLE_STAT_EXEC,			// Execution time of the cycle
+	CYCLE_STAT_DC_PHASE,		// Absolute phase error to the reference clock if the master follows it
+	CYCLE_STAT_SEND,			// Time from the wakeup until the frame is sent, its spread is the send jitter
+	CYCLE_STAT_COUNT
+}cycle_stat_id_t;
+
+// Order of the work within a cycle
+typedef enum
+{
+	CYCLE_LAYOUT_CLASSIC = 0,	// Receive, cycle logic, send
+	CYCLE_LAYOUT_SEND_FIRST,	// Receive, send the outputs of the previous cycle, cycle logic
+	CYCLE_LAYOUTS
+}cycle_layout_t;
+
+typedef struct
+{
+	uint64_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[CYCLE_HIST_BUCKETS];
+}cycle_hist_t;
+
+typedef struct
+{
+	uint64_t start_ns;			// CLOCK_MONOTONIC time of the first sample in this window
+	uint64_t end_ns;			// CLOCK_MONOTONIC time the window was completed
+	cycle_hist_t hist[CYCLE_STAT_COUNT];
+}cycle_stats_window_t;
+
+// Layout of the shared memory segment. Windows are written in a round robin manner,
+// the window with number n is stored in windows[n % CYCLE_STATS_WINDOWS].
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t period_ns;			// Nominal cycle period
+	uint32_t window_cycles;		// Number of cycles per window
+	uint32_t layout;			// cycle_layout_t of the writer
+	atomic_ulong completed;		// Number of completed windows, window completed-1 is the latest
+	cycle_stats_window_t windows[CYCLE_STATS_WINDOWS];
+}cycle_stats_shm_t;
+
+// Writer handle used by cyclic_task
+typedef struct
+{
+	cycle_stats_shm_t* shm;
+	cycle_stats_window_t* current;
+	cycle_stats_window_t* total;	// Merge of the windows completed since cycle_stats_start_total() or NULL
+}cycle_stats_t;
+
+static inline unsigned int cycle_hist_bucket(uint32_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < (2 * CYCLE_HIST_SUB_COUNT))
+	{
+		return value;
+	}
+	msb = 31 - __builtin_clz(value);
+	shift = msb - CYCLE_HIST_SUB_BITS;
+	return (shift * CYCLE_HIST_SUB_COUNT) + (value >> shift);
+}
+
+// Adds one sample to a histogram, its min must be initialised to UINT32_MAX
+static inline void cycle_hist_record(cycle_hist_t* hist, uint32_t value)
+{
+	hist->buckets[cycle_hist_bucket(value)]++;
+	hist->count++;
+	if (value < hist->min)
+	{
+		hist->min = value;
+	}
+	if (value > hist->max)
+	{
+		hist->max = value;
+	}
+}
+
+// Adds one sample to the current window. Constant time, no allocation, no system call.
+static inline void cycle_stats_record(cycle_stats_t* stats, cycle_stat_id_t id, uint32_t value)
+{
+	cycle_hist_record(&stats->current->hist[id], value);
+}
+
+// Writer side
+int cycle_stats_create(cycle_stats_t* stats, uint32_t period_ns, uint32_t window_cycles, cycle_layout_t layout);
+void cycle_stats_complete_window(cycle_stats_t* stats, uint64_t now_ns);
+void cycle_stats_start_total(cycle_stats_t* stats, cycle_stats_window_t* total, uint64_t now_ns);
+
+// Reader side
+cycle_stats_shm_t* cycle_stats_attach(void);
+bool cycle_stats_read(cycle_stats_shm_t* shm, unsigned int windows, cycle_stats_window_t* result);
+uint32_t cycle_hist_percentile(const cycle_hist_t* hist, double percentile);
+uint64_t cycle_hist_count_below(const cycle_hist_t* hist, uint32_t value);
+const char* cycle_layout_name(cycle_layout_t layout);
+
+#endif /* CYCLE_STATS_H_ */
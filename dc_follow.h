@@ -0,0 +1,75 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DC_FOLLOW_H_
+#define DC_FOLLOW_H_
+
+#include <stdint.h>
+
+// Master follows the DC reference clock. The application time advances by exactly one
+// period per cycle, the host wakeup deadline is corrected by a PI controller so that the
+// application time matches the reference clock read back by the frame of the last cycle.
+// The host then wakes at a constant phase to SYNC0 and its drift and jitter stay out of the
+// distributed clocks of the drives.
+
+// Gains per cycle. The correction is measured two cycles later, the loop settles in about 50 cycles.
+#define DC_FOLLOW_KP 0.1
+#define DC_FOLLOW_KI 0.0025
+// Limit of the correction of one wakeup relative to the period
+#define DC_FOLLOW_ADJUST_MAX_PERMILLE 10
+
+typedef struct
+{
+	int64_t offset_ns;			// Application time - host time
+	double integral;
+	uint64_t app_time_ns;		// Application time of the last cycle, 0 before the first cycle
+	int32_t phase_error_ns;		// Application time - reference clock, within +-period/2
+	int32_t adjust_ns;			// Correction of the next wakeup deadline
+}dc_follow_t;
+
+// Called after the frame of the last cycle was received with the lower 32 bits of the
+// reference clock it has read. Returns the correction of the next wakeup deadline.
+static inline int32_t dc_follow_update(dc_follow_t* dc, uint32_t reference_time, uint32_t period_ns)
+{
+	int64_t half = period_ns / 2;
+	int64_t error = (int32_t)((uint32_t)dc->app_time_ns - reference_time);
+	int32_t limit = (int32_t)((period_ns / 1000) * DC_FOLLOW_ADJUST_MAX_PERMILLE);
+	double adjust;
+
+	if (dc->app_time_ns == 0)
+	{
+		dc->adjust_ns = 0;
+		return 0;
+	}
+	// Only the phase to SYNC0 matters, whole periods are ignored
+	error = ((((error + half) % period_ns) + period_ns) % period_ns) - half;
+	adjust = DC_FOLLOW_KP * error + DC_FOLLOW_KI * (dc->integral + error);
+	if (adjust > limit)
+		adjust = limit;
+	else if (adjust < -limit)
+		adjust = -limit;
+	else
+		dc->integral += error;	// No wind up while limited
+
+	// An early wakeup (application time ahead of the reference) delays the next one
+	dc->phase_error_ns = error;
+	dc->adjust_ns = (int32_t)adjust;
+	dc->offset_ns -= dc->adjust_ns;
+	return dc->adjust_ns;
+}
+
+#endif /* DC_FOLLOW_H_ */
@@ -14,15 +14,22 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE /* CPU affinity */
 #include <stdbool.h>
 #include <errno.h>
-#include <mqueue.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <sched.h> /* sched_setscheduler() */
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <alloca.h>
+#include <malloc.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 
 /****************************************************************************/
 
@@ -31,20 +38,63 @@
 #include "pigpio.h"
 #endif
 #include "servo_gui.h"
+#include "pdo_ring.h"
+#include "rxpdo_channel.h"
+#include "cycle_stats.h"
+#include "sdo_engine.h"
+#include "autotune.h"
+#include "param_set.h"
+#include "pdo_recorder.h"
+#include "cia402.h"
+#include "velocity_profile.h"
+#include "dc_follow.h"
+#include "process_image.h"
+#include "cycle_health.h"
+#include "session.h"
+#include "cmd_stream.h"
+#include "sync0_shift.h"
+#include "pdo_layout.h"
 /****************************************************************************/
 // Optional features
 #define CONFIGURE_PDOS  1
 #define SDO_ACCESS      1
 
-// Timing parameter
-#define CYCLE_FREQ 1000
+// Timing parameter, the cycle frequency is selected at startup
+#define CYCLE_FREQ_DEFAULT 1000
 #define CLOCK_SOURCE CLOCK_MONOTONIC
 #define CALC_TIMING
 
 /****************************************************************************/
 
 #define NSEC_PER_SEC (1000000000L)
-#define PERIOD_NS (NSEC_PER_SEC / CYCLE_FREQ)
+
+// Supported cycle frequencies. SYNC0 is shifted by 4.4 periods like the original 4.4 ms at 1 kHz,
+// unless set or calibrated by -S. Only the phase of 0.4 periods matters, SYNC0 is periodic.
+static const unsigned int cycle_freqs[] = {1000, 2000, 4000, 8000};
+#define CYCLE_FREQS (sizeof(cycle_freqs)/sizeof(cycle_freqs[0]))
+#define SYNC0_SHIFT_PERMILLE 4400
+// The reference clock is synchronised at this rate independent of the cycle frequency
+#define SYNC_REF_FREQ 500
+// A cycle frequency is refused if the execution time p99.9 exceeds this share of the period
+#define CYCLE_LOAD_LIMIT_PERCENT 80
+#define CYCLE_CHECK_SECONDS 1
+// Calibration of the SYNC0 shift: timeout of a register or SDO read, reads of the system time
+// difference and time the slaves may take to exchange process data after the master is activated anew
+#define SYNC0_REQUEST_TIMEOUT_MS 1000
+#define SYNC0_DIFF_READS 10
+#define SYNC0_SETTLE_TIMEOUT_MS 10000
+
+// Memory touched once before the cycle starts, so it never page faults afterwards
+#define PREFAULT_STACK_KB_DEFAULT 256
+#define PREFAULT_HEAP_KB_DEFAULT 4096
+// Stack of the gui thread, faulted in by mlockall(MCL_FUTURE) when the thread is created
+#define GUI_STACK_SIZE (256 * 1024)
+
+// Derived from the cycle frequency in main()
+static unsigned int cycle_freq = CYCLE_FREQ_DEFAULT;
+static uint32_t period_ns;
+static double period_s;
+static struct timespec cycletime;
 
 #define DIFF_NS(A, B) (((B).tv_sec - (A).tv_sec) * NSEC_PER_SEC + \
         (B).tv_nsec - (A).tv_nsec)
@@ -56,16 +106,45 @@
 // EtherCAT
 static ec_master_t *master = NULL;
 static ec_domain_t *domain1 = NULL;
-static ec_slave_config_t *sc_ECT60_config = NULL;
+static ec_slave_config_t *sc_ECT60_config[MAX_AXES];
 static txpdo_queue_data_t txpdo_queue_data;
-static unsigned int digout;
-static pthread_mutex_t mymutex;
-static pthread_cond_t mycondition;
-static mqd_t myqueue;
-int long curmessages;
+static unsigned int digout[MAX_AXES];
+static txpdo_ring_t txpdo_ring;
+// Samples are published once the startup check is done, its cycles would only fill the ring
+static bool txpdo_publish = false;
+static rxpdo_channel_t rxpdo_channel;
 bool winch_required = false;
-rxpdo_queue_data_t rxpdo_queue_data;
-#define MAXMSG 10
+static bool gui_active = false;
+// Without gui the process image is published in shared memory for local readers
+static bool headless = false;
+static process_image_shm_t *process_image_shm = NULL;
+static process_image_t process_image;
+
+// Number of cycles to run in benchmark mode, 0 runs the gui and cycles forever
+static unsigned long bench_cycles = 0;
+// Set by a thread running in place of the gui to end the cycle, main shuts down then
+static atomic_bool cycle_stop = false;
+// Frame rate of the gui, the cycle data in between is aggregated
+#define GUI_RATE_DEFAULT 30
+static unsigned int gui_rate = GUI_RATE_DEFAULT;
+// Recording of the process data of every cycle, without trigger the last minute is kept
+#define RECORDER_DEFAULT_SECONDS 60
+static pdo_recorder_t pdo_recorder;
+
+// Capture of the whole session for a replay with -P, see session.h
+#define SESSION_DEFAULT_SECONDS 60
+static session_t session;
+static rxpdo_queue_data_t session_command;
+
+// Tuning of the velocity loop of one axis with -A, runs instead of the gui
+static autotune_t autotune;
+// Download or upload of a parameter set with -D or -U, runs instead of the gui
+static param_job_t param_job;
+// Setpoints streamed by a local motion program with -x, applied instead of the gui command
+static cmd_stream_t cmd_stream;
+static cmd_stream_t *command_stream = NULL;
+static rxpdo_queue_data_t streamed_command;
+_Static_assert(CMD_STREAM_MAX_AXES == MAX_AXES, "command stream entries must cover all axes");
 
 /****************************************************************************/
 
@@ -76,35 +155,105 @@ static uint8_t *domain1_pd = NULL;
 
 #define Rtelligent_ECT60 0x00000a88, 0x0a880002
 
-// offsets for PDO entries
-static unsigned int CiA402_reg6041;
-static unsigned int CiA402_reg6061;
-static unsigned int CiA402_reg606c;
-static unsigned int CiA402_reg60fd;
-static unsigned int CiA402_reg6040;
-static unsigned int CiA402_reg6083;
-static unsigned int CiA402_reg6084;
-static unsigned int CiA402_reg60ff;
-static unsigned int CiA402_reg6060;
-static unsigned int CiA402_reg2006;
-
-const static ec_pdo_entry_reg_t domain1_regs[] = {
-    {rtelligentpos,  Rtelligent_ECT60, 0x6041, 0, &CiA402_reg6041},
-    {rtelligentpos,  Rtelligent_ECT60, 0x6061, 0, &CiA402_reg6061},
-    {rtelligentpos,  Rtelligent_ECT60, 0x606c, 0, &CiA402_reg606c},
-    {rtelligentpos,  Rtelligent_ECT60, 0x60fd, 0, &CiA402_reg60fd},
-    {rtelligentpos,  Rtelligent_ECT60, 0x6040, 0, &CiA402_reg6040},
-    {rtelligentpos,  Rtelligent_ECT60, 0x6083, 0, &CiA402_reg6083},
-    {rtelligentpos,  Rtelligent_ECT60, 0x6084, 0, &CiA402_reg6084},
-    {rtelligentpos,  Rtelligent_ECT60, 0x60ff, 0, &CiA402_reg60ff},
-    {rtelligentpos,  Rtelligent_ECT60, 0x6060, 0, &CiA402_reg6060},
-    {rtelligentpos,  Rtelligent_ECT60, 0x2006, 0, &CiA402_reg2006},
-    {}
+// Descriptor of an axis, every axis is a Rtelligent ECT60 drive
+typedef struct
+{
+    uint16_t alias;
+    uint16_t position;
+}axis_descriptor_t;
+
+// Axes driven by this application. If more axes are requested on the command line than listed
+// here, the additional ones are addressed at the positions following the last entry.
+static const axis_descriptor_t axis_descriptors[] = {
+    {rtelligentpos},
 };
 
+#define AXIS_DESCRIPTORS (sizeof(axis_descriptors)/sizeof(axis_descriptors[0]))
+
+static axis_descriptor_t axis_table[MAX_AXES];
+static unsigned int axes = AXIS_DESCRIPTORS;
+
+// Command applied until the gui publishes its first one, initialised for all axes in main()
+static rxpdo_queue_data_t rxpdo_default_command;
+
+// Offsets of the PDO entries reported by the master, stored as struct of arrays. They are only
+// used to check the layout of the domain and to locate entries in a capture, the cycle accesses
+// the process data through pdo_image.
+#define PDO_OFFSETS(name, index, subindex, type) unsigned int name[MAX_AXES];
+static struct
+{
+    PDO_ENTRIES(PDO_OFFSETS)
+}CiA402_offsets;
+
+// PDO entries registered for each axis in this order, the array their offsets are stored in and
+// their offset within the image of the axis
+#define PDO_TX_REG(name, index, subindex, type) {index, subindex, CiA402_offsets.name, PDO_TX_OFFSET(name)},
+#define PDO_RX_REG(name, index, subindex, type) {index, subindex, CiA402_offsets.name, PDO_RX_OFFSET(name)},
+static const struct
+{
+    uint16_t index;
+    uint8_t subindex;
+    unsigned int *offsets;
+    unsigned int image_offset;
+}axis_pdo_regs[] = {
+    PDO_TX_ENTRIES(PDO_TX_REG)
+    PDO_RX_ENTRIES(PDO_RX_REG)
+};
+
+// Process data of all axes, copied from the domain at once by read_inputs() and back by write_outputs()
+static pdo_axis_t pdo_image[MAX_AXES];
+
+// Generated from axis_table and axis_pdo_regs, terminated by an empty entry
+static ec_pdo_entry_reg_t domain1_regs[MAX_AXES * PDO_REGS_PER_AXIS + 1];
+
+// Power state machine of every axis, driven by cyclic_task
+static cia402_axis_t cia402_axes[MAX_AXES];
+
+// Jerk limited setpoint generator of every axis in cyclic synchronous velocity mode
+#define MODE_PROFILE_VELOCITY 3
+#define MODE_CYCLIC_SYNC_VELOCITY 9
+static velocity_profile_t velocity_profiles[MAX_AXES];
+
+// Tracking error between velocity setpoint written and actual velocity of the same cycle
+static struct
+{
+    double square_sum;
+    int32_t max_abs;
+    unsigned long count;
+}tracking[MAX_AXES];
+
 static unsigned int counter = 0;
 static unsigned int sync_ref_counter = 0;
-const struct timespec cycletime = {0, PERIOD_NS};
+static unsigned int sync_ref_divider;
+static unsigned long cycle_number = 0;
+// Distributed clocks: the reference clock follows the master, or with -d the master follows the reference clock
+static bool dc_follow = false;
+static dc_follow_t dc_follow_state;
+// SYNC0 shift and its calibration by -S cal, the timing of every cycle is recorded while sync0_recording is set
+static int32_t sync0_shift_ns;
+static bool sync0_calibrate = false;
+static sync0_run_t sync0_run;
+static sync0_run_t *sync0_recording = NULL;
+#ifdef EC_HAVE_REG_ACCESS
+// System time delay 0x0928 and difference 0x092C of every slave
+static ec_reg_request_t *dc_delay_request[MAX_AXES], *dc_diff_request[MAX_AXES];
+#endif
+// Health counters of the cycle, kept independent of the timing statistics
+static cycle_health_t cycle_health;
+// Reaction to a wakeup deadline already passed, see cycle_overrun_policy_t
+#define OVERRUN_CATCH_UP_DEFAULT 2
+static cycle_overrun_policy_t overrun_policy = CYCLE_OVERRUN_SKIP;
+static unsigned int overrun_catch_up_max = OVERRUN_CATCH_UP_DEFAULT;
+static unsigned int overrun_catch_up_cycles = 0;
+static bool overrun_stopped = false;
+#ifdef CALC_TIMING
+static cycle_stats_t cycle_stats;
+// All windows of the benchmark run, it may be longer than the windows kept
+static cycle_stats_window_t bench_stats;
+#endif
+// Order of the work within a cycle, see cycle_layout_t. In send-first layout the frame leaves at
+// a fixed time after the wakeup with the outputs computed in the previous cycle.
+static cycle_layout_t cycle_layout = CYCLE_LAYOUT_CLASSIC;
 
 /*****************************************************************************/
 
@@ -112,28 +261,21 @@ const struct timespec cycletime = {0, PERIOD_NS};
 
 // Cia402 In and Out --------------------------
 
+// Generated from the tables in pdo_layout.h
 static ec_pdo_entry_info_t rtelligent_TX_pdo_entries[] = {
-    {0x6041, 0, 16},
-    {0x6061, 0, 8},
-    {0x606c, 0, 32},
-    {0x60fd, 0, 32}
+    PDO_TX_ENTRIES(PDO_ENTRY_INFO)
 };
 
 static ec_pdo_entry_info_t rtelligent_RX_pdo_entries[] = {
-    {0x6040, 0, 16},
-    {0x6083, 0, 32},
-    {0x6084, 0, 32},
-    {0x60ff, 0, 32},
-    {0x6060, 0, 8},
-	{0x2006, 0, 16}
+    PDO_RX_ENTRIES(PDO_ENTRY_INFO)
 };
 
 static ec_pdo_info_t rtelligent_TX_pdo[] = {
-    {0x1a01, sizeof(rtelligent_TX_pdo_entries)/sizeof(rtelligent_TX_pdo_entries[0]), rtelligent_TX_pdo_entries}
+    {PDO_TX_INDEX, PDO_TX_COUNT, rtelligent_TX_pdo_entries}
 };
 
 static ec_pdo_info_t rtelligent_RX_pdo[] = {
-    {0x1602, sizeof(rtelligent_RX_pdo_entries)/sizeof(rtelligent_RX_pdo_entries[0]), rtelligent_RX_pdo_entries}
+    {PDO_RX_INDEX, PDO_RX_COUNT, rtelligent_RX_pdo_entries}
 };
 
 static ec_sync_info_t rtelligent_syncs[] = {
@@ -145,24 +287,19 @@ static ec_sync_info_t rtelligent_syncs[] = {
 
 /*****************************************************************************/
 
+// Asynchronous SDO transfers of all axes, advanced by cyclic_task and requested by the gui
+static sdo_engine_t sdo_engine;
+
 #if SDO_ACCESS
 // SDO entry info equals to PDO entry info
 typedef ec_pdo_entry_info_t ec_sdo_entry_info_t;
 
-
-
-
+// The outputs of the RX PDO are cached for the gui
 static ec_sdo_entry_info_t rtelligent_sdo_entries[] = {
-    {0x6040, 0, 16},
-    {0x6083, 0, 32},
-    {0x6084, 0, 32},
-    {0x60ff, 0, 32},
-    {0x6060, 0, 8},
-	{0x2006, 0, 16}
+    PDO_RX_ENTRIES(PDO_ENTRY_INFO)
 };
 
-// For each sdo entry info object there is a configurable request needed, so number of rtelligent_sdo_entries is needed
-static ec_sdo_request_t *sdo_requests[sizeof(rtelligent_sdo_entries)/sizeof(rtelligent_sdo_entries[0])];
+#define SDO_ENTRIES (sizeof(rtelligent_sdo_entries)/sizeof(rtelligent_sdo_entries[0]))
 
 
 #endif
@@ -177,14 +314,16 @@ void signal_handler(int signo)
 	case(SIGINT):
 	  {
 		printf("received SIGINT %d\n", signo);
-		ncurses_gui_deinit();
+		if (gui_active)
+			ncurses_gui_deinit();
 		exit(0);
 		break;
 	  }
 	case(SIGTERM):
 	  {
 		printf("received SIGTERM %d\n", signo);
-		ncurses_gui_deinit();
+		if (gui_active)
+			ncurses_gui_deinit();
 		exit(0);
 		break;
 	  }
@@ -216,51 +355,249 @@ struct timespec timespec_add(struct timespec time1, struct timespec time2)
 
 /*****************************************************************************/
 
-#if SDO_ACCESS
-void read_sdo(ec_sdo_request_t* ec_sdo_request)
+// Fills axis_table with the first n axes, continuing the positions after the last descriptor
+void build_axis_table(unsigned int n)
 {
-    switch (ecrt_sdo_request_state(ec_sdo_request)) {
-        case EC_REQUEST_UNUSED: // request was not used yet
-            ecrt_sdo_request_read(ec_sdo_request); // trigger first read
-            break;
-        case EC_REQUEST_BUSY:
-            printf("Still busy...\n");
-            break;
-        case EC_REQUEST_SUCCESS:
-            printf("SDO value: 0x%04X\n",
-                    EC_READ_U16(ecrt_sdo_request_data(ec_sdo_request)));
-            ecrt_sdo_request_read(ec_sdo_request); // trigger next read
-            break;
-        case EC_REQUEST_ERROR:
-            printf("Failed to read SDO!\n");
-            ecrt_sdo_request_read(ec_sdo_request); // retry reading
-            break;
+    for (unsigned int a = 0; a < n; a++) {
+        if (a < AXIS_DESCRIPTORS) {
+            axis_table[a] = axis_descriptors[a];
+        } else {
+            axis_table[a] = axis_descriptors[AXIS_DESCRIPTORS - 1];
+            axis_table[a].position += a - (AXIS_DESCRIPTORS - 1);
+        }
     }
+    axes = n;
 }
-#endif
 
-/****************************************************************************/
+// Generates the PDO entry registration list for all axes in use
+void build_domain_regs(void)
+{
+    unsigned int n = 0;
+
+    for (unsigned int a = 0; a < axes; a++) {
+        for (unsigned int e = 0; e < PDO_REGS_PER_AXIS; e++) {
+            domain1_regs[n++] = (ec_pdo_entry_reg_t){axis_table[a].alias, axis_table[a].position,
+                    Rtelligent_ECT60, axis_pdo_regs[e].index, axis_pdo_regs[e].subindex,
+                    &axis_pdo_regs[e].offsets[a]};
+        }
+    }
+    domain1_regs[n] = (ec_pdo_entry_reg_t){};
+}
+
+/*****************************************************************************/
 
-void cyclic_task()
+// Applies the overrun policy to the wakeup deadline, which has passed at now_ns
+void handle_overrun(struct timespec *deadline, uint64_t now_ns)
 {
-	int long ret;
+    uint64_t deadline_ns = TIMESPEC2NS(*deadline);
+    uint64_t late_ns = now_ns - deadline_ns;
+    unsigned int missed = late_ns / period_ns + 1;
+    cycle_overrun_policy_t action = overrun_policy;
+
+    if ((action == CYCLE_OVERRUN_CATCH_UP) && (overrun_catch_up_cycles < overrun_catch_up_max)) {
+        // The missed cycle is run now
+        overrun_catch_up_cycles++;
+        cycle_health_overrun(&cycle_health, cycle_number, late_ns, missed, 0, action);
+        return;
+    }
+    if (action == CYCLE_OVERRUN_STOP)
+        overrun_stopped = true;
+    else
+        action = CYCLE_OVERRUN_SKIP;
+    // Continue at the next slot of the grid, so the phase to SYNC0 is kept
+    deadline_ns += (uint64_t)missed * period_ns;
+    deadline->tv_sec = deadline_ns / NSEC_PER_SEC;
+    deadline->tv_nsec = deadline_ns % NSEC_PER_SEC;
+    overrun_catch_up_cycles = 0;
+    cycle_health_overrun(&cycle_health, cycle_number, late_ns, missed, missed, action);
+}
+
+// The cycle logic is kept apart from the master calls, so a captured session can be replayed
+// through it without a master. It only depends on domain1_pd, the command and the time.
+
+// Copies the process data of all axes from the domain and reads the TX PDOs
+void read_inputs(void)
+{
+    unsigned int a;
+
+    memcpy(pdo_image, domain1_pd, axes * sizeof(pdo_axis_t));
+    for (a = 0; a < axes; a++) {
+        txpdo_queue_data.velocity[a] = pdo_image[a].in.velocity_actual;
+        txpdo_queue_data.mode_of_operation[a] = pdo_image[a].in.mode_display;
+        txpdo_queue_data.statusword[a] = pdo_image[a].in.statusword;
+    }
+}
+
+// Writes the RX PDOs of all axes for the command and copies the process data back to the domain,
+// the time is the wakeup time of the cycle. The controlword follows from the drive state decoded
+// from the statusword of this cycle.
+void write_outputs(const rxpdo_queue_data_t *command, uint64_t now_ns)
+{
+    unsigned int a;
+
+    for (a = 0; a < axes; a++) {
+        cia402_axis_t *cia402 = &cia402_axes[a];
 
-    struct timespec wakeupTime, time;
+        pdo_image[a].out.controlword = cia402_step(cia402, txpdo_queue_data.statusword[a], command->enable[a] && !overrun_stopped, now_ns);
+        txpdo_queue_data.cia402_state[a] = cia402->state;
+        txpdo_queue_data.cia402_transitions[a] = cia402->transitions;
+        txpdo_queue_data.cia402_faults[a] = cia402->faults;
+        txpdo_queue_data.enable_time_ns[a] = cia402->enable_time_ns;
+    }
+    for (a = 0; a < axes; a++) {
+        pdo_image[a].out.mode_of_operation = command->mode_of_operation[a];
+        pdo_image[a].out.profile_acceleration = command->profile_acceleration[a];
+        pdo_image[a].out.profile_deceleration = command->profile_deceleration[a];
+    }
+    // In cyclic synchronous velocity mode the setpoint is profiled here unless the generator is
+    // bypassed, in profile velocity mode by the drive. The generator follows the actual velocity
+    // while it is not in use.
+    for (a = 0; a < axes; a++) {
+        int32_t demand = command->velocity_setpoint[a];
+
+        if (command->mode_of_operation[a] != MODE_CYCLIC_SYNC_VELOCITY) {
+            velocity_profile_reset(&velocity_profiles[a], txpdo_queue_data.velocity[a]);
+        } else if ((txpdo_queue_data.mode_of_operation[a] != MODE_CYCLIC_SYNC_VELOCITY) ||
+                (cia402_axes[a].state != CIA402_OPERATION_ENABLED)) {
+            // Waiting for the drive to take over the mode or to be enabled
+            velocity_profile_reset(&velocity_profiles[a], txpdo_queue_data.velocity[a]);
+            demand = txpdo_queue_data.velocity[a];
+        } else if (command->profile_bypass[a]) {
+            // Written as commanded, a later limited command is profiled from this setpoint
+            velocity_profile_reset(&velocity_profiles[a], demand);
+        } else {
+            demand = lround(velocity_profile_step(&velocity_profiles[a], command->velocity_setpoint[a],
+                    command->profile_acceleration[a], command->profile_jerk[a], period_s));
+        }
+        txpdo_queue_data.velocity_demand[a] = demand;
+    }
+    for (a = 0; a < axes; a++)
+        pdo_image[a].out.target_velocity = txpdo_queue_data.velocity_demand[a];
+    memcpy(domain1_pd, pdo_image, axes * sizeof(pdo_axis_t));
+    for (a = 0; a < axes; a++) {
+        int32_t error = txpdo_queue_data.velocity_demand[a] - txpdo_queue_data.velocity[a];
+
+        if (cia402_axes[a].state != CIA402_OPERATION_ENABLED)
+            continue;
+        tracking[a].square_sum += (double)error * error;
+        if (abs(error) > tracking[a].max_abs)
+            tracking[a].max_abs = abs(error);
+        tracking[a].count++;
+    }
+}
+
+// Builds the command of a streamed entry on top of the gui command. The velocity is written as
+// streamed, the setpoint generator is bypassed unless the stream was stopped after an underrun.
+const rxpdo_queue_data_t *stream_command(const rxpdo_queue_data_t *command, const cmd_stream_entry_t *entry)
+{
+    bool stopped = atomic_load_explicit(&command_stream->stats.state, memory_order_relaxed) == CMD_STREAM_STOPPED;
+
+    streamed_command = *command;
+    for (unsigned int a = 0; a < axes; a++) {
+        streamed_command.velocity_setpoint[a] = entry->velocity_setpoint[a];
+        streamed_command.mode_of_operation[a] = entry->mode_of_operation[a];
+        streamed_command.enable[a] = (entry->enable_mask >> a) & 1;
+        streamed_command.profile_bypass[a] = !stopped;
+    }
+    return &streamed_command;
+}
+
+// The master copies the returned frame into the domain outputs included, so in send-first layout
+// the outputs written by the last cycle are put back from the image before the next frame is queued.
+// The inputs of the domain are left as received.
+void restore_outputs(void)
+{
+    for (unsigned int a = 0; a < axes; a++)
+        memcpy(domain1_pd + a * sizeof(pdo_axis_t) + offsetof(pdo_axis_t, out), &pdo_image[a].out, sizeof(pdo_outputs_t));
+}
+
+// Checks that every axis occupies its pdo_axis_t in the domain at the offsets reported by the master
+int check_pdo_layout(void)
+{
+    for (unsigned int a = 0; a < axes; a++) {
+        for (unsigned int e = 0; e < PDO_REGS_PER_AXIS; e++) {
+            size_t expected = a * sizeof(pdo_axis_t) + axis_pdo_regs[e].image_offset;
+
+            if (axis_pdo_regs[e].offsets[a] != expected) {
+                fprintf(stderr, "PDO entry 0x%04x of axis %u at offset %u instead of %zu of the generated layout\n",
+                        axis_pdo_regs[e].index, a + 1, axis_pdo_regs[e].offsets[a], expected);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Queues the distributed clock datagrams and the process data and sends the frame.
+// The send time relative to the wakeup is recorded, its spread is the send jitter.
+void send_frame(const struct timespec *wakeup)
+{
+    struct timespec time;
+
+    if (dc_follow) {
+        // Only read back by the sync datagram
+    } else if (sync_ref_counter) {
+        sync_ref_counter--;
+    } else {
+        sync_ref_counter = sync_ref_divider - 1;
+
+        clock_gettime(CLOCK_SOURCE, &time);
+        ecrt_master_sync_reference_clock_to(master, TIMESPEC2NS(time));
+    }
+    ecrt_master_sync_slave_clocks(master);
+
+    ecrt_domain_queue(domain1);
 #ifdef CALC_TIMING
-    struct timespec startTime, endTime, lastStartTime = {};
-    uint32_t period_ns = 0, exec_ns = 0, latency_ns = 0,
-             latency_min_ns = 0, latency_max_ns = 0,
-             period_min_ns = 0, period_max_ns = 0,
-             exec_min_ns = 0, exec_max_ns = 0;
+    clock_gettime(CLOCK_SOURCE, &time);
+    cycle_stats_record(&cycle_stats, CYCLE_STAT_SEND, DIFF_NS(*wakeup, time));
 #endif
+    ecrt_master_send(master);
+    if (sync0_recording) {
+        clock_gettime(CLOCK_SOURCE, &time);
+        sync0_run_sent(sync0_recording, DIFF_NS(*wakeup, time));
+    }
+}
 
-    // get current time
-    clock_gettime(CLOCK_SOURCE, &wakeupTime);
+// Runs the given number of cycles, 0 runs forever
+void cyclic_task(unsigned long cycles)
+{
+    unsigned int a;
+    rxpdo_queue_data_t command = rxpdo_default_command;
+    const rxpdo_queue_data_t *commanded = &command;
+    uint32_t applied_sequence = command.sequence;
+    static struct timespec wakeupTime;
+    struct timespec time;
+    uint64_t app_time_ns;
+    uint32_t reference_time;
+    ec_master_state_t ms;
+    ec_domain_state_t ds;
+    struct timespec logicTime;
+    uint32_t logic_ns = 0;
+#ifdef CALC_TIMING
+    struct timespec startTime, endTime, lastStartTime = {};
+    uint32_t measured_period_ns = 0, exec_ns = 0, latency_ns = 0;
+#endif
 
-    while(1) {
+    // get current time, a later call continues the wakeup grid the reference clock may be followed on
+    if (wakeupTime.tv_sec == 0)
+        clock_gettime(CLOCK_SOURCE, &wakeupTime);
 
+    for (unsigned long n = 0; ((cycles == 0) || (n < cycles)) && !atomic_load_explicit(&cycle_stop, memory_order_relaxed);
+            n++, cycle_number++) {
 
     	wakeupTime = timespec_add(wakeupTime, cycletime);
+        if (dc_follow_state.adjust_ns) {
+            uint64_t wakeup_ns = TIMESPEC2NS(wakeupTime) + dc_follow_state.adjust_ns;
+
+            wakeupTime.tv_sec = wakeup_ns / NSEC_PER_SEC;
+            wakeupTime.tv_nsec = wakeup_ns % NSEC_PER_SEC;
+        }
+        // A deadline already passed is handled by the overrun policy instead of a burst of cycles
+        clock_gettime(CLOCK_SOURCE, &time);
+        if (TIMESPEC2NS(time) > TIMESPEC2NS(wakeupTime))
+            handle_overrun(&wakeupTime, TIMESPEC2NS(time));
+        else
+            overrun_catch_up_cycles = 0;
         clock_nanosleep(CLOCK_SOURCE, TIMER_ABSTIME, &wakeupTime, NULL);
 
 #ifdef PIGPIO_OUT
@@ -273,127 +610,210 @@ void cyclic_task()
         // It is a good idea to use the target time (not the measured time) as
         // application time, because it is more stable.
         //
-        ecrt_master_application_time(master, TIMESPEC2NS(wakeupTime));
+        app_time_ns = TIMESPEC2NS(wakeupTime) + dc_follow_state.offset_ns;
+        ecrt_master_application_time(master, app_time_ns);
 
 
 #ifdef CALC_TIMING
         clock_gettime(CLOCK_SOURCE, &startTime);
         latency_ns = DIFF_NS(wakeupTime, startTime);
-        period_ns = DIFF_NS(lastStartTime, startTime);
+        measured_period_ns = DIFF_NS(lastStartTime, startTime);
         exec_ns = DIFF_NS(lastStartTime, endTime);
-        lastStartTime = startTime;
 
-        if (latency_ns > latency_max_ns) {
-            latency_max_ns = latency_ns;
-        }
-        if (latency_ns < latency_min_ns) {
-            latency_min_ns = latency_ns;
-        }
-        if (period_ns > period_max_ns) {
-            period_max_ns = period_ns;
-        }
-        if (period_ns < period_min_ns) {
-            period_min_ns = period_ns;
-        }
-        if (exec_ns > exec_max_ns) {
-            exec_max_ns = exec_ns;
-        }
-        if (exec_ns < exec_min_ns) {
-            exec_min_ns = exec_ns;
+        // The first cycle has no predecessor to calculate period and execution time from
+        if (lastStartTime.tv_sec) {
+            cycle_stats_record(&cycle_stats, CYCLE_STAT_PERIOD, measured_period_ns);
+            cycle_health_period(&cycle_health, measured_period_ns);
+            cycle_stats_record(&cycle_stats, CYCLE_STAT_EXEC, exec_ns);
         }
+        cycle_stats_record(&cycle_stats, CYCLE_STAT_LATENCY, latency_ns);
+        lastStartTime = startTime;
 #endif
 
         // receive process data
         ecrt_master_receive(master);
         ecrt_domain_process(domain1);
+        ecrt_master_state(master, &ms);
+        ecrt_domain_state(domain1, &ds);
+        cycle_health_update(&cycle_health, ds.wc_state == EC_WC_COMPLETE, ms.link_up);
+        // Time the frame of the last cycle passed the reference clock, for the calibration of the SYNC0 shift
+        if (sync0_recording) {
+            bool valid = (ecrt_master_reference_clock_time(master, &reference_time) == 0);
+
+            sync0_run_received(sync0_recording, app_time_ns, valid, reference_time, ds.wc_state == EC_WC_COMPLETE);
+        }
+
+        // The frame of the last cycle has read the reference clock, the next wakeup is corrected by its phase
+        if (dc_follow) {
+            if (ecrt_master_reference_clock_time(master, &reference_time) == 0) {
+                dc_follow_update(&dc_follow_state, reference_time, period_ns);
+#ifdef CALC_TIMING
+                cycle_stats_record(&cycle_stats, CYCLE_STAT_DC_PHASE, abs(dc_follow_state.phase_error_ns));
+#endif
+            } else {
+                // The correction is only applied in the cycle it was computed for, the offset follows it just once
+                dc_follow_state.adjust_ns = 0;
+            }
+            dc_follow_state.app_time_ns = app_time_ns;
+            txpdo_queue_data.dc_follow = true;
+            txpdo_queue_data.dc_phase_error_ns = dc_follow_state.phase_error_ns;
+            txpdo_queue_data.dc_adjust_ns = dc_follow_state.adjust_ns;
+        }
+
+        // In send-first layout the frame leaves before any application work, with the outputs of the last cycle
+        if (cycle_layout == CYCLE_LAYOUT_SEND_FIRST) {
+            restore_outputs();
+            send_frame(&wakeupTime);
+        }
 
         // check process data state (optional)
 
-        //************** lock queue ***********************//
-        // Lock mutex
-        pthread_mutex_lock(&mymutex);
-        // Write velocity setpoint
-	    EC_WRITE_S32(domain1_pd + CiA402_reg60ff, rxpdo_queue_data.velocity_setpoint);
-        // Read velocity from ethercat TX-PDO's
-        txpdo_queue_data.velocity = EC_READ_S32((void*)(domain1_pd + CiA402_reg606c));
-        // Read setpoint velocity from RX-PDO's
-        rxpdo_queue_data.velocity_setpoint = EC_READ_S32((void*)(domain1_pd + CiA402_reg60ff));
-        // Read mode of operation from TX-PDO's
-        txpdo_queue_data.mode_of_operation = EC_READ_S8((void*)(domain1_pd + CiA402_reg6061));
-        // Send data over message queue to gui thread
-        ret = mq_send(myqueue, (const char *)&txpdo_queue_data, sizeof(txpdo_queue_data_t)+1, 0);
-        {	// read number of current messages in queue
-        	struct mq_attr attr;
-        	mq_getattr(myqueue, &attr);
-        	// And store in global variable shared with gui thread
-        	curmessages = attr.mq_curmsgs;
-        }
-        // Throw signal to cond var waiting thread
-        pthread_cond_signal(&mycondition);
-        // Unlock mutex
-        pthread_mutex_unlock(&mymutex);
-        //************** unlock queue ***********************//
+        // Fetch the latest command from the gui thread. This never blocks, if the gui
+        // is just publishing, the command of the previous cycle is kept.
+        rxpdo_channel_read(&rxpdo_channel, &command);
+        // An entry of the command stream replaces the command while a stream runs
+        commanded = &command;
+        if (command_stream) {
+            const cmd_stream_entry_t *entry = cmd_stream_cycle(command_stream, command.sequence, TIMESPEC2NS(wakeupTime));
+
+            if (entry)
+                commanded = stream_command(&command, entry);
+        }
+
+        // The time of the cycle logic is only measured for a capture
+        if (session.header)
+            clock_gettime(CLOCK_SOURCE, &logicTime);
+        read_inputs();
+        if (session.header) {
+            clock_gettime(CLOCK_SOURCE, &time);
+            logic_ns = DIFF_NS(logicTime, time);
+        }
+        // Hand over the sample to the gui thread. This is wait-free and does not enter the kernel,
+        // a full ring is counted as overflow within the ring.
+        if (txpdo_publish)
+            txpdo_ring_push(&txpdo_ring, &txpdo_queue_data);
 
         if (counter) {
             counter--;
         } else { // do this at 1 Hz
-            counter = CYCLE_FREQ;
+            counter = cycle_freq;
 
             // check for master state (optional)
             //check_master_state(); deleteme
 
 #ifdef CALC_TIMING
-            // output timing stats
-//            printf("period     %10u ... %10u\n",
-//                    period_min_ns, period_max_ns);
-//            printf("exec       %10u ... %10u\n",
-//                    exec_min_ns, exec_max_ns);
-//            printf("latency    %10u ... %10u\n",
-//                    latency_min_ns, latency_max_ns);
-            period_max_ns = 0;
-            period_min_ns = 0xffffffff;
-            exec_max_ns = 0;
-            exec_min_ns = 0xffffffff;
-            latency_max_ns = 0;
-            latency_min_ns = 0xffffffff;
+            // publish timing stats of the last second to the readers of the shared memory
+            cycle_stats_complete_window(&cycle_stats, TIMESPEC2NS(startTime));
+#endif
 
+        }
 
+#if SDO_ACCESS
+        // Advance the queued SDO transfers within their budget, results go to the cache
+        sdo_engine_cycle(&sdo_engine, TIMESPEC2NS(wakeupTime));
 #endif
 
-#if SDO_ACCESS
-            // read SDO's
-            for(int i=0;i++;i<10)
-            {
-            	read_sdo(sdo_requests[i]);
-            }
+        // write process data, the whole command block is applied within the same cycle
+        if (session.header)
+            clock_gettime(CLOCK_SOURCE, &logicTime);
+        write_outputs(commanded, TIMESPEC2NS(wakeupTime));
+        if (session.header) {
+            clock_gettime(CLOCK_SOURCE, &time);
+            logic_ns += DIFF_NS(logicTime, time);
+        }
+        if (sync0_recording) {
+            clock_gettime(CLOCK_SOURCE, &time);
+            sync0_run_written(sync0_recording, DIFF_NS(wakeupTime, time));
+        }
+
+        // Record this cycle, the outputs are recorded as written above
+        pdo_record_t *record = pdo_recorder_next(&pdo_recorder);
+        if (record) {
+            record->cycle = cycle_number;
+            record->wakeup_ns = TIMESPEC2NS(wakeupTime);
+#ifdef CALC_TIMING
+            record->start_ns = TIMESPEC2NS(startTime);
+#else
+            record->start_ns = record->wakeup_ns;
 #endif
+            for (a = 0; a < axes; a++) {
+                record->axis[a].statusword = txpdo_queue_data.statusword[a];
+                record->axis[a].mode_display = txpdo_queue_data.mode_of_operation[a];
+                record->axis[a].velocity_actual = txpdo_queue_data.velocity[a];
+                record->axis[a].digital_inputs = pdo_image[a].in.digital_inputs;
+                record->axis[a].target_velocity = txpdo_queue_data.velocity_demand[a];
+            }
+            pdo_recorder_commit(&pdo_recorder, record);
         }
 
-        // write process data
-	    EC_WRITE_U16(domain1_pd + CiA402_reg6040, 0x1f);
-	    EC_WRITE_U8(domain1_pd + CiA402_reg6060, 0x3);
-	    EC_WRITE_S32(domain1_pd + CiA402_reg6083, 0xa000);
-	    EC_WRITE_S32(domain1_pd + CiA402_reg6084, 0xa000);
-	    // EC_WRITE_S32(domain1_pd + CiA402_reg60ff, 0x1000);
+        // Capture this cycle for a replay, a changed command is captured before the cycle it is applied in
+        if (session.header) {
+            session_command_t *applied;
+            session_cycle_t *captured;
+
+            if ((session.used == 0) || memcmp(commanded, &session_command, sizeof(command))) {
+                applied = session_append(&session, SESSION_COMMAND, SESSION_COMMAND_SIZE);
+                if (applied) {
+                    applied->command = *commanded;
+                    session_command = *commanded;
+                    session_commit(&session, applied);
+                }
+            }
+            captured = session_append(&session, SESSION_CYCLE, SESSION_CYCLE_SIZE(session.header->domain_size));
+            if (captured) {
+                captured->cycle = cycle_number;
+                captured->wakeup_ns = TIMESPEC2NS(wakeupTime);
+#ifdef CALC_TIMING
+                captured->start_ns = TIMESPEC2NS(startTime);
+#else
+                captured->start_ns = captured->wakeup_ns;
+#endif
+                captured->logic_ns = logic_ns;
+                captured->working_counter = ds.working_counter;
+                captured->wc_state = ds.wc_state;
+                captured->link_up = ms.link_up;
+                captured->al_states = ms.al_states;
+                captured->flags = overrun_stopped ? SESSION_FLAG_OVERRUN_STOPPED : 0;
+                memcpy(captured->data, domain1_pd, session.header->domain_size);
+                session_commit(&session, captured);
+            }
+        }
 
-	    {
-		    digout = EC_READ_U16((void*)(domain1_pd  + CiA402_reg2006));
+	    if (command.sequence != applied_sequence) {
+	        // First cycle writing this command, measure its latency
+	        applied_sequence = command.sequence;
+	        clock_gettime(CLOCK_SOURCE, &time);
+	        txpdo_queue_data.command_sequence = applied_sequence;
+	        txpdo_queue_data.command_latency_ns = TIMESPEC2NS(time) - command.timestamp_ns;
 	    }
 
-
-        if (sync_ref_counter) {
-            sync_ref_counter--;
-        } else {
-            sync_ref_counter = 1; // sync every cycle
-
-            clock_gettime(CLOCK_SOURCE, &time);
-            ecrt_master_sync_reference_clock_to(master, TIMESPEC2NS(time));
+        for (a = 0; a < axes; a++)
+		    digout[a] = pdo_image[a].out.digital_outputs;
+
+        if (process_image_shm) {
+            process_image.cycle = cycle_number;
+            process_image.app_time_ns = app_time_ns;
+            process_image.slaves_responding = ms.slaves_responding;
+            process_image.al_states = ms.al_states;
+            process_image.link_up = ms.link_up;
+            process_image.working_counter = ds.working_counter;
+            process_image.wc_state = ds.wc_state;
+            process_image.axes = axes;
+            for (a = 0; a < axes; a++) {
+                process_image.axis[a].statusword = txpdo_queue_data.statusword[a];
+                process_image.axis[a].mode_display = txpdo_queue_data.mode_of_operation[a];
+                process_image.axis[a].cia402_state = txpdo_queue_data.cia402_state[a];
+                process_image.axis[a].velocity_actual = txpdo_queue_data.velocity[a];
+                process_image.axis[a].velocity_demand = txpdo_queue_data.velocity_demand[a];
+                process_image.axis[a].digital_inputs = pdo_image[a].in.digital_inputs;
+            }
+            memcpy(process_image.data, domain1_pd, process_image_shm->domain_size);
+            process_image_publish(process_image_shm, &process_image);
         }
-        ecrt_master_sync_slave_clocks(master);
 
         // send process data
-        ecrt_domain_queue(domain1);
-        ecrt_master_send(master);
+        if (cycle_layout == CYCLE_LAYOUT_CLASSIC)
+            send_frame(&wakeupTime);
 
 #ifdef CALC_TIMING
         clock_gettime(CLOCK_SOURCE, &endTime);
@@ -409,44 +829,123 @@ void cyclic_task()
 
 /****************************************************************************/
 
-/****************************************************************************/
-
-int main(int argc, char **argv)
+// Consumer of the ring buffer in benchmark and headless mode, drains it at the pace of the gui
+void* bench_drain(void* arg)
 {
-	// open a message queue for communication between threads
-	struct mq_attr attr = {.mq_flags = 0, .mq_maxmsg = MAXMSG, .mq_msgsize = sizeof(txpdo_queue_data_t)+1, .mq_curmsgs = 0};
-#define myqueue_name "/myqueue"
-	myqueue = mq_open(myqueue_name, O_WRONLY | O_CREAT | O_NONBLOCK, 0660, &attr);
-	// Init the mutex for safe interthread communication
-	pthread_mutex_init(&mymutex, NULL);
-	pthread_cond_init(&mycondition, NULL);
-#ifdef PIGPIO_OUT
-	int pigpio_version;
-#endif
+    static txpdo_queue_data_t batch[64];
+    struct timespec period = {0, 10000000};
 
-	if ((signal(SIGINT, signal_handler) == SIG_ERR) || (signal(SIGTERM, signal_handler) == SIG_ERR) || (signal(SIGWINCH, signal_handler) == SIG_ERR) )
-	{
-		perror("signal handler registration failed");
-	}
-
-    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
-        perror("mlockall failed");
-        return -1;
+    while (1) {
+        while (txpdo_ring_pop_batch(&txpdo_ring, batch, 64) > 0);
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &period, NULL);
     }
+    return NULL;
+}
 
-#ifdef PIGPIO_OUT
-    pigpio_version = gpioInitialise(); 			// Initialise pigpio
-    if(pigpio_version < 0)
-    {
-    	printf("pigpio could not be initialised. Maybe library not installed or pigpio.service is running.\n");
+// Page faults of the cycle thread are counted from the start of the cyclic function
+static struct rusage cycle_usage;
+
+// Prints the timing of the benchmark run in one line per statistic
+void bench_report(void)
+{
+    struct rusage usage;
+
+    // Power state of every axis at the end of the run
+    for (unsigned int a = 0; a < axes; a++) {
+        printf("cia402: axis %2u %-18s transitions %4u faults %3u last enabling took %8.3f ms\n",
+                a + 1, cia402_state_name(cia402_axes[a].state), cia402_axes[a].transitions,
+                cia402_axes[a].faults, cia402_axes[a].enable_time_ns / 1e6);
     }
-    else
-    {
-    	printf("pigpio with version %d initialised\n", pigpio_version);
-    	gpioSetMode( 14, PI_OUTPUT);					// Set GPIO14 to output
+    for (unsigned int a = 0; a < axes; a++) {
+        printf("tracking: axis %2u mode %d rms %10.1f max %8d\n", a + 1, txpdo_queue_data.mode_of_operation[a],
+                tracking[a].count ? sqrt(tracking[a].square_sum / tracking[a].count) : 0.0, tracking[a].max_abs);
     }
+#ifdef CALC_TIMING
+    static const char *names[CYCLE_STAT_COUNT] = {"latency", "period", "exec", "dc phase", "send"};
+    const cycle_stats_window_t *stats = &bench_stats;
+    struct timespec now;
+
+    clock_gettime(CLOCK_SOURCE, &now);
+    cycle_stats_complete_window(&cycle_stats, TIMESPEC2NS(now));
+    for (int i = 0; i < CYCLE_STAT_COUNT; i++) {
+        if (stats->hist[i].count == 0)
+            continue;
+        printf("bench: axes %2u freq %5u %-8s n %8llu p50 %8.1f p99 %8.1f p99.9 %8.1f max %8.1f us\n",
+                axes, cycle_freq, names[i], (unsigned long long)stats->hist[i].count,
+                cycle_hist_percentile(&stats->hist[i], 50.0) / 1000.0,
+                cycle_hist_percentile(&stats->hist[i], 99.0) / 1000.0,
+                cycle_hist_percentile(&stats->hist[i], 99.9) / 1000.0,
+                stats->hist[i].max / 1000.0);
+    }
+    if (stats->hist[CYCLE_STAT_SEND].count)
+        printf("bench: layout %s send jitter p99.9-p50 %.1f max-min %.1f us\n", cycle_layout_name(cycle_layout),
+                (cycle_hist_percentile(&stats->hist[CYCLE_STAT_SEND], 99.9) -
+                cycle_hist_percentile(&stats->hist[CYCLE_STAT_SEND], 50.0)) / 1000.0,
+                (stats->hist[CYCLE_STAT_SEND].max - stats->hist[CYCLE_STAT_SEND].min) / 1000.0);
 #endif
+    printf("bench: wc incomplete %lu cycles in %lu runs, overruns %lu, link drops %lu\n",
+            atomic_load(&cycle_health.wc_incomplete_cycles), atomic_load(&cycle_health.wc_incomplete_runs),
+            atomic_load(&cycle_health.overruns), atomic_load(&cycle_health.link_drops));
+    printf("bench: deadline misses %lu, skipped cycles %lu%s\n", atomic_load(&cycle_health.deadline_misses),
+            atomic_load(&cycle_health.skipped_cycles), overrun_stopped ? ", axes stopped" : "");
+    if (command_stream) {
+        cmd_stream_stats_t *stats = &command_stream->stats;
+        unsigned long transports = atomic_load(&stats->transport_count), queued = atomic_load(&stats->queue_count);
+
+        printf("bench: stream %s batches %lu rejected %lu applied %lu underruns %lu cycles in %lu runs, stops %lu, "
+                "aborts %lu\n", cmd_stream_state_name(atomic_load(&stats->state)), atomic_load(&stats->batches),
+                atomic_load(&stats->rejected), atomic_load(&stats->applied), atomic_load(&stats->underrun_cycles),
+                atomic_load(&stats->underrun_runs), atomic_load(&stats->stops), atomic_load(&stats->aborts));
+        printf("bench: stream latency transport mean %.1f max %.1f us, queue mean %.1f max %.1f us, "
+                "depth min %u max %u\n",
+                transports ? atomic_load(&stats->transport_sum_ns) / 1000.0 / transports : 0.0,
+                atomic_load(&stats->transport_max_ns) / 1000.0,
+                queued ? atomic_load(&stats->queue_sum_ns) / 1000.0 / queued : 0.0,
+                atomic_load(&stats->queue_max_ns) / 1000.0,
+                (atomic_load(&stats->depth_min) == UINT_MAX) ? 0 : atomic_load(&stats->depth_min),
+                atomic_load(&stats->depth_max));
+    }
+    // Any page fault in the cycle shows up as a latency or exec peak
+    getrusage(RUSAGE_THREAD, &usage);
+    printf("bench: page faults in cycle minor %ld major %ld\n", usage.ru_minflt - cycle_usage.ru_minflt,
+            usage.ru_majflt - cycle_usage.ru_majflt);
+}
 
+// Runs the cycle for CYCLE_CHECK_SECONDS and returns false if its execution time
+// does not leave enough reserve within the period
+bool check_cycle_load(void)
+{
+#ifdef CALC_TIMING
+    static cycle_stats_window_t stats;
+    struct timespec now;
+    uint32_t exec_ns, limit_ns = (period_ns / 100) * CYCLE_LOAD_LIMIT_PERCENT;
+    struct rusage usage;
+
+    printf("Checking cycle at %u Hz for %u s...\n", cycle_freq, CYCLE_CHECK_SECONDS);
+    getrusage(RUSAGE_THREAD, &cycle_usage);
+    cyclic_task(CYCLE_CHECK_SECONDS * cycle_freq);
+    getrusage(RUSAGE_THREAD, &usage);
+    clock_gettime(CLOCK_SOURCE, &now);
+    cycle_stats_complete_window(&cycle_stats, TIMESPEC2NS(now));
+    if (!cycle_stats_read(cycle_stats.shm, CYCLE_CHECK_SECONDS, &stats))
+        return false;
+    exec_ns = cycle_hist_percentile(&stats.hist[CYCLE_STAT_EXEC], 99.9);
+    printf("Cycle check: exec p99.9 %.1f us max %.1f us, latency p99.9 %.1f us max %.1f us, page faults %ld, "
+            "limit %.1f us of %.1f us: %s\n",
+            exec_ns / 1000.0, stats.hist[CYCLE_STAT_EXEC].max / 1000.0,
+            cycle_hist_percentile(&stats.hist[CYCLE_STAT_LATENCY], 99.9) / 1000.0,
+            stats.hist[CYCLE_STAT_LATENCY].max / 1000.0, usage.ru_minflt - cycle_usage.ru_minflt,
+            limit_ns / 1000.0, period_ns / 1000.0, (exec_ns <= limit_ns) ? "ok" : "refused");
+    return exec_ns <= limit_ns;
+#else
+    return true;
+#endif
+}
+
+// Requests the master and configures the slaves, the domain and SYNC0 with the shift, then activates it.
+// Called once more by the calibration of the SYNC0 shift after the master was released.
+int configure_master(int32_t sync0_shift)
+{
     master = ecrt_request_master(0);
     if (!master)
         return -1;
@@ -455,36 +954,57 @@ int main(int argc, char **argv)
     if (!domain1)
         return -1;
 
-    if (!(sc_ECT60_config = ecrt_master_slave_config(master,
-                    rtelligentpos, Rtelligent_ECT60))) {
-        fprintf(stderr, "Failed to get slave configuration.\n");
-        return -1;
-    }
+    for (unsigned int a = 0; a < axes; a++) {
+        if (!(sc_ECT60_config[a] = ecrt_master_slave_config(master,
+                        axis_table[a].alias, axis_table[a].position, Rtelligent_ECT60))) {
+            fprintf(stderr, "Failed to get slave configuration of axis %u.\n", a);
+            return -1;
+        }
 
-    if (ecrt_slave_config_pdos(sc_ECT60_config, EC_END, rtelligent_syncs)) {
-        fprintf(stderr, "Failed to configure PDOs.\n");
-        return -1;
+        if (ecrt_slave_config_pdos(sc_ECT60_config[a], EC_END, rtelligent_syncs)) {
+            fprintf(stderr, "Failed to configure PDOs of axis %u.\n", a);
+            return -1;
+        }
     }
 
 #if SDO_ACCESS
     printf("Creating SDO requests...\n");
-    for(int i=0;i++;i<10)
-    {
-    if (!(sdo_requests[i] = ecrt_slave_config_create_sdo_request(sc_ECT60_config, 0x2006, 0, 2))) {
-        printf("Failed to create SDO request.\n");
-    }
-    ecrt_sdo_request_timeout(sdo_requests[i], 500); // ms
+    sdo_engine_init(&sdo_engine);
+    for (unsigned int a = 0; a < axes; a++) {
+        if (sdo_engine_add_slave(&sdo_engine, sc_ECT60_config[a]) < 0) {
+            fprintf(stderr, "Failed to create SDO requests of axis %u.\n", a);
+            return -1;
+        }
+        // The parameters shown in the gui are cached for every axis
+        for (unsigned int i = 0; i < SDO_ENTRIES; i++) {
+            sdo_engine_watch(&sdo_engine, a, rtelligent_sdo_entries[i].index,
+                    rtelligent_sdo_entries[i].subindex, rtelligent_sdo_entries[i].bit_length / 8);
+        }
     }
 #endif
 
-    printf("Registering PDO entries...\n");
+    printf("Registering PDO entries of %u axes...\n", axes);
+    build_domain_regs();
     if (ecrt_domain_reg_pdo_entry_list(domain1, domain1_regs)) {
         fprintf(stderr, "PDO entry registration failed!\n");
         return -1;
     }
+    if (check_pdo_layout())
+        return -1;
 
-    // configure SYNC signals for this slave
-    ecrt_slave_config_dc(sc_ECT60_config, 0x0700, PERIOD_NS, 4400000, 0, 0);
+    // configure SYNC signals for all slaves
+    for (unsigned int a = 0; a < axes; a++)
+        ecrt_slave_config_dc(sc_ECT60_config[a], 0x0700, period_ns, sync0_shift, 0, 0);
+#ifdef EC_HAVE_REG_ACCESS
+    // The calibration reads the distributed clock registers of the slaves
+    for (unsigned int a = 0; sync0_calibrate && (a < axes); a++) {
+        if (!(dc_delay_request[a] = ecrt_slave_config_create_reg_request(sc_ECT60_config[a], 4)) ||
+                !(dc_diff_request[a] = ecrt_slave_config_create_reg_request(sc_ECT60_config[a], 4))) {
+            fprintf(stderr, "Failed to create register requests of axis %u.\n", a);
+            return -1;
+        }
+    }
+#endif
 
 
     printf("Activating master...\n");
@@ -494,9 +1014,845 @@ int main(int argc, char **argv)
     if (!(domain1_pd = ecrt_domain_data(domain1))) {
         return -1;
     }
+    return 0;
+}
+
+#ifdef EC_HAVE_REG_ACCESS
+// Runs the cycle until the register requests of all axes have read the 32 bit register at address
+bool read_dc_register(ec_reg_request_t **requests, uint16_t address, uint32_t *values)
+{
+    unsigned int a, ms;
+    bool busy;
+
+    for (a = 0; a < axes; a++)
+        ecrt_reg_request_read(requests[a], address, 4);
+    for (ms = 0; ; ms += 10) {
+        busy = false;
+        for (a = 0; a < axes; a++)
+            busy |= (ecrt_reg_request_state(requests[a]) == EC_REQUEST_BUSY);
+        if (!busy)
+            break;
+        if (ms >= SYNC0_REQUEST_TIMEOUT_MS)
+            return false;
+        cyclic_task(cycle_freq / 100);
+    }
+    for (a = 0; a < axes; a++) {
+        if (ecrt_reg_request_state(requests[a]) != EC_REQUEST_SUCCESS)
+            return false;
+        values[a] = EC_READ_U32(ecrt_reg_request_data(requests[a]));
+    }
+    return true;
+}
+#endif
+
+// Runs the cycle until the SDO engine has uploaded the object of the axis
+bool read_sdo(unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size, uint32_t *value)
+{
+    int entry = sdo_engine_watch(&sdo_engine, axis, index, subindex, size);
+    sdo_result_t result;
+    uint32_t errors;
+
+    if ((entry < 0) || !sdo_engine_result(&sdo_engine, entry, &result))
+        return false;
+    errors = result.errors;
+    if (!sdo_engine_read(&sdo_engine, axis, index, subindex, size))
+        return false;
+    for (unsigned int ms = 0; ms < SYNC0_REQUEST_TIMEOUT_MS; ms += 10) {
+        cyclic_task(cycle_freq / 100);
+        if (sdo_engine_result(&sdo_engine, entry, &result) && (result.pending == 0)) {
+            *value = result.value;
+            return (result.errors == errors) && (result.state == SDO_ENTRY_VALID);
+        }
+    }
+    return false;
+}
+
+// Sum of the SM events missed 0x1C32:0B of all axes, false if any drive does not provide it
+bool read_sm_events_missed(uint32_t *missed)
+{
+    uint32_t value;
+
+    *missed = 0;
+    for (unsigned int a = 0; a < axes; a++) {
+        if (!read_sdo(a, 0x1C32, 0x0B, 2, &value))
+            return false;
+        *missed += value;
+    }
+    return true;
+}
+
+// Records the frames over the calibration time with the configured shift and evaluates them. Cycles
+// skipped by the host and SM events missed by the drives in the meantime are counted, the latter are
+// -1 if the drives do not provide 0x1C32:0B.
+void record_sync0_run(uint32_t delay_ns, sync0_result_t *result, unsigned long *skipped, long *sm_missed)
+{
+    uint32_t missed_start, missed_end;
+    bool missed_valid = read_sm_events_missed(&missed_start);
+    unsigned long skipped_start = atomic_load(&cycle_health.skipped_cycles);
+
+    printf("sync0: recording %u s with shift %.1f us...\n", SYNC0_SHIFT_CAL_SECONDS, sync0_shift_ns / 1000.0);
+    sync0_run_start(&sync0_run, period_ns, cycle_layout == CYCLE_LAYOUT_SEND_FIRST);
+    sync0_recording = &sync0_run;
+    cyclic_task(SYNC0_SHIFT_CAL_SECONDS * cycle_freq);
+    sync0_recording = NULL;
+    *skipped = atomic_load(&cycle_health.skipped_cycles) - skipped_start;
+    sync0_shift_evaluate(&sync0_run, sync0_shift_ns, delay_ns, result);
+    *sm_missed = (missed_valid && read_sm_events_missed(&missed_end)) ? (long)(missed_end - missed_start) : -1;
+}
+
+void print_sync0_result(const char *name, const sync0_result_t *result, unsigned long skipped, long sm_missed)
+{
+    printf("sync0: %s shift %.1f us (phase %.1f us): %lu frames at the reference clock p99.9 %.1f max %.1f us, "
+            "sent p99.9 %.1f us, late %lu (%lu with any shift), WC incomplete %lu, cycles skipped %lu, SM events missed %ld, "
+            "command latency mean %.1f max %.1f us\n",
+            name, sync0_shift_ns / 1000.0, (sync0_shift_ns % period_ns) / 1000.0, result->frames,
+            result->frame_p999_ns / 1000.0, result->frame_max_ns / 1000.0, result->sent_p999_ns / 1000.0, result->late,
+            result->overrun, result->wc_incomplete, skipped, sm_missed, result->latency_mean_ns / 1000.0,
+            result->latency_max_ns / 1000.0);
+}
+
+// Calibrates the SYNC0 shift, see sync0_shift.h. The frames are recorded with the configured shift, the
+// smallest shift the percentile of them would have been in time with plus the margin is selected, the
+// master is configured anew with it and the frames are recorded again to verify it. Returns the exit code.
+int calibrate_sync0_shift(uint32_t margin_ns, double percentile)
+{
+    uint32_t delay_ns = 0, calc_copy_ns = 0, diff_ns = 0, value;
+    sync0_result_t before, selected, after;
+    unsigned long skipped_before, skipped_after, late_allowed;
+    long missed_before, missed_after;
+    ec_domain_state_t ds;
+    int32_t shift_ns;
+#ifdef EC_HAVE_REG_ACCESS
+    uint32_t values[MAX_AXES];
+
+    // Delay of the frame from the reference clock to the slave and how well the slave clocks follow it
+    if (read_dc_register(dc_delay_request, 0x0928, values)) {
+        for (unsigned int a = 0; a < axes; a++)
+            delay_ns = (values[a] > delay_ns) ? values[a] : delay_ns;
+    } else {
+        printf("sync0: system time delay 0x0928 not read, assumed 0\n");
+    }
+    for (unsigned int r = 0; r < SYNC0_DIFF_READS; r++) {
+        if (!read_dc_register(dc_diff_request, 0x092C, values))
+            break;
+        for (unsigned int a = 0; a < axes; a++)
+            diff_ns = ((uint32_t)abs(sync0_time_difference(values[a])) > diff_ns) ?
+                    (uint32_t)abs(sync0_time_difference(values[a])) : diff_ns;
+    }
+#else
+    printf("sync0: the master has no register access, delay and time difference of the slaves are not included\n");
+#endif
+    // Time a drive needs from the frame until the outputs are valid, if it tells
+    for (unsigned int a = 0; a < axes; a++) {
+        if (read_sdo(a, 0x1C32, 0x06, 4, &value) && (value > calc_copy_ns))
+            calc_copy_ns = value;
+    }
+    printf("sync0: slaves delay %.1f us, time difference %.3f us, calc and copy %.1f us\n", delay_ns / 1000.0,
+            diff_ns / 1000.0, calc_copy_ns / 1000.0);
+    delay_ns += diff_ns + calc_copy_ns;
+
+    record_sync0_run(delay_ns, &before, &skipped_before, &missed_before);
+    print_sync0_result("before", &before, skipped_before, missed_before);
+    shift_ns = sync0_shift_select(&sync0_run, delay_ns, margin_ns, percentile);
+    if (shift_ns < 0) {
+        fprintf(stderr, "sync0: the frames pass the slaves too late within the period of %.1f us for any shift\n",
+                period_ns / 1000.0);
+        return 1;
+    }
+    // The run recorded before tells what the selected shift accepts and the latency it should give
+    sync0_shift_evaluate(&sync0_run, shift_ns, delay_ns, &selected);
+    printf("sync0: selected shift %.1f us: p%g of the frames within the period + slaves %.1f us + margin %.1f us, "
+            "accepts late %lu of %lu frames (%lu with any shift), command latency mean %.1f max %.1f us\n",
+            shift_ns / 1000.0, percentile, delay_ns / 1000.0, margin_ns / 1000.0, selected.late, selected.frames,
+            selected.overrun, selected.latency_mean_ns / 1000.0, selected.latency_max_ns / 1000.0);
+
+    // SYNC0 is configured when the master is activated, so it is configured anew. The wakeup grid is kept.
+    ecrt_release_master(master);
+    memset(&dc_follow_state, 0, sizeof(dc_follow_state));
+    sync0_shift_ns = shift_ns;
+    if (configure_master(sync0_shift_ns))
+        return 1;
+    for (unsigned int ms = 0; ; ms += 10) {
+        cyclic_task(cycle_freq / 100);
+        ecrt_domain_state(domain1, &ds);
+        if (ds.wc_state == EC_WC_COMPLETE)
+            break;
+        if (ms >= SYNC0_SETTLE_TIMEOUT_MS) {
+            fprintf(stderr, "sync0: the slaves do not exchange process data with shift %.1f us\n", shift_ns / 1000.0);
+            return 1;
+        }
+    }
+    // The slave clocks settle on the reference before the verification
+    cyclic_task(cycle_freq);
+    record_sync0_run(delay_ns, &after, &skipped_after, &missed_after);
+    print_sync0_result("after", &after, skipped_after, missed_after);
+    printf("sync0: command latency mean %.1f -> %.1f us (expected %.1f), max %.1f -> %.1f us\n",
+            before.latency_mean_ns / 1000.0, after.latency_mean_ns / 1000.0, selected.latency_mean_ns / 1000.0,
+            before.latency_max_ns / 1000.0, after.latency_max_ns / 1000.0);
+
+    // Late frames are accepted up to the share the selection leaves out. Every cycle skipped by the host
+    // and every late frame leaves an SM event without a frame.
+    late_allowed = (unsigned long)(after.frames * (100.0 - percentile) / 100.0);
+    if ((after.frames == 0) || (after.late - after.overrun > late_allowed) || after.wc_incomplete ||
+            (missed_after > (long)(skipped_after + after.late))) {
+        printf("sync0: shift %.1f us failed, keep the shift or raise the margin\n", sync0_shift_ns / 1000.0);
+        return 1;
+    }
+    // The dead time must be the one the shift gives on the calibration run, up to one step of the shift
+    if (after.latency_mean_ns > selected.latency_mean_ns + SYNC0_SHIFT_STEP_NS) {
+        printf("sync0: shift %.1f us gives a command latency above the expected one, keep the shift or raise the margin\n",
+                sync0_shift_ns / 1000.0);
+        return 1;
+    }
+    printf("sync0: shift %.1f us verified, start with -S %.1f\n", sync0_shift_ns / 1000.0, sync0_shift_ns / 1000.0);
+    return 0;
+}
+
+// Touches the stack and heap of the configured size once. With mlockall(MCL_FUTURE) active
+// the pages stay resident, and malloc is kept from returning memory to the system.
+void prefault_memory(size_t stack_kb, size_t heap_kb)
+{
+    volatile unsigned char *stack = alloca(stack_kb * 1024 + 1);
+    unsigned char *heap;
+    long page = sysconf(_SC_PAGESIZE);
+
+    for (size_t i = 0; i < stack_kb * 1024; i += page)
+        stack[i] = 0;
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (heap_kb && (heap = malloc(heap_kb * 1024))) {
+        for (size_t i = 0; i < heap_kb * 1024; i += page)
+            heap[i] = 0;
+        free(heap);
+    }
+}
+
+// Checks the cpu is excluded from the scheduler by isolcpus= so the cycle does not share it
+bool cpu_isolated(int cpu)
+{
+    FILE *f = fopen("/sys/devices/system/cpu/isolated", "r");
+    char list[256] = "";
+    char *range;
+    int first, last;
+    bool isolated = false;
+
+    if (!f)
+        return false;
+    if (fgets(list, sizeof(list), f)) {
+        for (range = strtok(list, ",\n"); range && !isolated; range = strtok(NULL, ",\n")) {
+            int n = sscanf(range, "%d-%d", &first, &last);
+
+            if (n == 1)
+                last = first;
+            isolated = (n >= 1) && (cpu >= first) && (cpu <= last);
+        }
+    }
+    fclose(f);
+    return isolated;
+}
+
+// Prepares the attributes of the gui or the benchmark drain thread. The policy is set
+// explicitly instead of being inherited from the real time main thread.
+void thread_attr_init(pthread_attr_t *attr, int priority, int cpu)
+{
+    struct sched_param param = {.sched_priority = priority};
+
+    pthread_attr_init(attr);
+    pthread_attr_setstacksize(attr, GUI_STACK_SIZE);
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+}
+
+// Offsets of the entry with the given index of all axes
+static const unsigned int *pdo_entry_offsets(uint16_t index)
+{
+    for (unsigned int i = 0; i < PDO_REGS_PER_AXIS; i++) {
+        if (axis_pdo_regs[i].index == index)
+            return axis_pdo_regs[i].offsets;
+    }
+    return NULL;
+}
+
+// Replays a captured session through the cycle logic without a master. Like the master, every
+// cycle only updates the inputs of the domain from the capture, so the outputs are written by the
+// logic of this build alone. They are compared with the outputs captured, and the time of the
+// logic is compared with the time captured. Returns the number of cycles with different outputs.
+long replay_session(const char *path, bool realtime, const char *report_path)
+{
+    session_t replay;
+    const session_header_t *header;
+    const session_record_t *record;
+    const session_cycle_t *captured;
+    uint64_t offset = 0, first_wakeup_ns = 0;
+    rxpdo_queue_data_t command = rxpdo_default_command;
+    static cycle_hist_t captured_hist = {.min = UINT32_MAX}, replayed_hist = {.min = UINT32_MAX};
+    static const char *names[] = {"captured", "replayed"};
+    const cycle_hist_t *hists[] = {&captured_hist, &replayed_hist};
+    unsigned long cycles = 0, commands = 0, mismatches = 0, first_cycle = 0;
+    uint32_t first_byte = 0, replayed_ns, i;
+    double captured_sum = 0, replayed_sum = 0;
+    struct timespec start, logicTime, time;
+    FILE *report = NULL;
+
+    if (session_open(&replay, path))
+        return -1;
+    header = replay.header;
+    if ((header->layout_size != sizeof(CiA402_offsets)) || (header->axes < 1) || (header->axes > MAX_AXES)) {
+        fprintf(stderr, "%s was captured with a different PDO layout\n", path);
+        session_close(&replay);
+        return -1;
+    }
+    memcpy(&CiA402_offsets, header->layout, sizeof(CiA402_offsets));
+    axes = header->axes;
+    if (check_pdo_layout()) {
+        fprintf(stderr, "%s was captured with a different PDO layout\n", path);
+        session_close(&replay);
+        return -1;
+    }
+    txpdo_queue_data.axes = axes;
+    period_ns = header->period_ns;
+    period_s = period_ns / (double)NSEC_PER_SEC;
+    cycle_freq = NSEC_PER_SEC / period_ns;
+    if (!(domain1_pd = calloc(header->domain_size, 1))) {
+        session_close(&replay);
+        return -1;
+    }
+    if (report_path) {
+        if (!(report = fopen(report_path, "w"))) {
+            perror(report_path);
+            session_close(&replay);
+            return -1;
+        }
+        fprintf(report, "cycle,wakeup_ns,captured_ns,replayed_ns,equal,first_difference\n");
+    }
+    printf("Replaying %s: %u axes at %u Hz, %s\n", path, axes, cycle_freq, realtime ? "real time" : "full speed");
+
+    clock_gettime(CLOCK_SOURCE, &start);
+    while ((record = session_next(&replay, &offset))) {
+        if (record->type == SESSION_COMMAND) {
+            command = ((const session_command_t *)record)->command;
+            commands++;
+            continue;
+        }
+        if (record->type != SESSION_CYCLE)
+            continue;
+        captured = (const session_cycle_t *)record;
+
+        // In real time every cycle is started at the offset it was woken up at in the capture
+        if (cycles == 0) {
+            first_wakeup_ns = captured->wakeup_ns;
+        } else if (realtime) {
+            uint64_t wakeup_ns = TIMESPEC2NS(start) + (captured->wakeup_ns - first_wakeup_ns);
+
+            time.tv_sec = wakeup_ns / NSEC_PER_SEC;
+            time.tv_nsec = wakeup_ns % NSEC_PER_SEC;
+            clock_nanosleep(CLOCK_SOURCE, TIMER_ABSTIME, &time, NULL);
+        }
+        for (unsigned int e = 0; e < sizeof(rtelligent_TX_pdo_entries)/sizeof(rtelligent_TX_pdo_entries[0]); e++) {
+            const unsigned int *offsets = pdo_entry_offsets(rtelligent_TX_pdo_entries[e].index);
+
+            for (unsigned int a = 0; a < axes; a++)
+                memcpy(domain1_pd + offsets[a], captured->data + offsets[a], rtelligent_TX_pdo_entries[e].bit_length / 8);
+        }
+        overrun_stopped = captured->flags & SESSION_FLAG_OVERRUN_STOPPED;
+
+        clock_gettime(CLOCK_SOURCE, &logicTime);
+        read_inputs();
+        write_outputs(&command, captured->wakeup_ns);
+        clock_gettime(CLOCK_SOURCE, &time);
+        replayed_ns = DIFF_NS(logicTime, time);
+
+        for (i = 0; (i < header->domain_size) && (domain1_pd[i] == captured->data[i]); i++);
+        if ((i < header->domain_size) && (mismatches++ == 0)) {
+            first_cycle = captured->cycle;
+            first_byte = i;
+        }
+        cycle_hist_record(&captured_hist, captured->logic_ns);
+        cycle_hist_record(&replayed_hist, replayed_ns);
+        captured_sum += captured->logic_ns;
+        replayed_sum += replayed_ns;
+        if (report) {
+            fprintf(report, "%llu,%llu,%u,%u,%d,%d\n", (unsigned long long)captured->cycle,
+                    (unsigned long long)captured->wakeup_ns, captured->logic_ns, replayed_ns,
+                    i == header->domain_size, (i < header->domain_size) ? (int)i : -1);
+        }
+        cycles++;
+    }
+
+    printf("replay: %lu cycles, %lu commands, %lu cycles with different outputs\n", cycles, commands, mismatches);
+    if (mismatches) {
+        // The entry of the first difference is the one at the nearest offset at or below it
+        unsigned int nearest = 0, entry = 0, axis = 0;
+
+        for (unsigned int r = 0; r < PDO_REGS_PER_AXIS; r++) {
+            for (unsigned int a = 0; a < axes; a++) {
+                if ((axis_pdo_regs[r].offsets[a] <= first_byte) && (axis_pdo_regs[r].offsets[a] >= nearest)) {
+                    nearest = axis_pdo_regs[r].offsets[a];
+                    entry = r;
+                    axis = a;
+                }
+            }
+        }
+        printf("replay: first difference in cycle %lu at byte %u, axis %u entry 0x%04x\n", first_cycle, first_byte,
+                axis + 1, axis_pdo_regs[entry].index);
+    }
+    for (int h = 0; h < 2; h++) {
+        if (hists[h]->count == 0)
+            continue;
+        printf("replay: logic %-8s n %8llu p50 %8.1f p99 %8.1f p99.9 %8.1f max %8.1f us\n", names[h],
+                (unsigned long long)hists[h]->count, cycle_hist_percentile(hists[h], 50.0) / 1000.0,
+                cycle_hist_percentile(hists[h], 99.0) / 1000.0, cycle_hist_percentile(hists[h], 99.9) / 1000.0,
+                hists[h]->max / 1000.0);
+    }
+    if (captured_sum > 0)
+        printf("replay: mean logic time replayed/captured %.3f\n", replayed_sum / captured_sum);
+    if (report)
+        fclose(report);
+    free(domain1_pd);
+    domain1_pd = NULL;
+    session_close(&replay);
+    return mismatches;
+}
+
+void usage(const char *name)
+{
+    printf("Usage: %s [-n axes] [-f hz [-F]] [-c cpu[,gui_cpu]] [-l stack_kb[,heap_kb]] [-d] [-H] [-s socket] [-o policy] [-L layout] [-x socket] [-b seconds] [-g hz] [-r file [-t mask[,pre,post]]] [-C file[,seconds]] [-P file[,rt] [-p report]] [-m mode] [-v velocity] [-A axis[,step[,overshoot,settling_ms]] [-G gains]]\n"
+            "       [-D set[,axis]] [-U list,set[,axis]] [-S shift_us|cal[,margin_us[,percentile]]]\n"
+            "  -n axes     Number of ECT60 axes (1..%u, default %u)\n"
+            "  -f hz       Cycle frequency 1000, 2000, 4000 or 8000 (default %u)\n"
+            "  -F          Run even if the execution time does not fit the cycle period\n"
+            "  -c cpu[,gui_cpu]\n"
+            "              Pin the cycle to cpu (isolate it by isolcpus=) and the gui to gui_cpu\n"
+            "  -l stack_kb[,heap_kb]\n"
+            "              Stack and heap pre-faulted before the cycle starts (default %u,%u)\n"
+            "  -d          Master follows the DC reference clock instead of setting it\n"
+            "  -H          Headless: no gui, publish the process image in shared memory\n"
+            "  -s socket   Unix socket of the cycle health counters, \"\" disables it (default %s)\n"
+            "  -o policy   Reaction to a missed deadline: skip to the next slot, catchup[,n] up to n cycles\n"
+            "              back to back, or stop all axes (default skip, n %u)\n"
+            "  -L layout   Cycle layout: classic computes the outputs before the send, sendfirst sends the\n"
+            "              outputs of the previous cycle right after the wakeup (default classic)\n"
+            "  -x socket   Accept setpoints streamed by a local motion program on this Unix socket\n"
+            "  -b seconds  Benchmark: run the cycle without gui and print its timing\n"
+            "  -g hz       Frame rate of the gui (%u..%u, default %u)\n"
+            "  -r file     Record the process data of every cycle into file (on a tmpfs, e.g. /dev/shm)\n"
+            "  -t mask,pre,post\n"
+            "              Stop recording post cycles after a statusword matched mask, keep pre cycles before\n"
+            "  -C file[,seconds]\n"
+            "              Capture the session for a replay into file (on a tmpfs, default %u s)\n"
+            "  -P file[,rt]\n"
+            "              Replay a captured session through the cycle logic at full speed or in real time,\n"
+            "              without a master, and compare outputs and logic time with the capture\n"
+            "  -p report   Write the comparison of every replayed cycle as CSV into report\n"
+            "  -m mode     Initial mode of operation, 3 profile or 9 cyclic synchronous velocity (default 3)\n"
+            "  -v velocity Initial velocity setpoint (default 0)\n"
+            "  -A axis[,step[,overshoot,settling_ms]]\n"
+            "              Tune the velocity loop of axis by steps of the velocity setpoint until the overshoot [%%]\n"
+            "              and settling time are met, without gui (default step %u, %u %%, %u ms)\n"
+            "  -G kp_index,ti_index[,kp_scale,ti_scale]\n"
+            "              Objects of the proportional gain and the integral time of the velocity loop tuned by -A\n"
+            "              and their values per 1/s and per us (default 1), required with a real master\n"
+            "  -D set[,axis]\n"
+            "              Download the parameter set to all axes or axis, verify it and report the time\n"
+            "  -U list,set[,axis]\n"
+            "              Upload the objects of list from axis (default 1) and save them as set\n"
+            "  -S shift_us|cal[,margin_us[,percentile]]\n"
+            "              Shift of SYNC0 (default %u %% of the period), or calibrate the smallest shift the percentile\n"
+            "              of the frames is in time with (default %g) plus margin (default %u us), verify it and report\n"
+            "              it, without gui\n",
+            name, MAX_AXES, (unsigned int)AXIS_DESCRIPTORS, CYCLE_FREQ_DEFAULT,
+            PREFAULT_STACK_KB_DEFAULT, PREFAULT_HEAP_KB_DEFAULT, CYCLE_HEALTH_SOCKET_DEFAULT, OVERRUN_CATCH_UP_DEFAULT,
+            GUI_RATE_MIN, GUI_RATE_MAX, GUI_RATE_DEFAULT, SESSION_DEFAULT_SECONDS, AUTOTUNE_STEP_DEFAULT, AUTOTUNE_OVERSHOOT_PERCENT_DEFAULT,
+            AUTOTUNE_SETTLING_MS_DEFAULT, SYNC0_SHIFT_PERMILLE / 10, SYNC0_SHIFT_PERCENTILE_DEFAULT,
+            SYNC0_SHIFT_MARGIN_NS_DEFAULT / 1000);
+}
+
+/****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int opt;
+    unsigned int i, n_axes = AXIS_DESCRIPTORS;
+    const char *record_path = NULL;
+    char *capture_path = NULL, *replay_path = NULL, *separator;
+    const char *report_path = NULL;
+    unsigned long capture_seconds = SESSION_DEFAULT_SECONDS;
+    bool replay_realtime = false;
+    unsigned int trigger_mask = 0;
+    unsigned long trigger_pre = 0, trigger_post = 0;
+    int trigger_fields = 0;
+    unsigned long bench_seconds = 0;
+    bool force = false;
+    int rt_cpu = -1, gui_cpu = -1;
+    const char *health_path = CYCLE_HEALTH_SOCKET_DEFAULT;
+    const char *stream_path = NULL;
+    unsigned long prefault_stack_kb = PREFAULT_STACK_KB_DEFAULT, prefault_heap_kb = PREFAULT_HEAP_KB_DEFAULT;
+    pthread_attr_t thread_attr;
+    int initial_mode = MODE_PROFILE_VELOCITY;
+    int32_t initial_velocity = 0;
+    int autotune_fields = 0;
+    unsigned int autotune_axis = 0;
+    pthread_t autotune_thread_id;
+    unsigned int param_axis = 0;
+    double autotune_overshoot = AUTOTUNE_OVERSHOOT_PERCENT_DEFAULT, autotune_settling_ms = AUTOTUNE_SETTLING_MS_DEFAULT;
+    // Gain objects of the drive tuned by -A, only the simulation has defaults
+    int gain_fields = 0;
+    unsigned int gain_kp_index = 0, gain_ti_index = 0;
+    double gain_kp_scale = 1.0, gain_ti_scale = 1.0;
+    // Negative for the default shift
+    double sync0_shift_us = -1.0, sync0_margin_us = SYNC0_SHIFT_MARGIN_NS_DEFAULT / 1000.0;
+    double sync0_percentile = SYNC0_SHIFT_PERCENTILE_DEFAULT;
+
+    while ((opt = getopt(argc, argv, "n:b:f:Fc:l:dHs:o:g:r:t:C:P:p:m:v:A:G:D:U:L:x:S:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_axes = strtoul(optarg, NULL, 0);
+            if ((n_axes < 1) || (n_axes > MAX_AXES)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'b':
+            bench_seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            cycle_freq = strtoul(optarg, NULL, 0);
+            break;
+        case 'F':
+            force = true;
+            break;
+        case 'c':
+            if ((sscanf(optarg, "%d,%d", &rt_cpu, &gui_cpu) < 1) || (rt_cpu < 0) || (rt_cpu >= CPU_SETSIZE) ||
+                    (gui_cpu >= CPU_SETSIZE)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            if (sscanf(optarg, "%lu,%lu", &prefault_stack_kb, &prefault_heap_kb) < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'd':
+            dc_follow = true;
+            break;
+        case 'H':
+            headless = true;
+            break;
+        case 's':
+            health_path = optarg;
+            break;
+        case 'o':
+            if (strcmp(optarg, "skip") == 0) {
+                overrun_policy = CYCLE_OVERRUN_SKIP;
+            } else if (strncmp(optarg, "catchup", 7) == 0) {
+                int catch_up;
+                char end;
+
+                overrun_policy = CYCLE_OVERRUN_CATCH_UP;
+                if (optarg[7] != '\0') {
+                    if ((sscanf(optarg + 7, ",%d%c", &catch_up, &end) != 1) || (catch_up < 1)) {
+                        usage(argv[0]);
+                        return -1;
+                    }
+                    overrun_catch_up_max = catch_up;
+                }
+            } else if (strcmp(optarg, "stop") == 0) {
+                overrun_policy = CYCLE_OVERRUN_STOP;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'x':
+            stream_path = optarg;
+            break;
+        case 'S':
+            if (strncmp(optarg, "cal", 3) == 0) {
+                sync0_calibrate = true;
+                sscanf(optarg + 3, ",%lf,%lf", &sync0_margin_us, &sync0_percentile);
+            } else {
+                sync0_shift_us = atof(optarg);
+            }
+            if ((sync0_calibrate && ((sync0_margin_us < 0.0) || (sync0_percentile <= 0.0) || (sync0_percentile > 100.0))) ||
+                    (!sync0_calibrate && (sync0_shift_us < 0.0))) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'L':
+            if (strcmp(optarg, "classic") == 0) {
+                cycle_layout = CYCLE_LAYOUT_CLASSIC;
+            } else if (strcmp(optarg, "sendfirst") == 0) {
+                cycle_layout = CYCLE_LAYOUT_SEND_FIRST;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'g':
+            gui_rate = strtoul(optarg, NULL, 0);
+            if ((gui_rate < GUI_RATE_MIN) || (gui_rate > GUI_RATE_MAX)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'C':
+            capture_path = optarg;
+            if ((separator = strrchr(optarg, ','))) {
+                *separator = '\0';
+                capture_seconds = strtoul(separator + 1, NULL, 0);
+            }
+            break;
+        case 'P':
+            replay_path = optarg;
+            if ((separator = strrchr(optarg, ',')) && (strcmp(separator + 1, "rt") == 0)) {
+                *separator = '\0';
+                replay_realtime = true;
+            }
+            break;
+        case 'p':
+            report_path = optarg;
+            break;
+        case 'm':
+            initial_mode = strtol(optarg, NULL, 0);
+            if ((initial_mode != MODE_PROFILE_VELOCITY) && (initial_mode != MODE_CYCLIC_SYNC_VELOCITY)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'v':
+            initial_velocity = strtol(optarg, NULL, 0);
+            break;
+        case 'D':
+        case 'U':
+            param_job.download = (opt == 'D');
+            param_job.path = optarg;
+            separator = strchr(optarg, ',');
+            if (!param_job.download) {
+                if (!separator) {
+                    usage(argv[0]);
+                    return -1;
+                }
+                *separator = '\0';
+                param_job.save_path = separator + 1;
+                separator = strchr(separator + 1, ',');
+            }
+            if (separator) {
+                *separator = '\0';
+                param_axis = strtoul(separator + 1, NULL, 0);
+            }
+            break;
+        case 'A':
+            if ((autotune_fields = sscanf(optarg, "%u,%d,%lf,%lf", &autotune_axis, &autotune.step,
+                            &autotune_overshoot, &autotune_settling_ms)) < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'G':
+            if (((gain_fields = sscanf(optarg, "%i,%i,%lf,%lf", &gain_kp_index, &gain_ti_index, &gain_kp_scale,
+                                &gain_ti_scale)) < 2) || (gain_kp_index > 0xffff) || (gain_ti_index > 0xffff) ||
+                    (gain_kp_scale <= 0.0) || (gain_ti_scale <= 0.0)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 't':
+            // The fault bit 0x0008 triggers on a fault of any axis
+            if (((trigger_fields = sscanf(optarg, "%i,%lu,%lu", &trigger_mask, &trigger_pre, &trigger_post)) < 1) ||
+                    (trigger_mask == 0) || (trigger_mask > 0xffff)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : -1;
+        }
+    }
+    build_axis_table(n_axes);
+
+    // Everything timed in cycles is derived from the cycle frequency
+    for (i = 0; (i < CYCLE_FREQS) && (cycle_freqs[i] != cycle_freq); i++);
+    if (i == CYCLE_FREQS) {
+        usage(argv[0]);
+        return -1;
+    }
+    period_ns = NSEC_PER_SEC / cycle_freq;
+    period_s = 1.0 / cycle_freq;
+    cycletime.tv_sec = 0;
+    cycletime.tv_nsec = period_ns;
+    sync_ref_divider = cycle_freq / SYNC_REF_FREQ;
+    sync0_shift_ns = (sync0_shift_us >= 0.0) ? (int32_t)(sync0_shift_us * 1000.0) :
+            (int32_t)(((uint64_t)period_ns * SYNC0_SHIFT_PERMILLE) / 1000);
+    bench_cycles = bench_seconds * cycle_freq;
+    if (trigger_fields < 2)
+        trigger_pre = cycle_freq;
+    if (trigger_fields < 3)
+        trigger_post = cycle_freq;
+
+    // Until the gui publishes its first command, all axes are enabled in the initial mode and velocity
+    for (unsigned int a = 0; a < MAX_AXES; a++) {
+        rxpdo_default_command.velocity_setpoint[a] = initial_velocity;
+        rxpdo_default_command.enable[a] = 1;
+        rxpdo_default_command.mode_of_operation[a] = initial_mode;
+        rxpdo_default_command.profile_acceleration[a] = 0xa000;
+        rxpdo_default_command.profile_deceleration[a] = 0xa000;
+        // Acceleration is reached within 100 ms
+        rxpdo_default_command.profile_jerk[a] = 10 * 0xa000;
+    }
+    txpdo_queue_data.axes = axes;
+
+    if (autotune_fields) {
+        if ((autotune_axis < 1) || (autotune_axis > axes) || (autotune_overshoot <= 0.0) || (autotune_settling_ms <= 0.0)) {
+            usage(argv[0]);
+            return -1;
+        }
+        // The objects of the simulated drive are no standard, a real drive is only stepped with the gain
+        // objects of its manual
+        if (gain_fields == 0) {
+#ifdef ECRT_SIMULATION
+            gain_kp_index = AUTOTUNE_SIM_KP_INDEX;
+            gain_ti_index = AUTOTUNE_SIM_TI_INDEX;
+#else
+            fprintf(stderr, "-A needs the gain objects of the drive by -G kp_index,ti_index[,kp_scale,ti_scale]\n");
+            return -1;
+#endif
+        }
+        autotune.axis = autotune_axis - 1;
+        autotune.kp_index = gain_kp_index;
+        autotune.ti_index = gain_ti_index;
+        autotune.kp_scale = gain_kp_scale;
+        autotune.ti_scale = gain_ti_scale;
+        if (autotune_fields < 2)
+            autotune.step = AUTOTUNE_STEP_DEFAULT;
+        autotune.overshoot_max = autotune_overshoot / 100.0;
+        autotune.settling_max_s = autotune_settling_ms / 1000.0;
+        autotune.period_s = period_s;
+        autotune.command = rxpdo_default_command;
+        autotune.ring = &txpdo_ring;
+        autotune.channel = &rxpdo_channel;
+        autotune.sdo = &sdo_engine;
+        autotune.stop = &cycle_stop;
+    }
+
+    if (param_job.path) {
+        // Without axis a set is downloaded to all axes and uploaded from the first
+        if (param_axis > axes) {
+            usage(argv[0]);
+            return -1;
+        }
+        param_job.first_axis = param_axis ? param_axis - 1 : 0;
+        param_job.axes = (param_axis || !param_job.download) ? 1 : axes;
+        for (unsigned int a = 0; a < axes; a++) {
+            param_job.alias[a] = axis_table[a].alias;
+            param_job.position[a] = axis_table[a].position;
+        }
+        param_job.command = rxpdo_default_command;
+        param_job.ring = &txpdo_ring;
+        param_job.channel = &rxpdo_channel;
+        param_job.sdo = &sdo_engine;
+    }
+
+    // A replay takes axes, layout and period from the capture and needs no master
+    if (replay_path) {
+        return (replay_session(replay_path, replay_realtime, report_path) == 0) ? 0 : 1;
+    }
+
+	// Init the ring buffer for passing TX PDO's to the gui thread
+	txpdo_ring_init(&txpdo_ring);
+	// Init the command channel from the gui thread
+	rxpdo_channel_init(&rxpdo_channel, &rxpdo_default_command);
+#ifdef PIGPIO_OUT
+	int pigpio_version;
+#endif
+
+	if ((signal(SIGINT, signal_handler) == SIG_ERR) || (signal(SIGTERM, signal_handler) == SIG_ERR) || (signal(SIGWINCH, signal_handler) == SIG_ERR) )
+	{
+		perror("signal handler registration failed");
+	}
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        perror("mlockall failed");
+        return -1;
+    }
+    prefault_memory(prefault_stack_kb, prefault_heap_kb);
+    if (sync0_calibrate) {
+        sync0_run.capacity = SYNC0_SHIFT_CAL_SECONDS * cycle_freq + 1;
+        if (!(sync0_run.samples = calloc(sync0_run.capacity, sizeof(sync0_sample_t)))) {
+            perror("allocation of the SYNC0 calibration failed");
+            return -1;
+        }
+    }
+
+#ifdef CALC_TIMING
+    // Timing statistics are published in shared memory with a window of one second
+    if (cycle_stats_create(&cycle_stats, period_ns, cycle_freq, cycle_layout)) {
+        return -1;
+    }
+#endif
+
+    if (record_path) {
+        // With a trigger, the ring holds exactly the pre and post trigger windows
+        unsigned long capacity = trigger_mask ? (trigger_pre + trigger_post + 1) : (RECORDER_DEFAULT_SECONDS * cycle_freq);
+
+        if (pdo_recorder_create(&pdo_recorder, record_path, axes, capacity, period_ns,
+                    trigger_mask, trigger_pre, trigger_post)) {
+            return -1;
+        }
+        printf("Recording %lu cycles into %s.\n", capacity, record_path);
+    }
+
+#ifdef PIGPIO_OUT
+    pigpio_version = gpioInitialise(); 			// Initialise pigpio
+    if(pigpio_version < 0)
+    {
+    	printf("pigpio could not be initialised. Maybe library not installed or pigpio.service is running.\n");
+    }
+    else
+    {
+    	printf("pigpio with version %d initialised\n", pigpio_version);
+    	gpioSetMode( 14, PI_OUTPUT);					// Set GPIO14 to output
+    }
+#endif
+
+    if (configure_master(sync0_shift_ns))
+        return -1;
+    if (headless && !(process_image_shm = process_image_create(period_ns, ecrt_domain_size(domain1)))) {
+        return -1;
+    }
+    if (capture_path) {
+        // Commands are published by the gui at most at its frame rate
+        uint64_t capacity = capture_seconds * (cycle_freq * SESSION_CYCLE_SIZE(ecrt_domain_size(domain1)) +
+                64 * SESSION_COMMAND_SIZE);
+
+        if (session_create(&session, capture_path, axes, period_ns, ecrt_domain_size(domain1), &CiA402_offsets,
+                    sizeof(CiA402_offsets), capacity)) {
+            return -1;
+        }
+        printf("Capturing %lu s of the session into %s.\n", capture_seconds, capture_path);
+    }
+
+    // Served and logged by a thread of normal policy on any cpu, so it is started before the priority and affinity are set
+    cycle_health_init(&cycle_health, period_ns);
+    if (cycle_health_serve(&cycle_health, health_path, bench_cycles || headless))
+        return -1;
+    if (stream_path && cmd_stream_serve(&cmd_stream, stream_path, period_ns, axes))
+        return -1;
 
-    /* Call ncurses gui thread */
-    ncurses_gui_thread(master, domain1, domain1_pd, &mymutex, &mycondition);
     /* Set priority */
 
     struct sched_param param = {};
@@ -507,10 +1863,85 @@ int main(int argc, char **argv)
     if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
         perror("sched_setscheduler failed\n");
     }
+    if (rt_cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(rt_cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            perror("sched_setaffinity failed");
+            return -1;
+        }
+        printf("Cycle on cpu %d (%s), gui on cpu %d.\n", rt_cpu,
+                cpu_isolated(rt_cpu) ? "isolated" : "not isolated, see isolcpus=", gui_cpu);
+    }
+
+    // The cycle frequency is checked with the real cycle before its data is consumed by anyone
+    if (!check_cycle_load() && !force) {
+        ecrt_release_master(master);
+        return -1;
+    }
+    txpdo_publish = true;
+    if (sync0_calibrate) {
+        int result = calibrate_sync0_shift(sync0_margin_us * 1000.0, sync0_percentile);
+
+        ecrt_release_master(master);
+        return result;
+    }
+    // Entries streamed during the check wait in the queue
+    if (stream_path) {
+        command_stream = &cmd_stream;
+        printf("Accepting command streams on %s.\n", stream_path);
+    }
+
+    thread_attr_init(&thread_attr, param.sched_priority - 1, gui_cpu);
+    if (param_job.path) {
+        pthread_t param_thread;
+
+        param_job.master = master;
+        if (pthread_create(&param_thread, &thread_attr, &param_set_thread, &param_job) != 0) {
+            pthread_attr_setinheritsched(&thread_attr, PTHREAD_INHERIT_SCHED);
+            pthread_create(&param_thread, &thread_attr, &param_set_thread, &param_job);
+        }
+    } else if (autotune_fields) {
+        if (pthread_create(&autotune_thread_id, &thread_attr, &autotune_thread, &autotune) != 0) {
+            pthread_attr_setinheritsched(&thread_attr, PTHREAD_INHERIT_SCHED);
+            pthread_create(&autotune_thread_id, &thread_attr, &autotune_thread, &autotune);
+        }
+    } else if (bench_cycles || headless) {
+        pthread_t drain_thread;
+
+        if (pthread_create(&drain_thread, &thread_attr, &bench_drain, NULL) != 0) {
+            // Without privileges the thread runs with the inherited policy
+            pthread_attr_setinheritsched(&thread_attr, PTHREAD_INHERIT_SCHED);
+            pthread_create(&drain_thread, &thread_attr, &bench_drain, NULL);
+        }
+    } else {
+        /* Call ncurses gui thread */
+        gui_active = true;
+        ncurses_gui_thread(master, domain1, domain1_pd, &rxpdo_channel, &txpdo_ring, &sdo_engine, gui_rate, cycle_freq, &thread_attr);
+    }
+    pthread_attr_destroy(&thread_attr);
 
     // Start cyclic ethercat communication within main context
     printf("Starting cyclic function.\n");
-    cyclic_task();
+    getrusage(RUSAGE_THREAD, &cycle_usage);
+#ifdef CALC_TIMING
+    // The cycles of the startup check are not part of the benchmark
+    if (bench_cycles) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_SOURCE, &now);
+        cycle_stats_start_total(&cycle_stats, &bench_stats, TIMESPEC2NS(now));
+    }
+#endif
+    cyclic_task(bench_cycles);
+
+    if (bench_cycles)
+        bench_report();
+    // Only the tuning stops the cycle, its thread returns right after
+    if (atomic_load(&cycle_stop))
+        pthread_join(autotune_thread_id, NULL);
 
     // After task ends, cleanup
     ecrt_release_master(master);
@@ -519,12 +1950,7 @@ int main(int argc, char **argv)
 	gpioTerminate();
 #endif
 
-    // Destroy mutex
-    pthread_mutex_destroy(&mymutex);
-    pthread_cond_destroy(&mycondition);
-    // Remove queue
-    mq_close(myqueue);
-    return 0;
+    return atomic_load(&cycle_stop) ? autotune.status : 0;
 }
 
 /****************************************************************************/
@@ -0,0 +1,430 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ecrt.h>
+#include "param_set.h"
+#include "pdo_ring.h"
+#include "rxpdo_channel.h"
+#include "sdo_engine.h"
+
+// Completions are polled at this interval, short against the duration of a transfer
+#define PARAM_POLL_NS 1000000L
+// Time for the drives to leave operation enabled before the transfer
+#define PARAM_DISABLE_MS 100
+#define PARAM_ABORT_UNSUPPORTED 0x06010000
+
+static const char* const param_type_names[PARAM_TYPES] = {"u8", "u16", "u32", "i8", "i16", "i32"};
+static const uint8_t param_type_sizes[PARAM_TYPES] = {1, 2, 4, 1, 2, 4};
+
+typedef enum
+{
+	TRANSFER_NONE = 0,			// Not to be transferred by the SDO engine
+	TRANSFER_TODO,
+	TRANSFER_PENDING,
+	TRANSFER_DONE,
+	TRANSFER_FAILED
+}transfer_state_t;
+
+typedef struct
+{
+	uint8_t state;				// transfer_state_t
+	int entry;					// Cache entry of the SDO engine
+	uint32_t errors;			// Errors of the entry before the transfer
+	uint32_t value;
+}transfer_t;
+
+// Only used by the parameter thread
+static param_set_t param_set;
+static transfer_t transfers[MAX_AXES][PARAM_SET_MAX];
+static txpdo_queue_data_t batch[64];
+
+/****************************************************************************/
+
+static uint32_t param_mask(uint8_t type)
+{
+	return (param_type_sizes[type] == 4) ? 0xffffffffU : ((1U << (8 * param_type_sizes[type])) - 1);
+}
+
+static long param_signed(const param_t* param)
+{
+	switch (param->type)
+	{
+	case PARAM_I8: return (int8_t)param->value;
+	case PARAM_I16: return (int16_t)param->value;
+	case PARAM_I32: return (int32_t)param->value;
+	}
+	return param->value;
+}
+
+static uint64_t param_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Waits one poll interval and discards the cycle data, nobody else drains the ring
+static void param_poll(param_job_t* job)
+{
+	struct timespec period = {0, PARAM_POLL_NS};
+
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &period, NULL);
+	while (txpdo_ring_pop_batch(job->ring, batch, 64) > 0);
+}
+
+/****************************************************************************/
+
+int param_set_load(param_set_t* set, const char* path)
+{
+	FILE* file = fopen(path, "r");
+	char line[256], type[8];
+	unsigned int number = 0, index, subindex;
+	long value;
+	int fields;
+
+	set->count = 0;
+	if (!file)
+	{
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file))
+	{
+		param_t* param = &set->params[set->count];
+		char* comment = strchr(line, '#');
+		uint8_t t;
+
+		number++;
+		if (comment)
+			*comment = '\0';
+		value = 0;
+		if ((fields = sscanf(line, "%i %i %7s %li", &index, &subindex, type, &value)) <= 0)
+		{
+			continue;
+		}
+		for (t = 0; (t < PARAM_TYPES) && (strcmp(type, param_type_names[t]) != 0); t++);
+		if ((fields < 3) || (index > 0xffff) || (subindex > 0xff) || (t == PARAM_TYPES))
+		{
+			fprintf(stderr, "%s:%u: expected index subindex type [value]\n", path, number);
+			fclose(file);
+			return -1;
+		}
+		if (set->count == PARAM_SET_MAX)
+		{
+			fprintf(stderr, "%s:%u: more than %u objects\n", path, number, PARAM_SET_MAX);
+			fclose(file);
+			return -1;
+		}
+		param->index = index;
+		param->subindex = subindex;
+		param->type = t;
+		param->value = (uint32_t)value & param_mask(t);
+		set->count++;
+	}
+	fclose(file);
+	return 0;
+}
+
+int param_set_save(const param_set_t* set, const char* path, unsigned int axis)
+{
+	FILE* file = fopen(path, "w");
+
+	if (!file)
+	{
+		perror(path);
+		return -1;
+	}
+	fprintf(file, "# Parameter set of axis %u\n# index subindex type value\n", axis + 1);
+	for (unsigned int i = 0; i < set->count; i++)
+	{
+		const param_t* param = &set->params[i];
+
+		fprintf(file, "0x%04x %u %s %ld\n", param->index, param->subindex, param_type_names[param->type],
+				param_signed(param));
+	}
+	if (fclose(file) != 0)
+	{
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/****************************************************************************/
+
+// Runs all transfers to do through the SDO engine, as many queued at once as it takes.
+// Returns the number of failed transfers.
+static unsigned int param_transfer(param_job_t* job, bool write)
+{
+	unsigned int total = job->axes * param_set.count, next = 0, outstanding = 0, failed = 0;
+
+	while ((next < total) || outstanding)
+	{
+		// Queue until the queue of the engine is full
+		for (; next < total; next++)
+		{
+			unsigned int a = job->first_axis + next / param_set.count;
+			const param_t* param = &param_set.params[next % param_set.count];
+			transfer_t* t = &transfers[a][next % param_set.count];
+			uint8_t size = param_type_sizes[param->type];
+			sdo_result_t result;
+			bool queued;
+
+			if (t->state != TRANSFER_TODO)
+				continue;
+			if (((t->entry = sdo_engine_watch(job->sdo, a, param->index, param->subindex, size)) < 0) ||
+					!sdo_engine_result(job->sdo, t->entry, &result))
+			{
+				fprintf(stderr, "params: no cache entry for 0x%04x:%u of axis %u\n", param->index, param->subindex, a + 1);
+				t->state = TRANSFER_FAILED;
+				failed++;
+				continue;
+			}
+			t->errors = result.errors;
+			queued = write ? sdo_engine_write(job->sdo, a, param->index, param->subindex, size, param->value) :
+					sdo_engine_read(job->sdo, a, param->index, param->subindex, size);
+			if (!queued)
+				break;
+			t->state = TRANSFER_PENDING;
+			outstanding++;
+		}
+
+		param_poll(job);
+		for (unsigned int a = job->first_axis; a < job->first_axis + job->axes; a++)
+		{
+			for (unsigned int i = 0; i < param_set.count; i++)
+			{
+				transfer_t* t = &transfers[a][i];
+				sdo_result_t result;
+
+				if ((t->state != TRANSFER_PENDING) || !sdo_engine_result(job->sdo, t->entry, &result) ||
+						(result.pending != 0))
+					continue;
+				outstanding--;
+				if ((result.errors != t->errors) || (result.state != SDO_ENTRY_VALID))
+				{
+					fprintf(stderr, "params: SDO %s of 0x%04x:%u of axis %u failed\n", write ? "download" : "upload",
+							param_set.params[i].index, param_set.params[i].subindex, a + 1);
+					t->state = TRANSFER_FAILED;
+					failed++;
+					continue;
+				}
+				t->state = TRANSFER_DONE;
+				t->value = result.value & param_mask(param_set.params[i].type);
+			}
+		}
+	}
+	return failed;
+}
+
+// Ring position of an axis addressed by alias and position, -1 if not found
+static int param_ring_position(param_job_t* job, unsigned int axis)
+{
+	ec_master_info_t master_info;
+	ec_slave_info_t slave_info;
+
+	if (job->alias[axis] == 0)
+		return job->position[axis];
+	if (ecrt_master(job->master, &master_info) != 0)
+		return -1;
+	for (unsigned int p = 0; p < master_info.slave_count; p++)
+	{
+		if ((ecrt_master_get_slave(job->master, p, &slave_info) == 0) && (slave_info.alias == job->alias[axis]))
+		{
+			return (p + job->position[axis] < master_info.slave_count) ? (int)(p + job->position[axis]) : -1;
+		}
+	}
+	return -1;
+}
+
+// Number of objects from first on which are the subindexes 1 .. n of one object, 0 if less than two
+static unsigned int param_complete_count(unsigned int first)
+{
+	const param_t* params = param_set.params;
+	unsigned int n = 0;
+
+	while ((first + n < param_set.count) && (params[first + n].index == params[first].index) &&
+			(params[first + n].subindex == n + 1))
+		n++;
+	return (n >= 2) ? n : 0;
+}
+
+// Downloads the objects which can be transferred by complete access. The objects of a failed
+// transfer are left to the SDO engine, after an unsupported access all objects of the axis are.
+static void param_download_complete(param_job_t* job, unsigned int axis, unsigned int* transfers_done,
+		unsigned int* objects_done)
+{
+	int position = param_ring_position(job, axis);
+	uint8_t data[PARAM_SET_COMPLETE_MAX_SIZE];
+
+	if (position < 0)
+	{
+		printf("params: axis %u not found on the ring, no complete access\n", axis + 1);
+		return;
+	}
+	for (unsigned int i = 0; i < param_set.count;)
+	{
+		unsigned int n = param_complete_count(i), size = 2;
+		uint32_t abort_code = 0;
+		int ret;
+
+		for (unsigned int s = 0; s < n; s++)
+		{
+			size += param_type_sizes[param_set.params[i + s].type];
+		}
+		if ((n == 0) || (size > PARAM_SET_COMPLETE_MAX_SIZE))
+		{
+			i += n ? n : 1;
+			continue;
+		}
+		// Subindex 0 is one byte padded to 16 bits
+		data[0] = n;
+		data[1] = 0;
+		size = 2;
+		for (unsigned int s = 0; s < n; s++)
+		{
+			for (unsigned int b = 0; b < param_type_sizes[param_set.params[i + s].type]; b++)
+			{
+				data[size++] = (uint8_t)(param_set.params[i + s].value >> (8 * b));
+			}
+		}
+		ret = ecrt_master_sdo_download_complete(job->master, position, param_set.params[i].index, data, size,
+				&abort_code);
+		if (ret == 0)
+		{
+			for (unsigned int s = 0; s < n; s++)
+				transfers[axis][i + s].state = TRANSFER_DONE;
+			(*transfers_done)++;
+			*objects_done += n;
+		}
+		else
+		{
+			printf("params: complete access to 0x%04x of axis %u failed (%s, abort 0x%08x)\n",
+					param_set.params[i].index, axis + 1, strerror(-ret), abort_code);
+			if (abort_code == PARAM_ABORT_UNSUPPORTED)
+				return;
+		}
+		i += n;
+	}
+}
+
+static void param_set_state(param_job_t* job, transfer_state_t state)
+{
+	for (unsigned int a = job->first_axis; a < job->first_axis + job->axes; a++)
+	{
+		for (unsigned int i = 0; i < param_set.count; i++)
+		{
+			transfers[a][i].state = state;
+		}
+	}
+}
+
+static int param_download(param_job_t* job)
+{
+	unsigned int complete_transfers = 0, complete_objects = 0, failed, mismatches = 0;
+	unsigned int objects = job->axes * param_set.count;
+	uint64_t start_ns = param_now_ns(), download_ns, verify_ns;
+
+	param_set_state(job, TRANSFER_TODO);
+	for (unsigned int a = job->first_axis; a < job->first_axis + job->axes; a++)
+	{
+		param_download_complete(job, a, &complete_transfers, &complete_objects);
+	}
+	failed = param_transfer(job, true);
+	download_ns = param_now_ns();
+
+	// Every object is read back, also those downloaded by complete access
+	param_set_state(job, TRANSFER_TODO);
+	failed += param_transfer(job, false);
+	verify_ns = param_now_ns();
+	for (unsigned int a = job->first_axis; a < job->first_axis + job->axes; a++)
+	{
+		for (unsigned int i = 0; i < param_set.count; i++)
+		{
+			const param_t* param = &param_set.params[i];
+			transfer_t* t = &transfers[a][i];
+
+			if ((t->state == TRANSFER_DONE) && (t->value != param->value))
+			{
+				fprintf(stderr, "params: 0x%04x:%u of axis %u is %u instead of %u\n", param->index, param->subindex,
+						a + 1, t->value, param->value);
+				mismatches++;
+			}
+		}
+	}
+
+	printf("params: downloaded %u objects to %u axes in %.1f ms, %u by %u complete access transfers, %u single\n",
+			objects, job->axes, (download_ns - start_ns) / 1e6, complete_objects, complete_transfers,
+			objects - complete_objects);
+	printf("params: verified %u objects in %.1f ms, %u failed transfers, %u mismatches\n", objects,
+			(verify_ns - download_ns) / 1e6, failed, mismatches);
+	printf("params: total %.1f ms, %.2f ms per object\n", (verify_ns - start_ns) / 1e6,
+			objects ? (verify_ns - start_ns) / 1e6 / objects : 0.0);
+	return (failed || mismatches) ? -1 : 0;
+}
+
+static int param_upload(param_job_t* job)
+{
+	uint64_t start_ns = param_now_ns(), end_ns;
+	unsigned int failed;
+
+	param_set_state(job, TRANSFER_TODO);
+	failed = param_transfer(job, false);
+	end_ns = param_now_ns();
+	for (unsigned int i = 0; i < param_set.count; i++)
+	{
+		param_set.params[i].value = transfers[job->first_axis][i].value;
+	}
+	printf("params: uploaded %u objects of axis %u in %.1f ms, %u failed\n", param_set.count, job->first_axis + 1,
+			(end_ns - start_ns) / 1e6, failed);
+	if (failed || param_set_save(&param_set, job->save_path, job->first_axis))
+		return -1;
+	printf("params: saved to %s\n", job->save_path);
+	return 0;
+}
+
+/****************************************************************************/
+
+void* param_set_thread(void* arg)
+{
+	param_job_t* job = (param_job_t*)arg;
+	int ret;
+
+	if (param_set_load(&param_set, job->path))
+		exit(1);
+
+	// Drives usually refuse changes of their parameters in operation enabled
+	for (unsigned int a = 0; a < MAX_AXES; a++)
+	{
+		job->command.enable[a] = 0;
+	}
+	rxpdo_channel_publish(job->channel, &job->command);
+	for (unsigned int i = 0; i < PARAM_DISABLE_MS * 1000000L / PARAM_POLL_NS; i++)
+	{
+		param_poll(job);
+	}
+
+	ret = job->download ? param_download(job) : param_upload(job);
+	exit(ret ? 1 : 0);
+	return NULL;
+}
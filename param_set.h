@@ -0,0 +1,95 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARAM_SET_H_
+#define PARAM_SET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "servo_gui.h"
+
+// Parameter sets of the drives, e.g. the vendor specific objects 0x2xxx set at commissioning.
+// A set is a text file with one object per line:
+//
+//   # index subindex type value
+//   0x2001 0 u16 300
+//   0x2010 1 i32 -20
+//
+// with the types u8, u16, u32, i8, i16 and i32. A download writes the set to the drives and
+// verifies it by reading every object back, an upload reads the objects listed in a file (the
+// values are ignored) from a drive and saves them as set. The transfers are pipelined through
+// the SDO engine, which keeps requests of every slave queued in the master. Objects listed with
+// the subindexes 1 .. n in order are downloaded by one complete access transfer if the drive
+// accepts it, otherwise one by one. The drives are disabled during the transfer.
+#define PARAM_SET_MAX 256
+// Data of a complete access transfer: subindex 0 padded to 16 bits and the subindexes 1 .. n
+#define PARAM_SET_COMPLETE_MAX_SIZE 512
+
+typedef enum
+{
+	PARAM_U8 = 0,
+	PARAM_U16,
+	PARAM_U32,
+	PARAM_I8,
+	PARAM_I16,
+	PARAM_I32,
+	PARAM_TYPES
+}param_type_t;
+
+typedef struct
+{
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t type;					// param_type_t
+	uint32_t value;					// Raw value of the size of the type
+}param_t;
+
+typedef struct
+{
+	param_t params[PARAM_SET_MAX];
+	unsigned int count;
+}param_set_t;
+
+int param_set_load(param_set_t* set, const char* path);
+int param_set_save(const param_set_t* set, const char* path, unsigned int axis);
+
+struct txpdo_ring;
+struct rxpdo_channel;
+struct sdo_engine;
+
+typedef struct
+{
+	// Set by the caller
+	bool download;
+	const char* path;
+	const char* save_path;			// Upload only
+	unsigned int first_axis;
+	unsigned int axes;
+	uint16_t alias[MAX_AXES];		// Addresses of the axes for complete access
+	uint16_t position[MAX_AXES];
+	rxpdo_queue_data_t command;
+	ec_master_t* master;
+	struct txpdo_ring* ring;
+	struct rxpdo_channel* channel;
+	struct sdo_engine* sdo;
+}param_job_t;
+
+// Thread function, runs the job and exits the process with 0 if all objects were transferred
+// and verified
+void* param_set_thread(void* arg);
+
+#endif /* PARAM_SET_H_ */
@@ -0,0 +1,87 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PDO_LAYOUT_H_
+#define PDO_LAYOUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// PDO mapping of an ECT60 drive, the only place it is spelled out. Each table lists the entries
+// of one PDO in mapping order as X(name, index, subindex, type), the bit length follows from the
+// type. The tables generate the PDO and SDO entry lists for the master, the registration of the
+// domain and the packed image of an axis, so the cycle copies the process data of all axes in and
+// out at once and accesses it by name.
+//
+// The master places the sync managers of a slave in the domain in the order their first entry is
+// registered, the inputs are registered first. Every axis then occupies one pdo_axis_t in the
+// domain, which is checked against the offsets reported by the master after the registration.
+#define PDO_TX_INDEX 0x1a01
+#define PDO_TX_ENTRIES(X) \
+	X(statusword,			0x6041, 0, uint16_t) \
+	X(mode_display,			0x6061, 0, int8_t) \
+	X(velocity_actual,		0x606c, 0, int32_t) \
+	X(digital_inputs,		0x60fd, 0, uint32_t)
+
+#define PDO_RX_INDEX 0x1602
+#define PDO_RX_ENTRIES(X) \
+	X(controlword,			0x6040, 0, uint16_t) \
+	X(profile_acceleration,	0x6083, 0, uint32_t) \
+	X(profile_deceleration,	0x6084, 0, uint32_t) \
+	X(target_velocity,		0x60ff, 0, int32_t) \
+	X(mode_of_operation,	0x6060, 0, int8_t) \
+	X(digital_outputs,		0x2006, 0, uint16_t)
+
+#define PDO_ENTRIES(X) PDO_TX_ENTRIES(X) PDO_RX_ENTRIES(X)
+
+// Expanders of the tables
+#define PDO_FIELD(name, index, subindex, type) type name;
+#define PDO_SIZE(name, index, subindex, type) + sizeof(type)
+#define PDO_COUNT(name, index, subindex, type) + 1
+#define PDO_ENTRY_INFO(name, index, subindex, type) {index, subindex, 8 * sizeof(type)},
+
+// The process data is little endian, the image is accessed without conversion
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the PDO image requires a little endian host");
+
+typedef struct __attribute__((packed))
+{
+	PDO_TX_ENTRIES(PDO_FIELD)
+}pdo_inputs_t;
+
+typedef struct __attribute__((packed))
+{
+	PDO_RX_ENTRIES(PDO_FIELD)
+}pdo_outputs_t;
+
+typedef struct __attribute__((packed))
+{
+	pdo_inputs_t in;
+	pdo_outputs_t out;
+}pdo_axis_t;
+
+_Static_assert(sizeof(pdo_inputs_t) == 0 PDO_TX_ENTRIES(PDO_SIZE), "TX PDO image not packed");
+_Static_assert(sizeof(pdo_outputs_t) == 0 PDO_RX_ENTRIES(PDO_SIZE), "RX PDO image not packed");
+
+#define PDO_TX_COUNT (0 PDO_TX_ENTRIES(PDO_COUNT))
+#define PDO_RX_COUNT (0 PDO_RX_ENTRIES(PDO_COUNT))
+#define PDO_REGS_PER_AXIS (PDO_TX_COUNT + PDO_RX_COUNT)
+
+// Offset of an entry within the image of an axis
+#define PDO_TX_OFFSET(name) (offsetof(pdo_axis_t, in) + offsetof(pdo_inputs_t, name))
+#define PDO_RX_OFFSET(name) (offsetof(pdo_axis_t, out) + offsetof(pdo_outputs_t, name))
+
+#endif /* PDO_LAYOUT_H_ */
@@ -0,0 +1,92 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "pdo_recorder.h"
+
+/****************************************************************************/
+
+// Creates the ring file and maps it. Must be called before the real time cycle starts.
+// All pages are written once here, so they are present and writable during recording.
+int pdo_recorder_create(pdo_recorder_t* rec, const char* path, uint32_t axes, uint64_t capacity, uint32_t period_ns,
+		uint16_t trigger_mask, uint64_t pre_trigger, uint64_t post_trigger)
+{
+	pdo_recorder_header_t* header;
+	size_t size = PDO_RECORDER_HEADER_SIZE + capacity * PDO_RECORD_SIZE(axes);
+	int fd, err;
+
+	memset(rec, 0, sizeof(pdo_recorder_t));
+	fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		perror("open of pdo recording failed");
+		return -1;
+	}
+	// Unlike ftruncate, the blocks are reserved, so a full file system cannot fault the cycle later
+	if ((err = posix_fallocate(fd, 0, size)) != 0)
+	{
+		errno = err;
+		perror("posix_fallocate of pdo recording failed");
+		close(fd);
+		return -1;
+	}
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+	{
+		perror("mmap of pdo recording failed");
+		return -1;
+	}
+	memset(header, 0, size);
+	header->version = PDO_RECORDER_VERSION;
+	header->record_size = PDO_RECORD_SIZE(axes);
+	header->axes = axes;
+	header->capacity = capacity;
+	header->period_ns = period_ns;
+	header->trigger_mask = trigger_mask;
+	header->pre_trigger = pre_trigger;
+	header->post_trigger = post_trigger;
+	atomic_init(&header->written, 0);
+	atomic_init(&header->trigger_record, 0);
+	atomic_init(&header->stopped, 0);
+	atomic_thread_fence(memory_order_release);
+	header->magic = PDO_RECORDER_MAGIC;
+
+	rec->header = header;
+	rec->records = (uint8_t*)header + PDO_RECORDER_HEADER_SIZE;
+	rec->map_size = size;
+	rec->record_size = header->record_size;
+	rec->axes = axes;
+	rec->capacity = capacity;
+	rec->trigger_mask = trigger_mask;
+	return 0;
+}
+
+// Unmaps the ring file. The recording stays in the file for pdo_rec2csv.
+void pdo_recorder_close(pdo_recorder_t* rec)
+{
+	if (rec->header)
+	{
+		munmap(rec->header, rec->map_size);
+		rec->header = NULL;
+	}
+}
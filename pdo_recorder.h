@@ -0,0 +1,140 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PDO_RECORDER_H_
+#define PDO_RECORDER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Recorder of the process data of every cycle into a memory mapped ring file. The file is
+// allocated, mapped and written once completely before the cycle starts, so recording is
+// a plain memory copy without any system call or page fault. The file should be placed on
+// a tmpfs (e.g. /dev/shm), since on other file systems the write back of dirty pages
+// write protects them again and the next record would fault.
+#define PDO_RECORDER_MAGIC 0x45435452	// "ECTR"
+#define PDO_RECORDER_VERSION 1
+#define PDO_RECORDER_HEADER_SIZE 4096
+
+// Process data of an axis within a record
+typedef struct
+{
+	uint16_t statusword;		// 0x6041
+	int8_t mode_display;		// 0x6061
+	uint8_t reserved;
+	int32_t velocity_actual;	// 0x606c
+	uint32_t digital_inputs;	// 0x60fd
+	int32_t target_velocity;	// 0x60ff
+}pdo_record_axis_t;
+
+// Record of a cycle, followed by the data of all axes
+typedef struct
+{
+	uint64_t cycle;
+	uint64_t wakeup_ns;			// CLOCK_MONOTONIC time the cycle was scheduled for
+	uint64_t start_ns;			// CLOCK_MONOTONIC time the cycle actually started
+	pdo_record_axis_t axis[];
+}pdo_record_t;
+
+#define PDO_RECORD_SIZE(AXES) (sizeof(pdo_record_t) + (AXES) * sizeof(pdo_record_axis_t))
+
+// Header at the beginning of the file, the records follow at PDO_RECORDER_HEADER_SIZE.
+// The ring holds the records written - capacity .. written - 1.
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t axes;
+	uint64_t capacity;				// Number of records in the ring
+	uint32_t period_ns;
+	uint16_t trigger_mask;			// Trigger if (statusword & mask) == mask for any axis, 0 disables
+	uint16_t reserved;
+	uint64_t pre_trigger;			// Records kept before the trigger
+	uint64_t post_trigger;			// Records written after the trigger until recording stops
+	_Alignas(64) atomic_ullong written;
+	atomic_ullong trigger_record;	// Number of the record which triggered plus one, 0 if not triggered
+	atomic_uint stopped;
+}pdo_recorder_header_t;
+
+typedef struct
+{
+	pdo_recorder_header_t* header;
+	uint8_t* records;
+	size_t map_size;
+	uint32_t record_size;
+	uint32_t axes;
+	uint64_t capacity;
+	uint64_t slot;
+	uint64_t written;
+	uint64_t trigger_record;
+	uint16_t trigger_mask;
+	bool last_match;
+	bool stopped;
+}pdo_recorder_t;
+
+int pdo_recorder_create(pdo_recorder_t* rec, const char* path, uint32_t axes, uint64_t capacity, uint32_t period_ns,
+		uint16_t trigger_mask, uint64_t pre_trigger, uint64_t post_trigger);
+void pdo_recorder_close(pdo_recorder_t* rec);
+
+// Called by cyclic_task. Returns the record to fill for this cycle, NULL if not recording.
+static inline pdo_record_t* pdo_recorder_next(pdo_recorder_t* rec)
+{
+	if ((rec->header == NULL) || rec->stopped)
+	{
+		return NULL;
+	}
+	return (pdo_record_t*)(rec->records + rec->slot * rec->record_size);
+}
+
+// Called by cyclic_task after the record returned by pdo_recorder_next() is filled.
+// The trigger fires on the first record matching the trigger condition.
+static inline void pdo_recorder_commit(pdo_recorder_t* rec, const pdo_record_t* record)
+{
+	pdo_recorder_header_t* header = rec->header;
+	bool match = false;
+
+	if (rec->trigger_mask)
+	{
+		for (uint32_t a = 0; a < rec->axes; a++)
+		{
+			match |= (record->axis[a].statusword & rec->trigger_mask) == rec->trigger_mask;
+		}
+	}
+	if (++rec->slot == rec->capacity)
+	{
+		rec->slot = 0;
+	}
+	rec->written++;
+
+	if ((rec->trigger_record == 0) && match && !rec->last_match)
+	{
+		rec->trigger_record = rec->written;
+		atomic_store_explicit(&header->trigger_record, rec->trigger_record, memory_order_relaxed);
+	}
+	rec->last_match = match;
+	if (rec->trigger_record && ((rec->written - rec->trigger_record) >= header->post_trigger))
+	{
+		rec->stopped = true;
+		atomic_store_explicit(&header->stopped, 1, memory_order_relaxed);
+	}
+	atomic_store_explicit(&header->written, rec->written, memory_order_release);
+}
+
+#endif /* PDO_RECORDER_H_ */
@@ -0,0 +1,115 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PDO_RING_H_
+#define PDO_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "servo_gui.h"
+
+// Single producer (cyclic_task) / single consumer (gui thread) ring buffer of
+// TX PDO samples. The producer side is wait-free and never enters the kernel,
+// so it may be used from within the real time cycle. Both indices are free
+// running and only masked on slot access, therefore the size must be a power of two.
+#define TXPDO_RING_SIZE 1024
+#define TXPDO_RING_MASK (TXPDO_RING_SIZE - 1)
+
+#define CACHELINE_SIZE 64
+
+typedef struct txpdo_ring
+{
+	// Producer cache line: written by cyclic_task only
+	_Alignas(CACHELINE_SIZE) atomic_uint head;
+	unsigned int cached_tail;
+	atomic_ulong overflows;
+	// Consumer cache line: written by gui thread only
+	_Alignas(CACHELINE_SIZE) atomic_uint tail;
+	unsigned int cached_head;
+	// Sample storage
+	_Alignas(CACHELINE_SIZE) txpdo_queue_data_t slots[TXPDO_RING_SIZE];
+}txpdo_ring_t;
+
+static inline void txpdo_ring_init(txpdo_ring_t* ring)
+{
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->overflows, 0);
+	ring->cached_tail = 0;
+	ring->cached_head = 0;
+}
+
+// Called by the producer. If the ring is full the sample is dropped and counted as overflow.
+static inline bool txpdo_ring_push(txpdo_ring_t* ring, const txpdo_queue_data_t* data)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if ((head - ring->cached_tail) == TXPDO_RING_SIZE)
+	{
+		// Ring seems to be full, refresh the view on the consumer index
+		ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if ((head - ring->cached_tail) == TXPDO_RING_SIZE)
+		{
+			// Single writer, so a plain load/store pair is enough and stays wait-free
+			atomic_store_explicit(&ring->overflows,
+					atomic_load_explicit(&ring->overflows, memory_order_relaxed) + 1,
+					memory_order_relaxed);
+			return false;
+		}
+	}
+	ring->slots[head & TXPDO_RING_MASK] = *data;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+// Called by the consumer. Copies up to max samples in order of arrival into data and
+// returns the number of copied samples.
+static inline unsigned int txpdo_ring_pop_batch(txpdo_ring_t* ring, txpdo_queue_data_t* data, unsigned int max)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned int count;
+
+	if (ring->cached_head == tail)
+	{
+		ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	}
+	count = ring->cached_head - tail;
+	if (count > max)
+	{
+		count = max;
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		data[i] = ring->slots[(tail + i) & TXPDO_RING_MASK];
+	}
+	atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+	return count;
+}
+
+// Number of samples waiting for the consumer. May be called from any thread.
+static inline unsigned int txpdo_ring_fill(txpdo_ring_t* ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire) -
+			atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static inline unsigned long txpdo_ring_overflows(txpdo_ring_t* ring)
+{
+	return atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
+
+#endif /* PDO_RING_H_ */
@@ -0,0 +1,140 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "process_image.h"
+
+/****************************************************************************/
+
+// Creates and maps the shared memory segment. Must be called before the real time cycle starts.
+process_image_shm_t* process_image_create(uint32_t period_ns, uint32_t domain_size)
+{
+	process_image_shm_t* shm;
+	int fd;
+
+	if (domain_size > PROCESS_IMAGE_DATA_SIZE)
+	{
+		fprintf(stderr, "Process image: domain of %u bytes exceeds %u bytes\n", domain_size, PROCESS_IMAGE_DATA_SIZE);
+		return NULL;
+	}
+	fd = shm_open(PROCESS_IMAGE_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd == -1)
+	{
+		perror("shm_open of process image failed");
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(process_image_shm_t)) == -1)
+	{
+		perror("ftruncate of process image failed");
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(process_image_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		perror("mmap of process image failed");
+		return NULL;
+	}
+
+	// Invalidate the segment for readers while it is set up
+	shm->magic = 0;
+	atomic_thread_fence(memory_order_release);
+	memset(shm, 0, sizeof(process_image_shm_t));
+	shm->version = PROCESS_IMAGE_VERSION;
+	shm->size = sizeof(process_image_shm_t);
+	shm->period_ns = period_ns;
+	shm->domain_size = domain_size;
+	atomic_init(&shm->published, 0);
+	for (unsigned int i = 0; i < PROCESS_IMAGE_SLOTS; i++)
+	{
+		atomic_init(&shm->slots[i].version, 0);
+	}
+	atomic_thread_fence(memory_order_release);
+	shm->magic = PROCESS_IMAGE_MAGIC;
+	return shm;
+}
+
+/****************************************************************************/
+
+// Maps the shared memory segment of a running ECT60ctrl read only.
+process_image_shm_t* process_image_attach(void)
+{
+	process_image_shm_t* shm;
+	int fd;
+
+	fd = shm_open(PROCESS_IMAGE_SHM_NAME, O_RDONLY, 0);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(process_image_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		return NULL;
+	}
+	if ((shm->magic != PROCESS_IMAGE_MAGIC) || (shm->version != PROCESS_IMAGE_VERSION) ||
+			(shm->size != sizeof(process_image_shm_t)))
+	{
+		munmap(shm, sizeof(process_image_shm_t));
+		return NULL;
+	}
+	return shm;
+}
+
+// Copies the latest snapshot. Returns false if nothing was published yet or the writer
+// has overtaken the reader on every attempt, e.g. while the reader was preempted.
+bool process_image_read(process_image_shm_t* shm, process_image_t* image)
+{
+	unsigned int* dst = (unsigned int*)image;
+
+	for (int attempt = 0; attempt < PROCESS_IMAGE_READ_RETRIES; attempt++)
+	{
+		unsigned long n = atomic_load_explicit(&shm->published, memory_order_acquire);
+		process_image_slot_t* slot;
+		atomic_uint* src;
+		unsigned int begin, end;
+
+		if (n == 0)
+		{
+			return false;
+		}
+		slot = &shm->slots[(n - 1) % PROCESS_IMAGE_SLOTS];
+		src = (atomic_uint*)&slot->image;
+		begin = atomic_load_explicit(&slot->version, memory_order_acquire);
+		if (begin & 1)
+		{
+			continue;
+		}
+		for (unsigned int i = 0; i < PROCESS_IMAGE_WORDS(shm->domain_size); i++)
+		{
+			dst[i] = atomic_load_explicit(&src[i], memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		end = atomic_load_explicit(&slot->version, memory_order_relaxed);
+		if (begin == end)
+		{
+			return true;
+		}
+	}
+	return false;
+}
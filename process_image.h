@@ -0,0 +1,118 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROCESS_IMAGE_H_
+#define PROCESS_IMAGE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Snapshot of the process image and the master and domain state, published by cyclic_task
+// every cycle in a POSIX shared memory segment. Any number of local readers poll it at their
+// own rate. The writer never waits: it alternates between two slots, each protected by a
+// seqlock, and a reader takes the slot published last, which is only written again one cycle later.
+
+#define PROCESS_IMAGE_SHM_NAME "/ect60ctrl_process_image"
+#define PROCESS_IMAGE_MAGIC 0x45435450		// "ECTP"
+#define PROCESS_IMAGE_VERSION 1
+
+#define PROCESS_IMAGE_CACHELINE 64
+#define PROCESS_IMAGE_MAX_AXES 16
+// Bytes of the domain process data mirrored
+#define PROCESS_IMAGE_DATA_SIZE 1024
+#define PROCESS_IMAGE_SLOTS 2
+// Attempts of a reader to get a consistent copy
+#define PROCESS_IMAGE_READ_RETRIES 4
+
+typedef struct
+{
+	uint16_t statusword;			// 0x6041
+	int8_t mode_display;			// 0x6061
+	uint8_t cia402_state;			// cia402_state_t decoded from the statusword
+	int32_t velocity_actual;		// 0x606c
+	int32_t velocity_demand;		// 0x60ff as written
+	uint32_t digital_inputs;		// 0x60fd
+}process_image_axis_t;
+
+typedef struct
+{
+	uint64_t cycle;
+	uint64_t app_time_ns;			// Application time of the cycle
+	// ecrt_master_state()
+	uint32_t slaves_responding;
+	uint32_t al_states;
+	uint32_t link_up;
+	// ecrt_domain_state()
+	uint32_t working_counter;
+	uint32_t wc_state;
+	uint32_t axes;
+	process_image_axis_t axis[PROCESS_IMAGE_MAX_AXES];
+	uint8_t data[PROCESS_IMAGE_DATA_SIZE];	// Domain process data with the received inputs and the outputs written by this cycle, domain_size bytes are valid
+}process_image_t;
+
+// Every slot starts on its own cache line, the version and the image do not share one
+typedef struct
+{
+	_Alignas(PROCESS_IMAGE_CACHELINE) atomic_uint version;		// Odd while written
+	_Alignas(PROCESS_IMAGE_CACHELINE) process_image_t image;
+}process_image_slot_t;
+
+// Layout of the shared memory segment. The snapshot number n is stored in slots[n % PROCESS_IMAGE_SLOTS].
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;					// sizeof(process_image_shm_t), checked by readers
+	uint32_t period_ns;
+	uint32_t domain_size;			// Valid bytes of process_image_t.data
+	_Alignas(PROCESS_IMAGE_CACHELINE) atomic_ulong published;	// Number of published snapshots
+	process_image_slot_t slots[PROCESS_IMAGE_SLOTS];
+}process_image_shm_t;
+
+// The snapshot is copied word by word with relaxed atomics like the command channel. Only the
+// words up to the valid bytes of the domain data are copied.
+#define PROCESS_IMAGE_WORDS(domain_size) \
+	((__builtin_offsetof(process_image_t, data) + (domain_size) + sizeof(atomic_uint) - 1) / sizeof(atomic_uint))
+
+// Called by cyclic_task. Constant time, no system call.
+static inline void process_image_publish(process_image_shm_t* shm, const process_image_t* image)
+{
+	unsigned long n = atomic_load_explicit(&shm->published, memory_order_relaxed);
+	process_image_slot_t* slot = &shm->slots[n % PROCESS_IMAGE_SLOTS];
+	unsigned int version = atomic_load_explicit(&slot->version, memory_order_relaxed);
+	const unsigned int* src = (const unsigned int*)image;
+	atomic_uint* dst = (atomic_uint*)&slot->image;
+
+	atomic_store_explicit(&slot->version, version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (unsigned int i = 0; i < PROCESS_IMAGE_WORDS(shm->domain_size); i++)
+	{
+		atomic_store_explicit(&dst[i], src[i], memory_order_relaxed);
+	}
+	atomic_store_explicit(&slot->version, version + 2, memory_order_release);
+	atomic_store_explicit(&shm->published, n + 1, memory_order_release);
+}
+
+// Writer side
+process_image_shm_t* process_image_create(uint32_t period_ns, uint32_t domain_size);
+
+// Reader side
+process_image_shm_t* process_image_attach(void);
+bool process_image_read(process_image_shm_t* shm, process_image_t* image);
+
+#endif /* PROCESS_IMAGE_H_ */
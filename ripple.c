@@ -0,0 +1,274 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ripple.h"
+
+// 4 floats processed at once, compiled to NEON, SSE or scalar code depending on the target
+typedef float v4f __attribute__((vector_size(16)));
+#define V4F_LANES 4
+
+#define RIPPLE_FFT_MASK (RIPPLE_FFT_SIZE - 1)
+
+// Tables and work buffers of the FFT, only used by the gui thread
+static _Alignas(16) float window[RIPPLE_FFT_SIZE];
+static float window_sum;
+// Twiddle factors of the stage with butterflies of half size h are stored at h .. 2h-1
+static _Alignas(16) float twiddle_re[RIPPLE_FFT_SIZE];
+static _Alignas(16) float twiddle_im[RIPPLE_FFT_SIZE];
+static uint16_t bit_reverse[RIPPLE_FFT_SIZE];
+static _Alignas(16) float samples[RIPPLE_FFT_SIZE];
+static _Alignas(16) float fft_re[RIPPLE_FFT_SIZE];
+static _Alignas(16) float fft_im[RIPPLE_FFT_SIZE];
+
+/****************************************************************************/
+
+static inline v4f v4f_load(const float* src)
+{
+	v4f v;
+
+	memcpy(&v, src, sizeof(v));
+	return v;
+}
+
+static inline float v4f_sum(v4f v)
+{
+	return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+static float sum(const float* x, unsigned int count)
+{
+	v4f acc = {0.0f, 0.0f, 0.0f, 0.0f};
+	float result;
+	unsigned int i;
+
+	for (i = 0; i + V4F_LANES <= count; i += V4F_LANES)
+	{
+		acc += v4f_load(&x[i]);
+	}
+	result = v4f_sum(acc);
+	for (; i < count; i++)
+	{
+		result += x[i];
+	}
+	return result;
+}
+
+static float square_deviation_sum(const float* x, unsigned int count, float mean)
+{
+	v4f acc = {0.0f, 0.0f, 0.0f, 0.0f};
+	float result;
+	unsigned int i;
+
+	for (i = 0; i + V4F_LANES <= count; i += V4F_LANES)
+	{
+		v4f d = v4f_load(&x[i]) - mean;
+
+		acc += d * d;
+	}
+	result = v4f_sum(acc);
+	for (; i < count; i++)
+	{
+		result += (x[i] - mean) * (x[i] - mean);
+	}
+	return result;
+}
+
+// In place radix-2 decimation in time of fft_re and fft_im, which are in bit reversed order
+static void fft(void)
+{
+	unsigned int h, k, j;
+
+	// The first two stages have less butterflies per group than lanes
+	for (h = 1; h < V4F_LANES; h <<= 1)
+	{
+		for (k = 0; k < RIPPLE_FFT_SIZE; k += 2 * h)
+		{
+			for (j = 0; j < h; j++)
+			{
+				float wr = twiddle_re[h + j], wi = twiddle_im[h + j];
+				float tr = wr * fft_re[k + j + h] - wi * fft_im[k + j + h];
+				float ti = wr * fft_im[k + j + h] + wi * fft_re[k + j + h];
+
+				fft_re[k + j + h] = fft_re[k + j] - tr;
+				fft_im[k + j + h] = fft_im[k + j] - ti;
+				fft_re[k + j] += tr;
+				fft_im[k + j] += ti;
+			}
+		}
+	}
+	for (; h < RIPPLE_FFT_SIZE; h <<= 1)
+	{
+		for (k = 0; k < RIPPLE_FFT_SIZE; k += 2 * h)
+		{
+			for (j = 0; j < h; j += V4F_LANES)
+			{
+				v4f* re0 = (v4f*)&fft_re[k + j];
+				v4f* im0 = (v4f*)&fft_im[k + j];
+				v4f* re1 = (v4f*)&fft_re[k + j + h];
+				v4f* im1 = (v4f*)&fft_im[k + j + h];
+				v4f wr = *(const v4f*)&twiddle_re[h + j];
+				v4f wi = *(const v4f*)&twiddle_im[h + j];
+				v4f tr = wr * *re1 - wi * *im1;
+				v4f ti = wr * *im1 + wi * *re1;
+
+				*re1 = *re0 - tr;
+				*im1 = *im0 - ti;
+				*re0 += tr;
+				*im0 += ti;
+			}
+		}
+	}
+}
+
+/****************************************************************************/
+
+void ripple_init(void)
+{
+	window_sum = 0.0f;
+	for (unsigned int i = 0; i < RIPPLE_FFT_SIZE; i++)
+	{
+		unsigned int reversed = 0;
+
+		window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / RIPPLE_FFT_SIZE);
+		window_sum += window[i];
+		for (unsigned int b = 0; b < RIPPLE_FFT_BITS; b++)
+		{
+			reversed |= ((i >> b) & 1) << (RIPPLE_FFT_BITS - 1 - b);
+		}
+		bit_reverse[i] = reversed;
+	}
+	for (unsigned int h = 1; h < RIPPLE_FFT_SIZE; h <<= 1)
+	{
+		for (unsigned int j = 0; j < h; j++)
+		{
+			twiddle_re[h + j] = cosf((float)M_PI * j / h);
+			twiddle_im[h + j] = -sinf((float)M_PI * j / h);
+		}
+	}
+}
+
+void ripple_reset(ripple_t* ripple)
+{
+	memset(ripple, 0, sizeof(ripple_t));
+}
+
+void ripple_add(ripple_t* ripple, const float* error, unsigned int count)
+{
+	uint64_t total = ripple->count + count;
+	double batch_mean, delta;
+	unsigned int part;
+
+	if (count == 0)
+	{
+		return;
+	}
+	// Mean and squared differences of the batch are merged into the running ones (Chan et al.)
+	batch_mean = sum(error, count) / count;
+	delta = batch_mean - ripple->mean;
+	ripple->m2 += square_deviation_sum(error, count, batch_mean) + delta * delta * ripple->count * count / total;
+	ripple->mean += delta * count / total;
+	ripple->count = total;
+
+	// Only the last RIPPLE_FFT_SIZE errors are kept
+	if (count > RIPPLE_FFT_SIZE)
+	{
+		error += count - RIPPLE_FFT_SIZE;
+		ripple->since_spectrum += count - RIPPLE_FFT_SIZE;
+		count = RIPPLE_FFT_SIZE;
+	}
+	part = RIPPLE_FFT_SIZE - ripple->head;
+	if (part > count)
+	{
+		part = count;
+	}
+	memcpy(&ripple->history[ripple->head], error, part * sizeof(float));
+	memcpy(ripple->history, error + part, (count - part) * sizeof(float));
+	ripple->head = (ripple->head + count) & RIPPLE_FFT_MASK;
+	ripple->filled = (ripple->filled + count > RIPPLE_FFT_SIZE) ? RIPPLE_FFT_SIZE : ripple->filled + count;
+	ripple->since_spectrum += count;
+}
+
+bool ripple_spectrum(ripple_t* ripple)
+{
+	float mean, weight;
+	unsigned int i, k, p;
+
+	if ((ripple->filled < RIPPLE_FFT_SIZE) || (ripple->since_spectrum < RIPPLE_FFT_HOP))
+	{
+		return false;
+	}
+	ripple->since_spectrum = 0;
+
+	// Oldest sample first, without the mean of the window and multiplied by the window
+	memcpy(samples, &ripple->history[ripple->head], (RIPPLE_FFT_SIZE - ripple->head) * sizeof(float));
+	memcpy(&samples[RIPPLE_FFT_SIZE - ripple->head], ripple->history, ripple->head * sizeof(float));
+	mean = sum(samples, RIPPLE_FFT_SIZE) / RIPPLE_FFT_SIZE;
+	for (i = 0; i < RIPPLE_FFT_SIZE; i += V4F_LANES)
+	{
+		*(v4f*)&samples[i] = (*(v4f*)&samples[i] - mean) * *(const v4f*)&window[i];
+	}
+	for (i = 0; i < RIPPLE_FFT_SIZE; i++)
+	{
+		fft_re[bit_reverse[i]] = samples[i];
+		fft_im[i] = 0.0f;
+	}
+	fft();
+
+	// The first spectrum is taken as it is, later ones are averaged
+	weight = ripple->spectra ? RIPPLE_AVERAGE : 1.0f;
+	for (k = 0; k < RIPPLE_FFT_SIZE / 2; k += V4F_LANES)
+	{
+		v4f re = *(const v4f*)&fft_re[k];
+		v4f im = *(const v4f*)&fft_im[k];
+		v4f* power = (v4f*)&ripple->power[k];
+
+		*power += (re * re + im * im - *power) * weight;
+	}
+	ripple->spectra++;
+
+	// Largest maxima within the main lobe width of the window of 2 bins to each side, so a peak
+	// widened by jitter of the cycle is found once. The lowest bins contain the leakage of the mean.
+	memset(ripple->peak_bin, 0, sizeof(ripple->peak_bin));
+	memset(ripple->peak_amplitude, 0, sizeof(ripple->peak_amplitude));
+	for (k = 3; k < RIPPLE_FFT_SIZE / 2 - 2; k++)
+	{
+		float a, b, c, offset, amplitude;
+
+		if ((ripple->power[k] <= ripple->power[k - 1]) || (ripple->power[k] <= ripple->power[k - 2]) ||
+				(ripple->power[k] < ripple->power[k + 1]) || (ripple->power[k] < ripple->power[k + 2]))
+		{
+			continue;
+		}
+		// Parabolic interpolation of the magnitude around the maximum
+		a = sqrtf(ripple->power[k - 1]);
+		b = sqrtf(ripple->power[k]);
+		c = sqrtf(ripple->power[k + 1]);
+		offset = (a - 2.0f * b + c != 0.0f) ? 0.5f * (a - c) / (a - 2.0f * b + c) : 0.0f;
+		amplitude = 2.0f * (b - 0.25f * (a - c) * offset) / window_sum;
+		for (p = 0; (p < RIPPLE_PEAKS) && (amplitude <= ripple->peak_amplitude[p]); p++);
+		if (p == RIPPLE_PEAKS)
+		{
+			continue;
+		}
+		memmove(&ripple->peak_bin[p + 1], &ripple->peak_bin[p], (RIPPLE_PEAKS - 1 - p) * sizeof(float));
+		memmove(&ripple->peak_amplitude[p + 1], &ripple->peak_amplitude[p], (RIPPLE_PEAKS - 1 - p) * sizeof(float));
+		ripple->peak_bin[p] = k + offset;
+		ripple->peak_amplitude[p] = amplitude;
+	}
+	return true;
+}
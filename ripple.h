@@ -0,0 +1,82 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RIPPLE_H_
+#define RIPPLE_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Analysis of the velocity ripple, the error between actual velocity (0x606c) and velocity
+// demand (0x60ff) of every cycle. It runs in the gui thread on all samples drained from the ring,
+// never in the real time thread. Mean, variance and RMS are updated with every batch by the
+// parallel form of Welford's algorithm. The spectrum of the last RIPPLE_FFT_SIZE samples is
+// calculated every RIPPLE_FFT_HOP samples with a Hann window and averaged, its largest peaks
+// are the dominant frequencies of the ripple, e.g. mechanical resonances.
+// The kernels work on 4 floats at once by GCC vector extensions, NEON on a Cortex-A.
+
+#define RIPPLE_FFT_BITS 10
+#define RIPPLE_FFT_SIZE (1U << RIPPLE_FFT_BITS)
+// Samples between two spectra, 50% overlap
+#define RIPPLE_FFT_HOP (RIPPLE_FFT_SIZE / 2)
+// Weight of a new spectrum in the average
+#define RIPPLE_AVERAGE 0.25f
+#define RIPPLE_PEAKS 3
+
+typedef struct
+{
+	// Welford
+	uint64_t count;
+	double mean;
+	double m2;					// Sum of squared differences from the mean
+	// Last RIPPLE_FFT_SIZE errors in a ring
+	_Alignas(16) float history[RIPPLE_FFT_SIZE];
+	unsigned int head;
+	unsigned int filled;
+	unsigned int since_spectrum;
+	// Averaged power spectrum of bins 0 .. RIPPLE_FFT_SIZE / 2 - 1
+	_Alignas(16) float power[RIPPLE_FFT_SIZE / 2];
+	unsigned long spectra;
+	float peak_bin[RIPPLE_PEAKS];		// Interpolated bin, 0 if none
+	float peak_amplitude[RIPPLE_PEAKS];	// Amplitude of a sine of the velocity unit
+}ripple_t;
+
+// Calculates the tables of the FFT, must be called once before any spectrum
+void ripple_init(void);
+void ripple_reset(ripple_t* ripple);
+// Adds count errors of consecutive cycles
+void ripple_add(ripple_t* ripple, const float* error, unsigned int count);
+// Calculates the spectrum if RIPPLE_FFT_HOP samples were added since the last one. Returns true if it did.
+bool ripple_spectrum(ripple_t* ripple);
+
+static inline double ripple_variance(const ripple_t* ripple)
+{
+	return (ripple->count > 1) ? ripple->m2 / (ripple->count - 1) : 0.0;
+}
+
+static inline double ripple_rms(const ripple_t* ripple)
+{
+	return ripple->count ? sqrt(ripple->m2 / ripple->count + ripple->mean * ripple->mean) : 0.0;
+}
+
+static inline double ripple_frequency(float bin, double sample_rate_hz)
+{
+	return bin * sample_rate_hz / RIPPLE_FFT_SIZE;
+}
+
+#endif /* RIPPLE_H_ */
@@ -0,0 +1,120 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RXPDO_CHANNEL_H_
+#define RXPDO_CHANNEL_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "servo_gui.h"
+#include "pdo_ring.h"
+
+// Number of attempts of the reader to get a consistent copy. Bounding the attempts
+// keeps the reader wait-free, a failed read simply keeps the previous command.
+#define RXPDO_CHANNEL_READ_RETRIES 2
+
+// Seqlock protected command block published by the gui thread (single writer) and
+// read once per cycle by cyclic_task. An odd version marks a write in progress.
+typedef struct rxpdo_channel
+{
+	_Alignas(CACHELINE_SIZE) atomic_uint version;
+	rxpdo_queue_data_t data;
+}rxpdo_channel_t;
+
+// The command block is copied word by word with relaxed atomics, so a concurrent
+// access of reader and writer is not a data race in terms of the C11 memory model.
+#define RXPDO_CHANNEL_WORDS ((sizeof(rxpdo_queue_data_t) + sizeof(atomic_uint) - 1) / sizeof(atomic_uint))
+
+typedef union
+{
+	rxpdo_queue_data_t data;
+	unsigned int words[RXPDO_CHANNEL_WORDS];
+}rxpdo_channel_words_t;
+
+static inline void rxpdo_channel_copy_out(rxpdo_channel_t* channel, rxpdo_channel_words_t* dst)
+{
+	atomic_uint* src = (atomic_uint*)&channel->data;
+
+	for (unsigned int i = 0; i < RXPDO_CHANNEL_WORDS; i++)
+	{
+		dst->words[i] = atomic_load_explicit(&src[i], memory_order_relaxed);
+	}
+}
+
+static inline void rxpdo_channel_copy_in(rxpdo_channel_t* channel, const rxpdo_channel_words_t* src)
+{
+	atomic_uint* dst = (atomic_uint*)&channel->data;
+
+	for (unsigned int i = 0; i < RXPDO_CHANNEL_WORDS; i++)
+	{
+		atomic_store_explicit(&dst[i], src->words[i], memory_order_relaxed);
+	}
+}
+
+static inline void rxpdo_channel_init(rxpdo_channel_t* channel, const rxpdo_queue_data_t* initial)
+{
+	atomic_init(&channel->version, 0);
+	channel->data = *initial;
+}
+
+// Called by the writer only. Sequence number and timestamp of the command are assigned here.
+static inline void rxpdo_channel_publish(rxpdo_channel_t* channel, rxpdo_queue_data_t* command)
+{
+	rxpdo_channel_words_t words = {0};
+	unsigned int version = atomic_load_explicit(&channel->version, memory_order_relaxed);
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	command->sequence = channel->data.sequence + 1;
+	command->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	words.data = *command;
+
+	atomic_store_explicit(&channel->version, version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	rxpdo_channel_copy_in(channel, &words);
+	atomic_store_explicit(&channel->version, version + 2, memory_order_release);
+}
+
+// Called by cyclic_task. Returns true and a consistent copy of the command block in command,
+// or false if the writer was busy on every attempt. command is left untouched in that case.
+static inline bool rxpdo_channel_read(rxpdo_channel_t* channel, rxpdo_queue_data_t* command)
+{
+	rxpdo_channel_words_t words;
+	unsigned int begin, end;
+
+	for (int i = 0; i < RXPDO_CHANNEL_READ_RETRIES; i++)
+	{
+		begin = atomic_load_explicit(&channel->version, memory_order_acquire);
+		if (begin & 1)
+		{
+			continue;
+		}
+		rxpdo_channel_copy_out(channel, &words);
+		atomic_thread_fence(memory_order_acquire);
+		end = atomic_load_explicit(&channel->version, memory_order_relaxed);
+		if (begin == end)
+		{
+			*command = words.data;
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif /* RXPDO_CHANNEL_H_ */
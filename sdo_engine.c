@@ -0,0 +1,307 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "sdo_engine.h"
+
+static const uint8_t sdo_engine_sizes[SDO_ENGINE_SIZES] = {1, 2, 4};
+
+/****************************************************************************/
+
+static bool sdo_engine_size_supported(uint8_t size)
+{
+	for (unsigned int i = 0; i < SDO_ENGINE_SIZES; i++)
+	{
+		if (sdo_engine_sizes[i] == size)
+			return true;
+	}
+	return false;
+}
+
+/****************************************************************************/
+
+// Returns the cache entry of an object, which is created if not existing yet. Returns -1 if the
+// cache is full or the object is already cached with another size. Called by the requesting thread only,
+// so cached objects are listed in sdo_engine_result() before they are transferred the first time.
+int sdo_engine_watch(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size)
+{
+	unsigned int entries = atomic_load_explicit(&engine->entries, memory_order_relaxed);
+	sdo_cache_entry_t* entry;
+
+	if ((axis >= engine->slaves) || !sdo_engine_size_supported(size))
+	{
+		return -1;
+	}
+	for (unsigned int i = 0; i < entries; i++)
+	{
+		entry = &engine->cache[i];
+		if ((entry->axis == axis) && (entry->index == index) && (entry->subindex == subindex))
+		{
+			return (entry->size == size) ? (int)i : -1;
+		}
+	}
+	if (entries == SDO_ENGINE_CACHE_SIZE)
+	{
+		return -1;
+	}
+	entry = &engine->cache[entries];
+	entry->axis = axis;
+	entry->index = index;
+	entry->subindex = subindex;
+	entry->size = size;
+	// Readers see the key of the entry before its number is published
+	atomic_store_explicit(&engine->entries, entries + 1, memory_order_release);
+	return entries;
+}
+
+static bool sdo_engine_push(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size,
+		bool write, uint32_t value)
+{
+	unsigned int head = atomic_load_explicit(&engine->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&engine->tail, memory_order_acquire);
+	sdo_engine_request_t* request;
+	int entry;
+
+	if ((head - tail) == SDO_ENGINE_QUEUE_SIZE)
+	{
+		atomic_fetch_add_explicit(&engine->overflows, 1, memory_order_relaxed);
+		return false;
+	}
+	if ((entry = sdo_engine_watch(engine, axis, index, subindex, size)) < 0)
+	{
+		return false;
+	}
+	atomic_fetch_add_explicit(&engine->cache[entry].pending, 1, memory_order_relaxed);
+
+	request = &engine->queue[head & SDO_ENGINE_QUEUE_MASK];
+	request->entry = entry;
+	request->write = write;
+	request->value = value;
+	atomic_store_explicit(&engine->head, head + 1, memory_order_release);
+	return true;
+}
+
+// Writes the result of a transfer into the cache entry
+static void sdo_engine_complete(sdo_engine_t* engine, sdo_engine_channel_t* channel, bool success, uint64_t now_ns)
+{
+	sdo_cache_entry_t* entry = &engine->cache[channel->entry];
+	unsigned int version = atomic_load_explicit(&entry->version, memory_order_relaxed);
+	uint32_t value = channel->value;
+
+	if (success && !channel->write)
+	{
+		uint8_t* data = ecrt_sdo_request_data(channel->request);
+
+		value = 0;
+		for (unsigned int b = 0; b < channel->size; b++)
+		{
+			value |= (uint32_t)data[b] << (8 * b);
+		}
+	}
+
+	atomic_store_explicit(&entry->version, version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&entry->state, success ? SDO_ENTRY_VALID : SDO_ENTRY_ERROR, memory_order_relaxed);
+	if (success)
+	{
+		atomic_store_explicit(&entry->value, value, memory_order_relaxed);
+	}
+	else
+	{
+		atomic_store_explicit(&entry->errors, atomic_load_explicit(&entry->errors, memory_order_relaxed) + 1,
+				memory_order_relaxed);
+	}
+	atomic_store_explicit(&entry->timestamp_ns, now_ns, memory_order_relaxed);
+	atomic_store_explicit(&entry->version, version + 2, memory_order_release);
+	atomic_fetch_sub_explicit(&entry->pending, 1, memory_order_release);
+
+	atomic_fetch_add_explicit(success ? &engine->completed : &engine->failed, 1, memory_order_relaxed);
+	channel->entry = -1;
+}
+
+// Returns an idle channel for a transfer of a cache entry. Transfers of the same object are not
+// overlapped, so they complete in the order they were requested.
+static sdo_engine_channel_t* sdo_engine_idle_channel(sdo_engine_t* engine, uint16_t entry)
+{
+	sdo_cache_entry_t* e = &engine->cache[entry];
+	sdo_engine_channel_t* idle = NULL;
+
+	for (unsigned int c = 0; c < SDO_ENGINE_CHANNELS; c++)
+	{
+		sdo_engine_channel_t* channel = &engine->channels[e->axis][c];
+
+		if (channel->entry == entry)
+			return NULL;
+		if ((idle == NULL) && (channel->size == e->size) && (channel->entry < 0))
+			idle = channel;
+	}
+	return idle;
+}
+
+/****************************************************************************/
+
+void sdo_engine_init(sdo_engine_t* engine)
+{
+	memset(engine, 0, sizeof(sdo_engine_t));
+	atomic_init(&engine->head, 0);
+	atomic_init(&engine->tail, 0);
+	atomic_init(&engine->entries, 0);
+	atomic_init(&engine->overflows, 0);
+	atomic_init(&engine->completed, 0);
+	atomic_init(&engine->failed, 0);
+}
+
+// Creates the SDO requests of a slave. Must be called before the master is activated.
+// Returns the axis number of the slave or -1 on failure.
+int sdo_engine_add_slave(sdo_engine_t* engine, ec_slave_config_t* sc)
+{
+	unsigned int axis = engine->slaves;
+
+	if (axis == MAX_AXES)
+	{
+		return -1;
+	}
+	for (unsigned int c = 0; c < SDO_ENGINE_CHANNELS; c++)
+	{
+		sdo_engine_channel_t* channel = &engine->channels[axis][c];
+
+		channel->size = sdo_engine_sizes[c / SDO_ENGINE_CHANNELS_PER_SIZE];
+		channel->entry = -1;
+		// The object is set for each transfer, device type is a placeholder only
+		if (!(channel->request = ecrt_slave_config_create_sdo_request(sc, 0x1000, 0, channel->size)))
+		{
+			return -1;
+		}
+		ecrt_sdo_request_timeout(channel->request, SDO_ENGINE_TIMEOUT_MS);
+	}
+	return engine->slaves++;
+}
+
+// Queues an upload of an object. Returns false if the queue or the cache is full.
+bool sdo_engine_read(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size)
+{
+	return sdo_engine_push(engine, axis, index, subindex, size, false, 0);
+}
+
+// Queues a download of an object. Returns false if the queue or the cache is full.
+bool sdo_engine_write(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size, uint32_t value)
+{
+	return sdo_engine_push(engine, axis, index, subindex, size, true, value);
+}
+
+// Polls running transfers round robin and starts queued ones in order, both within the budget.
+// A request waits in the queue until a channel of its size is idle on its slave.
+void sdo_engine_cycle(sdo_engine_t* engine, uint64_t now_ns)
+{
+	unsigned int budget = SDO_ENGINE_BUDGET;
+	unsigned int total = engine->slaves * SDO_ENGINE_CHANNELS;
+	unsigned int tail = atomic_load_explicit(&engine->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&engine->head, memory_order_acquire);
+
+	for (unsigned int n = 0; (n < total) && budget; n++)
+	{
+		sdo_engine_channel_t* channel = &engine->channels[0][0] + engine->next_poll;
+		ec_request_state_t state;
+
+		engine->next_poll = (engine->next_poll + 1) % total;
+		if (channel->entry < 0)
+		{
+			continue;
+		}
+		budget--;
+		state = ecrt_sdo_request_state(channel->request);
+		if ((state == EC_REQUEST_SUCCESS) || (state == EC_REQUEST_ERROR))
+		{
+			sdo_engine_complete(engine, channel, state == EC_REQUEST_SUCCESS, now_ns);
+		}
+	}
+
+	for (; budget && (tail != head); budget--)
+	{
+		sdo_engine_request_t* request = &engine->queue[tail & SDO_ENGINE_QUEUE_MASK];
+		sdo_cache_entry_t* entry = &engine->cache[request->entry];
+		sdo_engine_channel_t* channel = sdo_engine_idle_channel(engine, request->entry);
+
+		if (channel == NULL)
+		{
+			break;
+		}
+		ecrt_sdo_request_index(channel->request, entry->index, entry->subindex);
+		channel->entry = request->entry;
+		channel->write = request->write;
+		channel->value = request->value;
+		if (request->write)
+		{
+			uint8_t* data = ecrt_sdo_request_data(channel->request);
+
+			for (unsigned int b = 0; b < channel->size; b++)
+			{
+				data[b] = (uint8_t)(request->value >> (8 * b));
+			}
+			ecrt_sdo_request_write(channel->request);
+		}
+		else
+		{
+			ecrt_sdo_request_read(channel->request);
+		}
+		tail++;
+	}
+	atomic_store_explicit(&engine->tail, tail, memory_order_release);
+}
+
+unsigned int sdo_engine_entries(sdo_engine_t* engine)
+{
+	return atomic_load_explicit(&engine->entries, memory_order_acquire);
+}
+
+// Returns true and a consistent copy of a cache entry, or false if the entry does not exist
+// or cyclic_task was writing it on every attempt.
+bool sdo_engine_result(sdo_engine_t* engine, unsigned int entry, sdo_result_t* result)
+{
+	sdo_cache_entry_t* e;
+	unsigned int begin, end;
+
+	if (entry >= sdo_engine_entries(engine))
+	{
+		return false;
+	}
+	e = &engine->cache[entry];
+	result->axis = e->axis;
+	result->index = e->index;
+	result->subindex = e->subindex;
+	result->size = e->size;
+	for (int i = 0; i < SDO_ENGINE_READ_RETRIES; i++)
+	{
+		begin = atomic_load_explicit(&e->version, memory_order_acquire);
+		if (begin & 1)
+		{
+			continue;
+		}
+		result->state = atomic_load_explicit(&e->state, memory_order_relaxed);
+		result->value = atomic_load_explicit(&e->value, memory_order_relaxed);
+		result->timestamp_ns = atomic_load_explicit(&e->timestamp_ns, memory_order_relaxed);
+		result->errors = atomic_load_explicit(&e->errors, memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		end = atomic_load_explicit(&e->version, memory_order_relaxed);
+		if (begin == end)
+		{
+			result->pending = atomic_load_explicit(&e->pending, memory_order_acquire);
+			return true;
+		}
+	}
+	return false;
+}
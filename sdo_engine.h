@@ -0,0 +1,138 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SDO_ENGINE_H_
+#define SDO_ENGINE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "ecrt.h"
+#include "servo_gui.h"
+#include "pdo_ring.h"
+
+// Asynchronous SDO transfers. Requests for any object are queued by a single non real time
+// thread, cyclic_task advances at most SDO_ENGINE_BUDGET request state machines per cycle
+// by sdo_engine_cycle() without any I/O. Every object transferred has an entry in a cache,
+// which holds the last result and is read by any thread without blocking.
+
+// SDO requests of the IgH master are created before activation with a fixed size. For every
+// supported object size each slave gets SDO_ENGINE_CHANNELS_PER_SIZE requests (channels),
+// which are pointed to the requested object right before the transfer.
+#define SDO_ENGINE_SIZES 3				// 1, 2 and 4 bytes (expedited transfers)
+#define SDO_ENGINE_MAX_SIZE 4
+#define SDO_ENGINE_CHANNELS_PER_SIZE 4
+#define SDO_ENGINE_CHANNELS (SDO_ENGINE_SIZES * SDO_ENGINE_CHANNELS_PER_SIZE)
+#define SDO_ENGINE_TIMEOUT_MS 500
+
+// Number of request state machines polled or started per cycle
+#define SDO_ENGINE_BUDGET 4
+
+// Queued requests, the size must be a power of two
+#define SDO_ENGINE_QUEUE_SIZE 64
+#define SDO_ENGINE_QUEUE_MASK (SDO_ENGINE_QUEUE_SIZE - 1)
+
+#define SDO_ENGINE_CACHE_SIZE 1024
+#define SDO_ENGINE_READ_RETRIES 2
+
+typedef enum
+{
+	SDO_ENTRY_UNKNOWN = 0,		// Not transferred yet
+	SDO_ENTRY_VALID,			// Value of the last successful read or write
+	SDO_ENTRY_ERROR				// Last transfer failed, value is of the last successful one
+}sdo_entry_state_t;
+
+// Cache entry of an object. Axis, index, subindex and size are set once by the requesting
+// thread before the entry is published, the result is written by cyclic_task under a seqlock.
+typedef struct
+{
+	uint16_t axis;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t size;
+	atomic_uint pending;			// Number of queued or running requests
+	atomic_uint version;
+	atomic_uint state;
+	atomic_uint value;
+	atomic_ullong timestamp_ns;		// CLOCK_MONOTONIC time of the last completed transfer
+	atomic_uint errors;
+}sdo_cache_entry_t;
+
+// Consistent copy of a cache entry
+typedef struct
+{
+	uint16_t axis;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t size;
+	sdo_entry_state_t state;
+	uint32_t value;
+	uint64_t timestamp_ns;
+	uint32_t errors;
+	unsigned int pending;
+}sdo_result_t;
+
+typedef struct
+{
+	uint16_t entry;
+	bool write;
+	uint32_t value;
+}sdo_engine_request_t;
+
+typedef struct
+{
+	ec_sdo_request_t* request;
+	uint8_t size;
+	int entry;						// Cache entry of the running transfer, -1 if idle
+	bool write;
+	uint32_t value;
+}sdo_engine_channel_t;
+
+typedef struct sdo_engine
+{
+	// Used by cyclic_task only after activation
+	sdo_engine_channel_t channels[MAX_AXES][SDO_ENGINE_CHANNELS];
+	unsigned int slaves;
+	unsigned int next_poll;
+	// Producer cache line: written by the requesting thread only
+	_Alignas(CACHELINE_SIZE) atomic_uint head;
+	atomic_ulong overflows;
+	atomic_uint entries;
+	// Consumer cache line: written by cyclic_task only
+	_Alignas(CACHELINE_SIZE) atomic_uint tail;
+	atomic_ulong completed;
+	atomic_ulong failed;
+	_Alignas(CACHELINE_SIZE) sdo_engine_request_t queue[SDO_ENGINE_QUEUE_SIZE];
+	sdo_cache_entry_t cache[SDO_ENGINE_CACHE_SIZE];
+}sdo_engine_t;
+
+void sdo_engine_init(sdo_engine_t* engine);
+int sdo_engine_add_slave(sdo_engine_t* engine, ec_slave_config_t* sc);
+
+// Called by the requesting thread only
+int sdo_engine_watch(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size);
+bool sdo_engine_read(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size);
+bool sdo_engine_write(sdo_engine_t* engine, unsigned int axis, uint16_t index, uint8_t subindex, uint8_t size, uint32_t value);
+
+// Called by cyclic_task only
+void sdo_engine_cycle(sdo_engine_t* engine, uint64_t now_ns);
+
+// Called by any thread
+unsigned int sdo_engine_entries(sdo_engine_t* engine);
+bool sdo_engine_result(sdo_engine_t* engine, unsigned int entry, sdo_result_t* result);
+
+#endif /* SDO_ENGINE_H_ */
@@ -16,37 +16,159 @@
  */
 
 
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <locale.h>
+#include <langinfo.h>
+#include <poll.h>
 #include <curses.h>
 #include <pthread.h>
-#include <mqueue.h>
+#include <time.h>
 #include <ecrt.h>
 #include <errno.h>
 #include "servo_gui.h"
+#include "pdo_ring.h"
+#include "rxpdo_channel.h"
+#include "cycle_stats.h"
+#include "sdo_engine.h"
+#include "cia402.h"
+#include "ripple.h"
+#include "trend.h"
+#include "cmd_stream.h"
+#include <stddef.h>
+#include <string.h>
 #ifdef PIGPIO_OUT
 #include "pigpio.h"
 #endif
 
 #define NCURSES_GUI
 
+// Maximum number and length of text fields the gui keeps track of for redrawing only changed ones
+#define GUI_MAX_FIELDS 96
+#define GUI_FIELD_LEN 80
+// Maximum number of samples drained from the ring with one batch
+#define GUI_BATCH_SIZE 64
+// Number of one second windows the timing statistics are merged over
+#define GUI_STATS_WINDOWS 5
+// Width of the text panels. The trend plot is shown next to them if at least GUI_TREND_MIN_WIDTH remains.
+#define GUI_PANEL_WIDTH 64
+#define GUI_TREND_MIN_WIDTH 24
+// Largest plot drawn in cells, a larger window is drawn partly
+#define GUI_TREND_MAX_COLUMNS 256
+#define GUI_TREND_MAX_ROWS 64
 
 
 #ifdef NCURSES_GUI
 
-static ec_master_state_t master_state = {};
-static ec_domain_state_t domain_state = {};
 static ec_master_t *master = NULL;
 static ec_domain_t *domain = NULL;
 static uint8_t *domain_pd = NULL;
-static pthread_mutex_t* mymutex;
-static mqd_t myqueue;
-static pthread_cond_t* mycondition;
-extern long int curmessages;
-extern rxpdo_queue_data_t rxpdo_queue_data;
+static rxpdo_channel_t* rxpdo_channel;
+static txpdo_ring_t* txpdo_ring;
+static unsigned int ring_fill = 0;
+static rxpdo_queue_data_t rxpdo_published;
+static cycle_stats_shm_t* cycle_stats_shm = NULL;
+static sdo_engine_t* sdo_engine;
+static unsigned int selected_axis = 0;
+static unsigned int gui_rate_hz;
+
+// Text of a field as it was last drawn
+typedef struct
+{
+	WINDOW* win;
+	int row;
+	int col;
+	char text[GUI_FIELD_LEN];
+}gui_field_t;
+
+static gui_field_t gui_fields[GUI_MAX_FIELDS];
+static unsigned int gui_field_count = 0;
+
+// Velocity statistics over all samples received since the last frame
+typedef struct
+{
+	unsigned long samples;
+	int32_t min[MAX_AXES];
+	int32_t max[MAX_AXES];
+	int64_t sum[MAX_AXES];
+	double error_square_sum[MAX_AXES];	// Tracking error between velocity demand and actual velocity
+	int32_t error_max_abs[MAX_AXES];
+}gui_aggregate_t;
+
+static gui_aggregate_t gui_aggregate;
+
+// Last power state transition seen of every axis
+typedef struct
+{
+	uint8_t state;
+	uint8_t from;
+	unsigned long samples_ago;
+}gui_transition_t;
+
+static gui_transition_t gui_transitions[MAX_AXES];
+
+// Ripple of the velocity of every axis while operation is enabled, since its last command
+static ripple_t gui_ripple[MAX_AXES];
+// History of the trend plot, allocated once, and whether the following error is plotted (f)
+static trend_t gui_trend;
+static bool gui_trend_error = false;
+// Braille characters give 2x4 dots per cell, otherwise one dot per cell is drawn
+static bool gui_braille = false;
 extern bool winch_required;
-WINDOW *win_ethcat, *win_cia402, *win_params;
+WINDOW *win_ethcat, *win_cia402, *win_params, *win_trend = NULL;
+
+// Prints a text field into a window, but only if its text changed since it was drawn the last time.
+// A shorter text overwrites the remainder of the previous one with blanks.
+void gui_field(WINDOW* win, int row, int col, const char* fmt, ...)
+{
+	char text[GUI_FIELD_LEN];
+	gui_field_t* field = NULL;
+	size_t old_len;
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+
+	for (unsigned int i = 0; i < gui_field_count; i++)
+	{
+		if ((gui_fields[i].win == win) && (gui_fields[i].row == row) && (gui_fields[i].col == col))
+		{
+			field = &gui_fields[i];
+			break;
+		}
+	}
+	if (field == NULL)
+	{
+		if (gui_field_count == GUI_MAX_FIELDS)
+		{
+			// Not tracked, draw it every time
+			mvwprintw(win, row, col, "%s", text);
+			return;
+		}
+		field = &gui_fields[gui_field_count++];
+		field->win = win;
+		field->row = row;
+		field->col = col;
+		field->text[0] = '\0';
+	}
+	else if (strcmp(field->text, text) == 0)
+	{
+		return;
+	}
+	old_len = strlen(field->text);
+	mvwprintw(win, row, col, "%-*s", (int)old_len, text);
+	strcpy(field->text, text);
+}
+
+// Forgets all drawn fields, so they are drawn completely with the next frame
+void gui_fields_invalidate(void)
+{
+	gui_field_count = 0;
+}
 
 void print_master_state(WINDOW* win)
 {
@@ -58,156 +180,649 @@ void print_master_state(WINDOW* win)
     // Read actual domain
     ecrt_domain_state(domain, &ds);
 
+    // Only changed fields are drawn
+    gui_field(win, 1, 2, "%u slave(s).", ms.slaves_responding);
+    gui_field(win, 2, 2, "AL states: 0x%02X.", ms.al_states);
+    gui_field(win, 3, 2, "Link is %s.", ms.link_up ? "up" : "down");
+    gui_field(win, 4, 2, "Domain1: WC %u.", ds.working_counter);
+    gui_field(win, 5, 2, "Domain1: State %u.", ds.wc_state);
+    gui_field(win, 6, 2, "Ring: %4u fill %8lu overflows", ring_fill, txpdo_ring_overflows(txpdo_ring));
+}
 
-    // Compare states with state from n-1 request and print if changed
-    if (ms.slaves_responding != master_state.slaves_responding)
-        mvwprintw(win, 1, 2, "%u slave(s).", ms.slaves_responding);
-    if (ms.al_states != master_state.al_states)
-    	mvwprintw(win, 2, 2, "AL states: 0x%02X.", ms.al_states);
-    if (ms.link_up != master_state.link_up)
-    	mvwprintw(win, 3, 2, "Link is %s.", ms.link_up ? "up" : "down");
-    if (ds.working_counter != domain_state.working_counter)
-        mvwprintw(win, 4, 2, "Domain1: WC %u.", ds.working_counter);
-    if (ds.wc_state != domain_state.wc_state)
-    	mvwprintw(win, 5, 2, "Domain1: State %u.", ds.wc_state);
-
-    // Store states persistent
-    master_state = ms;
-    domain_state = ds;
+// Prints frame rate and processor load of the gui thread, updated once per second
+void print_gui_load(WINDOW* win)
+{
+	static struct timespec last_wall, last_cpu;
+	static unsigned int frames = 0;
+	static double fps = 0.0, load = 0.0;
+	struct timespec wall, cpu;
+	double wall_s;
+
+	frames++;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	wall_s = (wall.tv_sec - last_wall.tv_sec) + (wall.tv_nsec - last_wall.tv_nsec) / 1e9;
+	if (wall_s >= 1.0)
+	{
+		fps = frames / wall_s;
+		load = 100.0 * ((cpu.tv_sec - last_cpu.tv_sec) + (cpu.tv_nsec - last_cpu.tv_nsec) / 1e9) / wall_s;
+		last_wall = wall;
+		last_cpu = cpu;
+		frames = 0;
+	}
+	gui_field(win, 7, 2, "Gui: %5.1f fps %5.2f %% cpu", fps, load);
 }
 
 
+// Prints the percentiles of the cycle timing over the latest windows from the shared memory
+void print_cycle_stats(WINDOW* win, txpdo_queue_data_t* ptxpdo)
+{
+	static cycle_stats_window_t stats;
+	static const char* names[CYCLE_STAT_COUNT] = {"latency", "period", "exec", "dc phase", "send"};
+	// Bounds of the phase error distribution [ns]
+	static const uint32_t phase_bins[] = {100, 200, 500, 1000, 2000, 5000, 10000};
+	uint64_t below, last = 0;
+
+	if (cycle_stats_shm == NULL)
+	{
+		// Statistics are not available if the real time thread is built without CALC_TIMING
+		cycle_stats_shm = cycle_stats_attach();
+		return;
+	}
+	if (!cycle_stats_read(cycle_stats_shm, GUI_STATS_WINDOWS, &stats))
+	{
+		return;
+	}
+	gui_field(win, 8, 2, "Timing [us] %ds    p50     p99   p99.9     max", GUI_STATS_WINDOWS);
+	for (int i = 0; i < CYCLE_STAT_COUNT; i++)
+	{
+		gui_field(win, 9 + i, 2, "%-10s %7.1f %7.1f %7.1f %7.1f", names[i],
+				cycle_hist_percentile(&stats.hist[i], 50.0) / 1000.0,
+				cycle_hist_percentile(&stats.hist[i], 99.0) / 1000.0,
+				cycle_hist_percentile(&stats.hist[i], 99.9) / 1000.0,
+				stats.hist[i].max / 1000.0);
+	}
+	// Spread of the send time over the windows, compare the layouts by restarting with the other one
+	gui_field(win, 9 + CYCLE_STAT_COUNT, 2, "Send jitter %-9s p99.9-p50 %6.1f max-min %6.1f",
+			cycle_layout_name(cycle_stats_shm->layout),
+			(cycle_hist_percentile(&stats.hist[CYCLE_STAT_SEND], 99.9) -
+			cycle_hist_percentile(&stats.hist[CYCLE_STAT_SEND], 50.0)) / 1000.0,
+			stats.hist[CYCLE_STAT_SEND].count ?
+			(stats.hist[CYCLE_STAT_SEND].max - stats.hist[CYCLE_STAT_SEND].min) / 1000.0 : 0.0);
+	if (!ptxpdo->dc_follow || (stats.hist[CYCLE_STAT_DC_PHASE].count == 0))
+	{
+		return;
+	}
+	gui_field(win, 15, 2, "DC follows reference: phase %+7d ns adjust %+5d ns", ptxpdo->dc_phase_error_ns,
+			ptxpdo->dc_adjust_ns);
+	gui_field(win, 16, 2, "|phase| [us] <0.1 <0.2 <0.5   <1   <2   <5  <10 more");
+	// Share of the cycles in every bin in percent
+	gui_field(win, 17, 2, "%%");
+	for (unsigned int i = 0; i <= sizeof(phase_bins) / sizeof(phase_bins[0]); i++)
+	{
+		below = (i < sizeof(phase_bins) / sizeof(phase_bins[0])) ?
+				cycle_hist_count_below(&stats.hist[CYCLE_STAT_DC_PHASE], phase_bins[i]) :
+				stats.hist[CYCLE_STAT_DC_PHASE].count;
+		gui_field(win, 17, 15 + 5 * i, "%4.0f", (100.0 * (below - last)) / stats.hist[CYCLE_STAT_DC_PHASE].count);
+		last = below;
+	}
+}
+
+// State, underruns, latency and queue depth of the command stream if one is served
+void print_cmd_stream(WINDOW* win)
+{
+	cmd_stream_t* stream = cmd_stream_served();
+	cmd_stream_stats_t* stats;
+	unsigned long transports, queued;
+
+	if (stream == NULL)
+	{
+		return;
+	}
+	stats = &stream->stats;
+	transports = atomic_load_explicit(&stats->transport_count, memory_order_relaxed);
+	queued = atomic_load_explicit(&stats->queue_count, memory_order_relaxed);
+	gui_field(win, 18, 2, "Stream: %-8s depth %4u underruns %6lu/%4lu stops %3lu",
+			cmd_stream_state_name(atomic_load_explicit(&stats->state, memory_order_relaxed)), cmd_stream_depth(stream),
+			atomic_load_explicit(&stats->underrun_cycles, memory_order_relaxed),
+			atomic_load_explicit(&stats->underrun_runs, memory_order_relaxed),
+			atomic_load_explicit(&stats->stops, memory_order_relaxed));
+	gui_field(win, 19, 2, "Latency [us] send %6.1f/%7.1f queue %8.1f/%8.1f",
+			transports ? atomic_load_explicit(&stats->transport_sum_ns, memory_order_relaxed) / 1000.0 / transports : 0.0,
+			atomic_load_explicit(&stats->transport_max_ns, memory_order_relaxed) / 1000.0,
+			queued ? atomic_load_explicit(&stats->queue_sum_ns, memory_order_relaxed) / 1000.0 / queued : 0.0,
+			atomic_load_explicit(&stats->queue_max_ns, memory_order_relaxed) / 1000.0);
+}
+
+// Dots of the trend plot in cells of the window and the series drawn last into every cell
+static uint8_t trend_dots[GUI_TREND_MAX_ROWS][GUI_TREND_MAX_COLUMNS];
+static uint8_t trend_color[GUI_TREND_MAX_ROWS][GUI_TREND_MAX_COLUMNS];
+static int32_t trend_min[TREND_SERIES][2 * GUI_TREND_MAX_COLUMNS];
+static int32_t trend_max[TREND_SERIES][2 * GUI_TREND_MAX_COLUMNS];
+static unsigned int gui_cycle_hz;
+
+// Draws min to max of every column of a series into the rows of the plot starting at cell row top,
+// scaled from lo at the bottom to hi at the top. Every column is connected to the previous one.
+static void trend_plot_series(trend_series_t series, unsigned int columns, unsigned int top, unsigned int rows,
+		int32_t lo, int32_t hi)
+{
+	// Bit of the braille dot at x (0..1) and y (0..3) of a cell, U+2800 plus the bits
+	static const uint8_t braille_bits[2][4] = {{0x01, 0x02, 0x04, 0x40}, {0x08, 0x10, 0x20, 0x80}};
+	unsigned int dx = gui_braille ? 2 : 1, dy = gui_braille ? 4 : 1;
+	int pixels = rows * dy;
+	int prev_top = -1, prev_bottom = -1;
+
+	for (unsigned int c = 0; c < columns; c++)
+	{
+		int y_top, y_bottom;
+
+		if (trend_min[series][c] > trend_max[series][c])
+		{
+			prev_top = -1;
+			continue;
+		}
+		y_top = (int)(((int64_t)(hi - trend_max[series][c]) * (pixels - 1)) / ((int64_t)hi - lo));
+		y_bottom = (int)(((int64_t)(hi - trend_min[series][c]) * (pixels - 1)) / ((int64_t)hi - lo));
+		if (prev_top >= 0)
+		{
+			if (prev_bottom < y_top)
+				y_top = prev_bottom;
+			if (prev_top > y_bottom)
+				y_bottom = prev_top;
+		}
+		prev_top = y_top;
+		prev_bottom = y_bottom;
+		for (int y = y_top; y <= y_bottom; y++)
+		{
+			unsigned int row = top + y / dy, col = c / dx;
+
+			trend_dots[row][col] |= gui_braille ? braille_bits[c % dx][y % dy] : 1;
+			trend_color[row][col] = series;
+		}
+	}
+}
+
+// Trend of velocity demand and actual velocity of the selected axis over TREND_SPAN_MS, optionally
+// with the following error below. The columns are merged from the bins for the current width of the
+// window, so the cost of a frame does not depend on the cycle rate.
+void print_trend(WINDOW* win)
+{
+	unsigned int a = selected_axis;
+	unsigned int cells = getmaxx(win) - 2, rows = getmaxy(win) - 3, velocity_rows, error_rows, columns;
+	int32_t lo = INT32_MAX, hi = INT32_MIN, error_lo, error_hi, range_min, range_max;
+	char header[GUI_FIELD_LEN];
+	unsigned char braille[4] = {0xe2, 0, 0, 0};
+
+	if ((getmaxx(win) < 4) || (getmaxy(win) < 5))
+	{
+		return;
+	}
+	if (cells > GUI_TREND_MAX_COLUMNS)
+		cells = GUI_TREND_MAX_COLUMNS;
+	if (rows > GUI_TREND_MAX_ROWS)
+		rows = GUI_TREND_MAX_ROWS;
+	// The following error gets a third of the rows and its own scale
+	error_rows = (gui_trend_error && (rows >= 3)) ? rows / 3 : 0;
+	velocity_rows = rows - error_rows;
+	columns = cells * (gui_braille ? 2 : 1);
+	memset(trend_dots, 0, sizeof(trend_dots));
+
+	for (trend_series_t series = TREND_DEMAND; series <= TREND_ACTUAL; series++)
+	{
+		trend_columns(&gui_trend, a, series, columns, trend_min[series], trend_max[series], &range_min, &range_max);
+		if (range_min < lo)
+			lo = range_min;
+		if (range_max > hi)
+			hi = range_max;
+	}
+	if (lo <= hi)
+	{
+		if (lo == hi)
+		{
+			lo--;
+			hi++;
+		}
+		trend_plot_series(TREND_DEMAND, columns, 0, velocity_rows, lo, hi);
+		trend_plot_series(TREND_ACTUAL, columns, 0, velocity_rows, lo, hi);
+	}
+	if (error_rows)
+	{
+		trend_columns(&gui_trend, a, TREND_ERROR, columns, trend_min[TREND_ERROR], trend_max[TREND_ERROR],
+				&error_lo, &error_hi);
+		if (error_lo <= error_hi)
+		{
+			if (error_lo == error_hi)
+			{
+				error_lo--;
+				error_hi++;
+			}
+			trend_plot_series(TREND_ERROR, columns, velocity_rows, error_rows, error_lo, error_hi);
+		}
+	}
+
+	// The header is cut at the border
+	if (lo > hi)
+		snprintf(header, sizeof(header), "Axis %u: no samples", a + 1);
+	else if (error_rows && (error_lo <= error_hi))
+		snprintf(header, sizeof(header), "Axis %u %.0fs v %d..%d e %d..%d", a + 1,
+				(double)gui_trend.samples_per_bin * TREND_BINS / gui_cycle_hz, lo, hi, error_lo, error_hi);
+	else
+		snprintf(header, sizeof(header), "Axis %u %.0fs v %d..%d", a + 1,
+				(double)gui_trend.samples_per_bin * TREND_BINS / gui_cycle_hz, lo, hi);
+	header[(cells < sizeof(header)) ? cells : sizeof(header) - 1] = '\0';
+	gui_field(win, 1, 1, "%s", header);
+
+	for (unsigned int row = 0; row < rows; row++)
+	{
+		wmove(win, 2 + row, 1);
+		for (unsigned int col = 0; col < cells; col++)
+		{
+			uint8_t dots = trend_dots[row][col];
+
+			if (dots == 0)
+			{
+				waddch(win, ' ');
+				continue;
+			}
+			wattron(win, COLOR_PAIR(2 + trend_color[row][col]));
+			if (gui_braille)
+			{
+				braille[1] = 0xa0 | (dots >> 6);
+				braille[2] = 0x80 | (dots & 0x3f);
+				waddstr(win, (const char*)braille);
+			}
+			else
+			{
+				waddch(win, '*');
+			}
+			wattroff(win, COLOR_PAIR(2 + trend_color[row][col]));
+		}
+	}
+}
+
 void dialog_cia402(WINDOW* win, txpdo_queue_data_t* ptxpdo, rxpdo_queue_data_t* prxpdo)
 {
-	mvwprintw(win_cia402, 1, 2, "Expected velocity: %7ld", prxpdo->velocity_setpoint);
-	mvwprintw(win_cia402, 2, 2, "Actual velocity: %7ld", ptxpdo->velocity);
-	mvwprintw(win_cia402, 3, 2, "Variance: %7ld", ptxpdo->velocity);
-	mvwprintw(win_cia402, 4, 2, "Mode of operation: %1d", ptxpdo->mode_of_operation);
+	unsigned int a = selected_axis;
+	int ymax = getmaxy(win);
+	gui_aggregate_t* agg = &gui_aggregate;
+
+	gui_field(win, 1, 2, "Axis: %2u of %2u (left/right) %s (e)", a + 1, ptxpdo->axes,
+			prxpdo->enable[a] ? "enabled " : "disabled");
+	gui_field(win, 2, 2, "Expected velocity: %7d demand %7d", (int)prxpdo->velocity_setpoint[a],
+			(int)ptxpdo->velocity_demand[a]);
+	gui_field(win, 3, 2, "Actual velocity: %7d", (int)ptxpdo->velocity[a]);
+	// Actual - demand velocity while operation is enabled since the last command of the axis
+	gui_field(win, 4, 2, "Error: mean %8.1f sd %8.1f rms %8.1f", gui_ripple[a].mean,
+			sqrt(ripple_variance(&gui_ripple[a])), ripple_rms(&gui_ripple[a]));
+	gui_field(win, 5, 2, "Mode of operation: %1d (m) acc %7u (a/A) jerk %8u (j/J)", ptxpdo->mode_of_operation[a],
+			prxpdo->profile_acceleration[a], prxpdo->profile_jerk[a]);
+	gui_field(win, 6, 2, "Command %6u latency: %7ld us", ptxpdo->command_sequence, ptxpdo->command_latency_ns / 1000);
+	// Statistics over all cycles since the last frame
+	if (agg->samples)
+	{
+		gui_field(win, 7, 2, "%4lu cycles: min %7d mean %7d max %7d", agg->samples, (int)agg->min[a],
+				(int)(agg->sum[a] / (int64_t)agg->samples), (int)agg->max[a]);
+		gui_field(win, 11, 2, "Tracking error: rms %8.1f max %7d", sqrt(agg->error_square_sum[a] / agg->samples),
+				(int)agg->error_max_abs[a]);
+	}
 
+	// Power state machine
+	gui_field(win, 8, 2, "State: %-18s statusword 0x%04X", cia402_state_name(ptxpdo->cia402_state[a]),
+			ptxpdo->statusword[a]);
+	gui_field(win, 9, 2, "Transitions %6u faults %4u enabling %8.3f ms", ptxpdo->cia402_transitions[a],
+			ptxpdo->cia402_faults[a], ptxpdo->enable_time_ns[a] / 1e6);
+	if (ptxpdo->cia402_transitions[a])
+	{
+		gui_field(win, 10, 2, "Last: %s -> %s, %lu cycles ago", cia402_state_name(gui_transitions[a].from),
+				cia402_state_name(gui_transitions[a].state), gui_transitions[a].samples_ago);
+	}
+
+	// Dominant frequencies of the ripple, the spectrum is only calculated for the selected axis
+	ripple_spectrum(&gui_ripple[a]);
+	if (gui_ripple[a].spectra && cycle_stats_shm)
+	{
+		double rate_hz = 1e9 / cycle_stats_shm->period_ns;
+		const ripple_t* ripple = &gui_ripple[a];
+
+		gui_field(win, 12, 2, "Ripple: %6.1f Hz %6.1f  %6.1f Hz %6.1f  %6.1f Hz %6.1f",
+				ripple_frequency(ripple->peak_bin[0], rate_hz), ripple->peak_amplitude[0],
+				ripple_frequency(ripple->peak_bin[1], rate_hz), ripple->peak_amplitude[1],
+				ripple_frequency(ripple->peak_bin[2], rate_hz), ripple->peak_amplitude[2]);
+	}
+
+	// Overview of all axes as far as the window height allows
+	for (unsigned int i = 0; (i < ptxpdo->axes) && ((int)(13 + i) < (ymax - 1)); i++)
+	{
+		gui_field(win, 13 + i, 2, "%c%2u: %9d / %9d %-18s", (i == a) ? '>' : ' ', i + 1,
+				(int)ptxpdo->velocity[i], (int)prxpdo->velocity_setpoint[i], cia402_state_name(ptxpdo->cia402_state[i]));
+	}
 }
 
+// Shows the cached parameters of the selected axis. They are read again once per second,
+// unless a transfer is still pending. Nothing here waits for a transfer.
 void dialog_parameters(WINDOW* win)
 {
+	static struct timespec last_refresh;
+	struct timespec now;
+	sdo_result_t result;
+	bool refresh;
+	int row = 2;
+	int ymax = getmaxy(win);
+
+	if ((sdo_engine == NULL) || (sdo_engine->slaves == 0))
+	{
+		gui_field(win, 1, 2, "No SDO access");
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	refresh = (now.tv_sec != last_refresh.tv_sec);
+	if (refresh)
+	{
+		last_refresh = now;
+	}
 
+	gui_field(win, 1, 2, "Axis %2u  Object      Value       State    Age [ms]  Errors", selected_axis + 1);
+	for (unsigned int i = 0; i < sdo_engine_entries(sdo_engine); i++)
+	{
+		static const char* state_names[] = {"unknown", "valid", "error"};
+
+		if (!sdo_engine_result(sdo_engine, i, &result) || (result.axis != selected_axis))
+		{
+			continue;
+		}
+		if (refresh && (result.pending == 0))
+		{
+			sdo_engine_read(sdo_engine, result.axis, result.index, result.subindex, result.size);
+		}
+		if (row < (ymax - 2))
+		{
+			uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+			gui_field(win, row++, 2, "         0x%04X:%02X  0x%0*X  %-7s  %8llu  %6u", result.index, result.subindex,
+					2 * result.size, result.value, state_names[result.state],
+					result.timestamp_ns ? (unsigned long long)((now_ns - result.timestamp_ns) / 1000000) : 0ULL,
+					result.errors);
+		}
+	}
+	gui_field(win, ymax - 2, 2, "SDO: %8lu done %6lu failed %6lu overflows",
+			atomic_load_explicit(&sdo_engine->completed, memory_order_relaxed),
+			atomic_load_explicit(&sdo_engine->failed, memory_order_relaxed),
+			atomic_load_explicit(&sdo_engine->overflows, memory_order_relaxed));
 }
 
-// Function for exchanging data with the real time cyclic_task of ethercat
-void exchange_data(txpdo_queue_data_t* p_txdata, rxpdo_queue_data_t* p_rxdata)
+// Adds received samples to the statistics of the current frame
+void gui_aggregate_add(const txpdo_queue_data_t* samples, unsigned int count)
 {
-	struct mq_attr attr;
+	gui_aggregate_t* agg = &gui_aggregate;
+	float ripple_error[MAX_AXES][GUI_BATCH_SIZE];
+	unsigned int ripple_errors[MAX_AXES] = {0};
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const txpdo_queue_data_t* sample = &samples[i];
+
+		if (agg->samples == 0)
+		{
+			for (unsigned int a = 0; a < sample->axes; a++)
+			{
+				agg->min[a] = agg->max[a] = sample->velocity[a];
+				agg->sum[a] = 0;
+				agg->error_square_sum[a] = 0.0;
+				agg->error_max_abs[a] = 0;
+			}
+		}
+		for (unsigned int a = 0; a < sample->axes; a++)
+		{
+			gui_transition_t* transition = &gui_transitions[a];
+			int32_t error = sample->velocity_demand[a] - sample->velocity[a];
+
+			if (sample->cia402_state[a] != transition->state)
+			{
+				transition->from = transition->state;
+				transition->state = sample->cia402_state[a];
+				transition->samples_ago = 0;
+			}
+			transition->samples_ago++;
+
+			if (sample->velocity[a] < agg->min[a])
+				agg->min[a] = sample->velocity[a];
+			if (sample->velocity[a] > agg->max[a])
+				agg->max[a] = sample->velocity[a];
+			agg->sum[a] += sample->velocity[a];
+			agg->error_square_sum[a] += (double)error * error;
+			if (abs(error) > agg->error_max_abs[a])
+				agg->error_max_abs[a] = abs(error);
+			if (sample->cia402_state[a] == CIA402_OPERATION_ENABLED)
+				ripple_error[a][ripple_errors[a]++] = -error;
+			trend_add(&gui_trend, a, sample->velocity_demand[a], sample->velocity[a]);
+		}
+		agg->samples++;
+	}
+	// The errors of every axis go to the ripple analysis at once, count is at most GUI_BATCH_SIZE
+	for (unsigned int a = 0; (count > 0) && (a < samples[0].axes); a++)
+	{
+		ripple_add(&gui_ripple[a], ripple_error[a], ripple_errors[a]);
+	}
+}
+
+// Function for exchanging data with the real time cyclic_task of ethercat.
+// Drains all samples queued since the last call in batches and returns the latest one in p_txdata.
+// Returns the number of received samples.
+unsigned int exchange_data(txpdo_queue_data_t* p_txdata, rxpdo_queue_data_t* p_rxdata)
+{
+	txpdo_queue_data_t batch[GUI_BATCH_SIZE];
+	unsigned int count, received = 0;
 
 #ifdef PIGPIO_OUT
                 // Enable GPIO15
                 gpioWrite(15, 1);
 #endif
-		//************** lock queue ***********************//
-		// Lock mutex
-		pthread_mutex_lock(mymutex);
-		// as long as queue is empty, go to conditional wait for signal from main thread with mutex unlocked
-        while (curmessages == 0) {
-#ifdef PIGPIO_OUT
-        		// Disable GPIO15
-        		gpioWrite(15, 0);
-#endif
-        		// No new messages in queue, so wait until condition is signaled
-                pthread_cond_wait(mycondition, mymutex);
-#ifdef PIGPIO_OUT
-                // Enable GPIO15
-                gpioWrite(15, 1);
-#endif
-            }
-       	// Comming here if queue is not empty triggered by signal from main thread
-        // Receive RX PDO's via queue
-        mq_receive(myqueue, (char *)p_txdata, sizeof(txpdo_queue_data_t)+1, 0);
-        // Get actual number of messages from queue
-        mq_getattr(myqueue, &attr);
-        // and store into the shared variable
-       	curmessages = attr.mq_curmsgs;
-       	// Write TX PDO's via global
-       	rxpdo_queue_data.velocity_setpoint = p_rxdata->velocity_setpoint;
-       	// Unlock mutex
-       	pthread_mutex_unlock(mymutex);
-        //************** unlock queue ***********************//
+		// Receive TX PDO's via ring buffer. The real time thread is never blocked by this.
+		ring_fill = txpdo_ring_fill(txpdo_ring);
+		while ((count = txpdo_ring_pop_batch(txpdo_ring, batch, GUI_BATCH_SIZE)) > 0)
+		{
+			gui_aggregate_add(batch, count);
+			*p_txdata = batch[count-1];
+			received += count;
+		}
+		// Publish the command block only if it was changed, so every sequence number is a new command
+		if (memcmp(&p_rxdata->velocity_setpoint, &rxpdo_published.velocity_setpoint,
+				sizeof(rxpdo_queue_data_t) - offsetof(rxpdo_queue_data_t, velocity_setpoint)) != 0)
+		{
+			rxpdo_channel_publish(rxpdo_channel, p_rxdata);
+			rxpdo_published = *p_rxdata;
+		}
 #ifdef PIGPIO_OUT
         		// Disable GPIO15
         		gpioWrite(15, 0);
 #endif
 
+	return received;
 }
 
-// This function is not allowed to contain a blocking call except exchange_data()
-void* ncurses_gui(void* arg)
+// Handles all keys pressed since the last call. Returns true if the command block was changed.
+bool handle_keys(txpdo_queue_data_t* ptxpdo, rxpdo_queue_data_t* prxpdo)
 {
 	int keypressed;
-	txpdo_queue_data_t txpdo_data = {0};
-	rxpdo_queue_data_t rxpdo_data = {0};
-    struct sched_param param = {};
-    // The scheduler priority of this thread is set to the highest possible -1.
-    param.sched_priority = sched_get_priority_max(SCHED_FIFO)-1;
-
-    printf("Using priority %i.\n", param.sched_priority);
-    if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
-        perror("sched_setscheduler failed\n");
-    }
-
-    ncurses_gui_reinit();
+	bool changed = false;
 
-
-	while(1)
+	// Get chars from keyboard buffer non blocking until it is empty
+	while ((keypressed = wgetch(win_ethcat)) != ERR)
 	{
-		// Exchange data with the ethercat realtime thread. This is synched with a condition from the real time thread and is a blocking call.
-		exchange_data(&txpdo_data, &rxpdo_data);
-
-		// Get char from keyboard buffer non blocking
-		keypressed = wgetch(win_ethcat);
-
         if(keypressed == KEY_UP)
         {
-        	rxpdo_data.velocity_setpoint += 1000;
+        	prxpdo->velocity_setpoint[selected_axis] += 1000;
+        	changed = true;
         }
         else if(keypressed == KEY_DOWN)
         {
-        	rxpdo_data.velocity_setpoint -= 1000;
+        	prxpdo->velocity_setpoint[selected_axis] -= 1000;
+        	changed = true;
+        }
+        else if(keypressed == 'm')
+        {
+        	// Toggle between profile velocity and cyclic synchronous velocity
+        	prxpdo->mode_of_operation[selected_axis] = (prxpdo->mode_of_operation[selected_axis] == 9) ? 3 : 9;
+        	changed = true;
+        }
+        else if((keypressed == 'a') && (prxpdo->profile_acceleration[selected_axis] > 1))
+        {
+        	prxpdo->profile_acceleration[selected_axis] /= 2;
+        	prxpdo->profile_deceleration[selected_axis] = prxpdo->profile_acceleration[selected_axis];
+        	changed = true;
         }
+        else if((keypressed == 'A') && (prxpdo->profile_acceleration[selected_axis] < 0x40000000))
+        {
+        	prxpdo->profile_acceleration[selected_axis] *= 2;
+        	prxpdo->profile_deceleration[selected_axis] = prxpdo->profile_acceleration[selected_axis];
+        	changed = true;
+        }
+        else if((keypressed == 'j') && (prxpdo->profile_jerk[selected_axis] > 1))
+        {
+        	prxpdo->profile_jerk[selected_axis] /= 2;
+        	changed = true;
+        }
+        else if((keypressed == 'J') && (prxpdo->profile_jerk[selected_axis] < 0x40000000))
+        {
+        	prxpdo->profile_jerk[selected_axis] *= 2;
+        	changed = true;
+        }
+        else if(keypressed == 'e')
+        {
+        	// Toggle between operation enabled and ready to switch on
+        	prxpdo->enable[selected_axis] = !prxpdo->enable[selected_axis];
+        	changed = true;
+        }
+        else if(keypressed == 'f')
+        {
+        	// Following error in the trend plot on or off
+        	gui_trend_error = !gui_trend_error;
+        }
+        else if((keypressed == KEY_RIGHT) && (selected_axis + 1 < ptxpdo->axes))
+        {
+        	selected_axis++;
+        }
+        else if((keypressed == KEY_LEFT) && (selected_axis > 0))
+        {
+        	selected_axis--;
+        }
+	}
+	// The ripple is analysed anew for the changed command
+	if (changed)
+	{
+		ripple_reset(&gui_ripple[selected_axis]);
+	}
+	return changed;
+}
 
+// This function is not allowed to contain a blocking call except waiting for the next frame or a key
+void* ncurses_gui(void* arg)
+{
+	txpdo_queue_data_t txpdo_data = {0};
+	rxpdo_queue_data_t rxpdo_data = {0};
+	struct timespec now, next_frame;
+	long timeout_ns;
+	struct pollfd keyboard = {.fd = STDIN_FILENO, .events = POLLIN};
+	long frame_ns = 1000000000L / gui_rate_hz;
+
+	// Start with the command block initially applied by the real time thread
+	while (!rxpdo_channel_read(rxpdo_channel, &rxpdo_data));
+	rxpdo_published = rxpdo_data;
+    ncurses_gui_reinit();
+
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+
+	while(1)
+	{
+		// The gui runs at its own frame rate, the real time thread never signals it.
+		// Between two frames only keys are handled, which wake up the thread immediately.
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout_ns = (next_frame.tv_sec - now.tv_sec) * 1000000000L + (next_frame.tv_nsec - now.tv_nsec);
+		if (timeout_ns > 0)
+		{
+			// Rounded up to full milliseconds so the frame is not polled for early
+			if ((poll(&keyboard, 1, (timeout_ns + 999999L) / 1000000L) > 0) && (keyboard.revents & POLLIN))
+			{
+				// A changed setpoint is published without waiting for the next frame
+				if (handle_keys(&txpdo_data, &rxpdo_data))
+				{
+					exchange_data(&txpdo_data, &rxpdo_data);
+				}
+			}
+			continue;
+		}
+
+		// Next frame is due, skip frames which have been missed completely
+		next_frame.tv_nsec += frame_ns;
+		if (next_frame.tv_nsec >= 1000000000L)
+		{
+			next_frame.tv_nsec -= 1000000000L;
+			next_frame.tv_sec++;
+		}
+		if ((next_frame.tv_sec < now.tv_sec) || ((next_frame.tv_sec == now.tv_sec) && (next_frame.tv_nsec < now.tv_nsec)))
+		{
+			next_frame = now;
+		}
+
+		// Exchange data with the ethercat realtime thread. This is non blocking.
+		exchange_data(&txpdo_data, &rxpdo_data);
 
         if(winch_required == true)
         {
         	ncurses_gui_reinit();
         }
-		// print out latest process data
+		// print out latest process data and the statistics of all cycles since the last frame
 		print_master_state(win_ethcat);
+		print_gui_load(win_ethcat);
+		print_cycle_stats(win_ethcat, &txpdo_data);
+		print_cmd_stream(win_ethcat);
 		dialog_cia402(win_cia402, &txpdo_data, &rxpdo_data);
 		dialog_parameters(win_params);
-		wrefresh(win_ethcat);
-		wrefresh(win_cia402);
-		wrefresh(win_params);
+		if (win_trend)
+		{
+			print_trend(win_trend);
+			wnoutrefresh(win_trend);
+		}
+		gui_aggregate.samples = 0;
+		// Output of all windows at once
+		wnoutrefresh(win_ethcat);
+		wnoutrefresh(win_cia402);
+		wnoutrefresh(win_params);
+		doupdate();
 	}
 	endwin();
 
 	return NULL;
 }
 
-void ncurses_gui_thread(ec_master_t* pmaster, ec_domain_t* pdomain, uint8_t *pdomain_pd, pthread_mutex_t* pmutex, pthread_cond_t* pcondition)
+void ncurses_gui_thread(ec_master_t* pmaster, ec_domain_t* pdomain, uint8_t *pdomain_pd, rxpdo_channel_t* pchannel, txpdo_ring_t* pring,
+		sdo_engine_t* psdo_engine, unsigned int rate_hz, unsigned int cycle_hz, pthread_attr_t* attr)
 {
 	pthread_t ncurses_thread_id;
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setstacksize(&attr, 200000);	// TODO deleteme
-
 
 	// Assign pointer to master and domain persistent
 	master = pmaster;
 	domain = pdomain;
 	domain_pd = pdomain_pd;
-	mymutex = pmutex;
-	mycondition = pcondition;
-#define myqueue_name "/myqueue"
-	// open the message queue for communication between threads
-	myqueue = mq_open(myqueue_name, O_RDONLY);
-
-	// Create a new thread which handles the ncurses GUI
-    pthread_create(&ncurses_thread_id, &attr, &ncurses_gui, NULL);
+	rxpdo_channel = pchannel;
+	txpdo_ring = pring;
+	sdo_engine = psdo_engine;
+	if (rate_hz < GUI_RATE_MIN)
+		rate_hz = GUI_RATE_MIN;
+	if (rate_hz > GUI_RATE_MAX)
+		rate_hz = GUI_RATE_MAX;
+	gui_rate_hz = rate_hz;
+	ripple_init();
+	trend_init(&gui_trend, cycle_hz);
+	gui_cycle_hz = cycle_hz;
+
+	// Create a new thread which handles the ncurses GUI. Its policy, priority and cpu are set
+	// by attr, without privileges for real time scheduling it runs with the inherited policy.
+	if (pthread_create(&ncurses_thread_id, attr, &ncurses_gui, NULL) != 0)
+	{
+		pthread_attr_setinheritsched(attr, PTHREAD_INHERIT_SCHED);
+		pthread_create(&ncurses_thread_id, attr, &ncurses_gui, NULL);
+	}
 }
 
 // The function is called initializing the ncurses windows after start or resizing the terminal.
@@ -233,8 +848,21 @@ void ncurses_gui_reinit(void)
 
 	getmaxyx(stdscr, ymax, xmax);
 
-	win_ethcat = newwin((ymax/2)-2, (xmax/2)-2, 1, 1);
-	win_cia402 = newwin((ymax/2)-2, (xmax/2)-2, 1, xmax/2);
+	// The trend plot is placed next to the text panels if the terminal is wide enough. Its history
+	// is kept, the columns are only mapped anew to the bins for the new width.
+	if (xmax >= (2 * GUI_PANEL_WIDTH + GUI_TREND_MIN_WIDTH))
+	{
+		win_ethcat = newwin((ymax/2)-2, GUI_PANEL_WIDTH-2, 1, 1);
+		win_cia402 = newwin((ymax/2)-2, GUI_PANEL_WIDTH-2, 1, GUI_PANEL_WIDTH);
+		win_trend = newwin((ymax/2)-2, xmax-(2*GUI_PANEL_WIDTH), 1, (2*GUI_PANEL_WIDTH)-1);
+	}
+	else
+	{
+		win_ethcat = newwin((ymax/2)-2, (xmax/2)-2, 1, 1);
+		win_cia402 = newwin((ymax/2)-2, (xmax/2)-2, 1, xmax/2);
+		win_trend = NULL;
+	}
+	gui_braille = (strcmp(nl_langinfo(CODESET), "UTF-8") == 0);
 	win_params = newwin((ymax/2)-2, (xmax)-3, ymax/2, 1);
 	// Set for getch() non blocking
 	if (nodelay (win_ethcat, true) == ERR) {
@@ -247,6 +875,10 @@ void ncurses_gui_reinit(void)
 	keypad(win_ethcat, true);
 	keypad(win_cia402, true);
 	init_pair(1, COLOR_BLUE, COLOR_WHITE);
+	// Series of the trend plot
+	init_pair(2 + TREND_DEMAND, COLOR_GREEN, COLOR_BLACK);
+	init_pair(2 + TREND_ACTUAL, COLOR_YELLOW, COLOR_BLACK);
+	init_pair(2 + TREND_ERROR, COLOR_RED, COLOR_BLACK);
 	box(win_ethcat, 0, 0);
 	box(win_cia402, 0, 0);
 	box(win_params, 0, 0);
@@ -262,6 +894,16 @@ void ncurses_gui_reinit(void)
 	wrefresh(win_ethcat);
 	wrefresh(win_cia402);
 	wrefresh(win_params);
+	if (win_trend)
+	{
+		box(win_trend, 0, 0);
+		wattron(win_trend, A_STANDOUT | A_BOLD | COLOR_PAIR(1));
+		mvwprintw(win_trend, 0, 1, "Trend (f: error)");
+		wattroff(win_trend, A_STANDOUT | A_BOLD | COLOR_PAIR(1));
+		wrefresh(win_trend);
+	}
+	// All fields are drawn again into the new windows
+	gui_fields_invalidate();
 
 	timeout(0);
 	winch_required = false;
@@ -269,8 +911,6 @@ void ncurses_gui_reinit(void)
 
 void ncurses_gui_deinit(void)
 {
-    // Remove queue
-    mq_close(myqueue);
     // Close ncurses window
     endwin();
 }
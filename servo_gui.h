@@ -8,20 +8,55 @@
 #ifndef EXAMPLES_DC_RTELLIGENT_SERVO_GUI_H_
 #define EXAMPLES_DC_RTELLIGENT_SERVO_GUI_H_
 
-// Data type send from cyclic_task via queue to ncurses_gui task
+#include <pthread.h>
+
+// Maximum number of ECT60 axes driven within one domain
+#define MAX_AXES 16
+
+// Limits of the frame rate of the gui. All samples received within one frame are drained from the ring.
+#define GUI_RATE_MIN 20
+#define GUI_RATE_MAX 60
+
+// Data type send from cyclic_task via ring buffer to ncurses_gui task.
+// The per axis values are stored as struct of arrays indexed by axis number.
 typedef struct
 {
-	int long velocity;
-	char mode_of_operation;
+	unsigned int axes;					// Number of axes in use
+	int32_t velocity[MAX_AXES];			// 0x606c
+	int32_t velocity_demand[MAX_AXES];	// 0x60ff as written, profiled in cyclic synchronous velocity mode
+	int8_t mode_of_operation[MAX_AXES];	// 0x6061
+	uint16_t statusword[MAX_AXES];		// 0x6041
+	uint8_t cia402_state[MAX_AXES];		// cia402_state_t decoded from the statusword
+	uint32_t cia402_transitions[MAX_AXES];
+	uint32_t cia402_faults[MAX_AXES];
+	uint32_t enable_time_ns[MAX_AXES];	// Time of the last enabling until operation enabled
+	uint32_t command_sequence;			// Sequence number of the latest command written to the RX PDO's
+	int long command_latency_ns;		// Time from publishing this command until writing it to the RX PDO's
+	uint8_t dc_follow;					// Master follows the DC reference clock
+	int32_t dc_phase_error_ns;			// Application time - reference clock of the last cycle
+	int32_t dc_adjust_ns;				// Correction of the next wakeup
 }txpdo_queue_data_t;
 
-// Data type send from ncurses_gui task to cyclic_task (no queue)
+// Command block send from ncurses_gui task to cyclic_task via seqlock channel
 typedef struct
 {
-	int long velocity_setpoint;
+	uint32_t sequence;							// Assigned on publishing, incremented with every command
+	uint64_t timestamp_ns;						// CLOCK_MONOTONIC time of publishing
+	int32_t velocity_setpoint[MAX_AXES];		// 0x60ff
+	uint8_t enable[MAX_AXES];					// Request operation enabled, else ready to switch on (0x6040)
+	int8_t mode_of_operation[MAX_AXES];			// 0x6060
+	uint32_t profile_acceleration[MAX_AXES];	// 0x6083
+	uint32_t profile_deceleration[MAX_AXES];	// 0x6084
+	uint32_t profile_jerk[MAX_AXES];			// Jerk limit of the setpoint generator in cyclic synchronous velocity mode
+	uint8_t profile_bypass[MAX_AXES];			// Write the setpoint as commanded in cyclic synchronous velocity mode
 }rxpdo_queue_data_t;
 
-void ncurses_gui_thread(ec_master_t*, ec_domain_t*, uint8_t *, pthread_mutex_t*, pthread_cond_t*);
+struct txpdo_ring;
+struct rxpdo_channel;
+struct sdo_engine;
+
+void ncurses_gui_thread(ec_master_t*, ec_domain_t*, uint8_t *, struct rxpdo_channel*, struct txpdo_ring*, struct sdo_engine*,
+		unsigned int, unsigned int, pthread_attr_t*);
 void ncurses_gui_reinit(void);
 void ncurses_gui_deinit(void);
 
@@ -0,0 +1,129 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ecrt.h>
+#include "session.h"
+
+/****************************************************************************/
+
+// Creates the session file and maps it. Must be called before the real time cycle starts.
+// All pages are written once here, so they are present and writable during the capture.
+int session_create(session_t* session, const char* path, uint32_t axes, uint32_t period_ns, uint32_t domain_size,
+		const void* layout, uint32_t layout_size, uint64_t capacity)
+{
+	session_header_t* header;
+	size_t size = SESSION_HEADER_SIZE + capacity;
+	int fd, err;
+
+	memset(session, 0, sizeof(session_t));
+	if (layout_size > SESSION_MAX_LAYOUT)
+	{
+		fprintf(stderr, "Session: layout of %u bytes exceeds %u bytes\n", layout_size, SESSION_MAX_LAYOUT);
+		return -1;
+	}
+	fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		perror("open of session failed");
+		return -1;
+	}
+	if ((err = posix_fallocate(fd, 0, size)) != 0)
+	{
+		errno = err;
+		perror("posix_fallocate of session failed");
+		close(fd);
+		return -1;
+	}
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+	{
+		perror("mmap of session failed");
+		return -1;
+	}
+	memset(header, 0, size);
+	header->version = SESSION_VERSION;
+	header->axes = axes;
+	header->period_ns = period_ns;
+	header->domain_size = domain_size;
+	header->layout_size = layout_size;
+	header->capacity = capacity;
+	memcpy(header->layout, layout, layout_size);
+	atomic_init(&header->used, 0);
+	atomic_init(&header->full, 0);
+	atomic_thread_fence(memory_order_release);
+	header->magic = SESSION_MAGIC;
+
+	session->header = header;
+	session->records = (uint8_t*)header + SESSION_HEADER_SIZE;
+	session->map_size = size;
+	session->capacity = capacity;
+	return 0;
+}
+
+// Maps a session file read only for a replay
+int session_open(session_t* session, const char* path)
+{
+	session_header_t* header;
+	struct stat st;
+	int fd;
+
+	memset(session, 0, sizeof(session_t));
+	fd = open(path, O_RDONLY);
+	if ((fd == -1) || (fstat(fd, &st) == -1))
+	{
+		perror(path);
+		return -1;
+	}
+	header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+	{
+		perror("mmap of session failed");
+		return -1;
+	}
+	if (((size_t)st.st_size < SESSION_HEADER_SIZE) || (header->magic != SESSION_MAGIC) ||
+			(header->version != SESSION_VERSION) || ((size_t)st.st_size < SESSION_HEADER_SIZE + header->capacity))
+	{
+		fprintf(stderr, "%s is no session of version %u\n", path, SESSION_VERSION);
+		munmap(header, st.st_size);
+		return -1;
+	}
+	session->header = header;
+	session->records = (uint8_t*)header + SESSION_HEADER_SIZE;
+	session->map_size = st.st_size;
+	session->capacity = header->capacity;
+	session->used = atomic_load_explicit(&header->used, memory_order_acquire);
+	session->full = true;
+	return 0;
+}
+
+void session_close(session_t* session)
+{
+	if (session->header)
+	{
+		munmap(session->header, session->map_size);
+		session->header = NULL;
+	}
+}
@@ -0,0 +1,154 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "servo_gui.h"
+
+// Capture of a session for an offline replay of the cycle logic. Unlike the process data
+// recorder, the whole domain image of every cycle is kept together with the master and domain
+// state, the timestamps and every command applied, so the cycle logic can be run again with
+// exactly the same inputs. The file is written linearly until it is full, like the recorder it
+// is allocated and mapped before the cycle starts and should be placed on a tmpfs.
+#define SESSION_MAGIC 0x45435343		// "ECSC"
+#define SESSION_VERSION 2
+#define SESSION_HEADER_SIZE 4096
+#define SESSION_MAX_LAYOUT 2048
+
+typedef enum
+{
+	SESSION_CYCLE = 1,
+	SESSION_COMMAND
+}session_record_type_t;
+
+#define SESSION_FLAG_OVERRUN_STOPPED 0x01
+
+// Every record starts with its type and its size including padding to 8 bytes
+typedef struct
+{
+	uint32_t type;
+	uint32_t size;
+}session_record_t;
+
+typedef struct
+{
+	session_record_t head;
+	uint64_t cycle;
+	uint64_t wakeup_ns;			// CLOCK_MONOTONIC time the cycle was scheduled for
+	uint64_t start_ns;			// CLOCK_MONOTONIC time the cycle actually started
+	uint32_t logic_ns;			// Execution time of the cycle logic
+	uint32_t working_counter;
+	uint8_t wc_state;
+	uint8_t link_up;
+	uint8_t al_states;
+	uint8_t flags;
+	uint32_t reserved;
+	uint8_t data[];				// Domain process data after the cycle logic: inputs received, outputs written
+}session_cycle_t;
+
+// Command block applied from this cycle on, written before the cycle record
+typedef struct
+{
+	session_record_t head;
+	rxpdo_queue_data_t command;
+}session_command_t;
+
+#define SESSION_ALIGN(SIZE) (((SIZE) + 7) & ~(size_t)7)
+#define SESSION_CYCLE_SIZE(DOMAIN_SIZE) SESSION_ALIGN(sizeof(session_cycle_t) + (DOMAIN_SIZE))
+#define SESSION_COMMAND_SIZE SESSION_ALIGN(sizeof(session_command_t))
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t axes;
+	uint32_t period_ns;
+	uint32_t domain_size;
+	uint32_t layout_size;
+	uint64_t capacity;				// Bytes available for records
+	uint8_t layout[SESSION_MAX_LAYOUT];	// Offsets of the PDO entries in the domain, opaque to the session
+	_Alignas(64) atomic_ullong used;	// Bytes of complete records
+	atomic_uint full;
+}session_header_t;
+
+typedef struct
+{
+	session_header_t* header;
+	uint8_t* records;
+	size_t map_size;
+	uint64_t capacity;
+	uint64_t used;
+	bool full;
+}session_t;
+
+int session_create(session_t* session, const char* path, uint32_t axes, uint32_t period_ns, uint32_t domain_size,
+		const void* layout, uint32_t layout_size, uint64_t capacity);
+int session_open(session_t* session, const char* path);
+void session_close(session_t* session);
+
+// Called by cyclic_task. Returns the record of the given type and size to fill, NULL if the file is full.
+static inline void* session_append(session_t* session, session_record_type_t type, uint32_t size)
+{
+	session_record_t* record;
+
+	if ((session->header == NULL) || session->full)
+	{
+		return NULL;
+	}
+	if (session->used + size > session->capacity)
+	{
+		session->full = true;
+		atomic_store_explicit(&session->header->full, 1, memory_order_relaxed);
+		return NULL;
+	}
+	record = (session_record_t*)(session->records + session->used);
+	record->type = type;
+	record->size = size;
+	return record;
+}
+
+// Called by cyclic_task after the record returned by session_append() is filled
+static inline void session_commit(session_t* session, const void* record)
+{
+	session->used += ((const session_record_t*)record)->size;
+	atomic_store_explicit(&session->header->used, session->used, memory_order_release);
+}
+
+// Reader side, returns the record at *offset and advances it, NULL at the end
+static inline const session_record_t* session_next(const session_t* session, uint64_t* offset)
+{
+	const session_record_t* record;
+
+	if (*offset + sizeof(session_record_t) > session->used)
+	{
+		return NULL;
+	}
+	record = (const session_record_t*)(session->records + *offset);
+	if ((record->size < sizeof(session_record_t)) || (*offset + record->size > session->used))
+	{
+		return NULL;
+	}
+	*offset += record->size;
+	return record;
+}
+
+#endif /* SESSION_H_ */
@@ -0,0 +1,246 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulated EtherCAT master. This header replaces the ecrt.h of the IgH EtherLab master
+// if ECT60ctrl is built with ENABLE_SIMULATION=1. It declares the subset of the
+// application interface used by ECT60ctrl with the same names, types and semantics,
+// so the application sources are built unchanged against both.
+
+#ifndef SIM_ECRT_H_
+#define SIM_ECRT_H_
+
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/****************************************************************************/
+
+#define ECRT_VER_MAJOR 1
+#define ECRT_VER_MINOR 6
+#define ECRT_VERSION(a, b) (((a) << 8) + (b))
+#define ECRT_VERSION_MAGIC ECRT_VERSION(ECRT_VER_MAJOR, ECRT_VER_MINOR)
+
+// Marks this header as the simulation for the application
+#define ECRT_SIMULATION 1
+
+#define EC_END ~0U
+
+// Register requests are available like in the IgH master since 1.5.2
+#define EC_HAVE_REG_ACCESS
+
+/****************************************************************************/
+
+typedef struct ec_master ec_master_t;
+typedef struct ec_slave_config ec_slave_config_t;
+typedef struct ec_domain ec_domain_t;
+typedef struct ec_sdo_request ec_sdo_request_t;
+typedef struct ec_reg_request ec_reg_request_t;
+
+typedef struct {
+    unsigned int slaves_responding;
+    unsigned int al_states : 4;
+    unsigned int link_up : 1;
+} ec_master_state_t;
+
+typedef enum {
+    EC_WC_ZERO = 0,
+    EC_WC_INCOMPLETE,
+    EC_WC_COMPLETE
+} ec_wc_state_t;
+
+typedef struct {
+    unsigned int slave_count;
+    unsigned int link_up : 1;
+    uint8_t scan_busy;
+    uint64_t app_time;
+} ec_master_info_t;
+
+#define EC_MAX_STRING_LENGTH 64
+
+// Without the port information of the IgH master
+typedef struct {
+    uint16_t position;
+    uint32_t vendor_id;
+    uint32_t product_code;
+    uint32_t revision_number;
+    uint32_t serial_number;
+    uint16_t alias;
+    int16_t current_on_ebus;
+    uint8_t al_state;
+    uint8_t error_flag;
+    uint8_t sync_count;
+    uint16_t sdo_count;
+    char name[EC_MAX_STRING_LENGTH];
+} ec_slave_info_t;
+
+typedef struct {
+    unsigned int working_counter;
+    ec_wc_state_t wc_state;
+    unsigned int redundancy_active;
+} ec_domain_state_t;
+
+typedef enum {
+    EC_DIR_INVALID,
+    EC_DIR_OUTPUT,
+    EC_DIR_INPUT,
+    EC_DIR_BOTH,
+    EC_DIR_COUNT
+} ec_direction_t;
+
+typedef enum {
+    EC_WD_DEFAULT,
+    EC_WD_ENABLE,
+    EC_WD_DISABLE,
+} ec_watchdog_mode_t;
+
+typedef struct {
+    uint16_t index;
+    uint8_t subindex;
+    uint8_t bit_length;
+} ec_pdo_entry_info_t;
+
+typedef struct {
+    uint16_t index;
+    unsigned int n_entries;
+    ec_pdo_entry_info_t const *entries;
+} ec_pdo_info_t;
+
+typedef struct {
+    uint8_t index;
+    ec_direction_t dir;
+    unsigned int n_pdos;
+    ec_pdo_info_t const *pdos;
+    ec_watchdog_mode_t watchdog_mode;
+} ec_sync_info_t;
+
+typedef struct {
+    uint16_t alias;
+    uint16_t position;
+    uint32_t vendor_id;
+    uint32_t product_code;
+    uint16_t index;
+    uint8_t subindex;
+    unsigned int *offset;
+    unsigned int *bit_position;
+} ec_pdo_entry_reg_t;
+
+typedef enum {
+    EC_REQUEST_UNUSED,
+    EC_REQUEST_BUSY,
+    EC_REQUEST_SUCCESS,
+    EC_REQUEST_ERROR,
+} ec_request_state_t;
+
+/****************************************************************************/
+
+// Master
+ec_master_t *ecrt_request_master(unsigned int master_index);
+void ecrt_release_master(ec_master_t *master);
+ec_domain_t *ecrt_master_create_domain(ec_master_t *master);
+ec_slave_config_t *ecrt_master_slave_config(ec_master_t *master, uint16_t alias,
+        uint16_t position, uint32_t vendor_id, uint32_t product_code);
+int ecrt_master_activate(ec_master_t *master);
+int ecrt_master_send(ec_master_t *master);
+int ecrt_master_receive(ec_master_t *master);
+int ecrt_master_state(const ec_master_t *master, ec_master_state_t *state);
+int ecrt_master_application_time(ec_master_t *master, uint64_t app_time);
+int ecrt_master_sync_reference_clock(ec_master_t *master);
+int ecrt_master_sync_reference_clock_to(ec_master_t *master, uint64_t sync_time);
+int ecrt_master_sync_slave_clocks(ec_master_t *master);
+int ecrt_master_reference_clock_time(ec_master_t *master, uint32_t *time);
+int ecrt_master(ec_master_t *master, ec_master_info_t *master_info);
+int ecrt_master_get_slave(ec_master_t *master, uint16_t slave_position,
+        ec_slave_info_t *slave_info);
+int ecrt_master_sdo_download_complete(ec_master_t *master,
+        uint16_t slave_position, uint16_t index, uint8_t *data,
+        size_t data_size, uint32_t *abort_code);
+
+// Slave configuration
+int ecrt_slave_config_pdos(ec_slave_config_t *sc, unsigned int n_syncs,
+        const ec_sync_info_t syncs[]);
+int ecrt_slave_config_dc(ec_slave_config_t *sc, uint16_t assign_activate,
+        uint32_t sync0_cycle, int32_t sync0_shift, uint32_t sync1_cycle,
+        int32_t sync1_shift);
+ec_sdo_request_t *ecrt_slave_config_create_sdo_request(ec_slave_config_t *sc,
+        uint16_t index, uint8_t subindex, size_t size);
+ec_reg_request_t *ecrt_slave_config_create_reg_request(ec_slave_config_t *sc,
+        size_t size);
+
+// Domain
+int ecrt_domain_reg_pdo_entry_list(ec_domain_t *domain,
+        const ec_pdo_entry_reg_t *pdo_entry_regs);
+size_t ecrt_domain_size(const ec_domain_t *domain);
+uint8_t *ecrt_domain_data(ec_domain_t *domain);
+int ecrt_domain_process(ec_domain_t *domain);
+int ecrt_domain_queue(ec_domain_t *domain);
+int ecrt_domain_state(const ec_domain_t *domain, ec_domain_state_t *state);
+
+// SDO requests
+int ecrt_sdo_request_index(ec_sdo_request_t *req, uint16_t index, uint8_t subindex);
+int ecrt_sdo_request_timeout(ec_sdo_request_t *req, uint32_t timeout);
+uint8_t *ecrt_sdo_request_data(ec_sdo_request_t *req);
+size_t ecrt_sdo_request_data_size(const ec_sdo_request_t *req);
+ec_request_state_t ecrt_sdo_request_state(ec_sdo_request_t *req);
+int ecrt_sdo_request_write(ec_sdo_request_t *req);
+int ecrt_sdo_request_read(ec_sdo_request_t *req);
+
+// Register requests
+uint8_t *ecrt_reg_request_data(ec_reg_request_t *req);
+ec_request_state_t ecrt_reg_request_state(const ec_reg_request_t *req);
+int ecrt_reg_request_write(ec_reg_request_t *req, uint16_t address, size_t size);
+int ecrt_reg_request_read(ec_reg_request_t *req, uint16_t address, size_t size);
+
+/****************************************************************************/
+
+// Process data access, the bus byte order is little endian
+
+#define EC_READ_BIT(DATA, POS) ((*((uint8_t *) (DATA)) >> (POS)) & 0x01)
+
+#define EC_READ_U8(DATA) ((uint8_t) *((uint8_t *) (DATA)))
+#define EC_READ_S8(DATA) ((int8_t) *((uint8_t *) (DATA)))
+#define EC_READ_U16(DATA) ((uint16_t) le16toh(*((uint16_t *) (DATA))))
+#define EC_READ_S16(DATA) ((int16_t) le16toh(*((uint16_t *) (DATA))))
+#define EC_READ_U32(DATA) ((uint32_t) le32toh(*((uint32_t *) (DATA))))
+#define EC_READ_S32(DATA) ((int32_t) le32toh(*((uint32_t *) (DATA))))
+#define EC_READ_U64(DATA) ((uint64_t) le64toh(*((uint64_t *) (DATA))))
+#define EC_READ_S64(DATA) ((int64_t) le64toh(*((uint64_t *) (DATA))))
+
+#define EC_WRITE_U8(DATA, VAL) \
+    do { \
+        *((uint8_t *)(DATA)) = ((uint8_t) (VAL)); \
+    } while (0)
+#define EC_WRITE_S8(DATA, VAL) EC_WRITE_U8(DATA, VAL)
+#define EC_WRITE_U16(DATA, VAL) \
+    do { \
+        *((uint16_t *) (DATA)) = htole16((uint16_t) (VAL)); \
+    } while (0)
+#define EC_WRITE_S16(DATA, VAL) EC_WRITE_U16(DATA, VAL)
+#define EC_WRITE_U32(DATA, VAL) \
+    do { \
+        *((uint32_t *) (DATA)) = htole32((uint32_t) (VAL)); \
+    } while (0)
+#define EC_WRITE_S32(DATA, VAL) EC_WRITE_U32(DATA, VAL)
+#define EC_WRITE_U64(DATA, VAL) \
+    do { \
+        *((uint64_t *) (DATA)) = htole64((uint64_t) (VAL)); \
+    } while (0)
+#define EC_WRITE_S64(DATA, VAL) EC_WRITE_U64(DATA, VAL)
+
+/****************************************************************************/
+
+#endif /* SIM_ECRT_H_ */
@@ -0,0 +1,1156 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulated EtherCAT master with simulated ECT60 drives.
+//
+// Every configured slave is simulated as ECT60 drive with the PDO mapping given by
+// ecrt_slave_config_pdos(). The domain process data is exchanged with the drives by
+// a simulated frame: ecrt_master_send() takes a copy of the outputs, the next
+// ecrt_master_receive() delivers the outputs to the drives, advances the drive models
+// and returns their inputs. ecrt_domain_process() copies the whole frame into the domain,
+// the outputs sent included. The behaviour is configured by environment variables:
+//
+// ECT60_SIM_FRAME_LATENCY_US   Round trip time of the frame, a frame not returned until
+//                              the next receive is lost (default 30)
+// ECT60_SIM_SEND_COST_US       Busy time of ecrt_master_send() (default 0)
+// ECT60_SIM_SPIKE_US           Additional busy time of every ECT60_SIM_SPIKE_EVERY-th send,
+// ECT60_SIM_SPIKE_EVERY        an execution time spike of the cycle (default 0, 0)
+// ECT60_SIM_WC_FAULT_RATE      Probability of a lost frame (default 0)
+// ECT60_SIM_WC_FAULT_EVERY     Lose every n-th frame, 0 disables (default 0)
+// ECT60_SIM_INERTIA            Load inertia relative to the motor (default 1)
+// ECT60_SIM_LAG_US             Lag of the actual velocity 0x606c (default 1000)
+// ECT60_SIM_KP                 Velocity loop gain [1/s], object 0x2101 (default 300)
+// ECT60_SIM_TI_US              Velocity loop integral time, object 0x2102 (default 10000)
+// ECT60_SIM_TORQUE_MAX         Torque limit as acceleration [units/s^2] (default 1e6)
+// ECT60_SIM_FRICTION           Viscous friction [1/s] (default 0.5)
+// ECT60_SIM_RIPPLE             Amplitude of a sinusoidal torque disturbance [units/s^2] (default 0)
+// ECT60_SIM_RIPPLE_HZ          Frequency of the torque disturbance (default 0)
+// ECT60_SIM_FAULT_PERIOD_MS    Raise a drive fault after this time in operation enabled (default 0)
+// ECT60_SIM_STRICT             Only accept CiA402 conform transitions (default 0)
+// ECT60_SIM_COMPLETE_ACCESS    Accept complete access downloads of vendor objects (default 1)
+// ECT60_SIM_DC_DRIFT_PPM       Drift of the reference clock against the host clock (default 50)
+// ECT60_SIM_SLAVE_DELAY_NS     Propagation delay of the frame from one slave to the next (default 700)
+// ECT60_SIM_DC_DIFF_NS         Largest system time difference of a slave to the reference (default 20)
+// ECT60_SIM_CALC_COPY_US       Time a drive needs from the frame until its outputs are valid at SYNC0,
+//                              object 0x1C32:06 (default 5)
+//
+// With a SYNC0 cycle configured, the SYNC0 events of every slave are at the first application
+// time plus the shift plus multiples of the cycle. A frame passing a slave later than calc and
+// copy time before the next SYNC0 event is applied one event later, an event without a new frame
+// since the last one is counted in 0x1C32:0B like an SM event missed.
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ecrt.h"
+#include "sim_drive.h"
+
+/****************************************************************************/
+
+#define SIM_MAX_CONFIGS 32
+#define SIM_MAX_DOMAINS 4
+#define SIM_MAX_SYNCS 4
+#define SIM_MAX_ENTRIES 32
+#define SIM_MAX_AREAS (2 * SIM_MAX_CONFIGS)
+#define SIM_MAX_SDO_REQUESTS 16
+#define SIM_SDO_MAX_SIZE 4
+// Number of frames a SDO transfer takes to complete
+#define SIM_SDO_FRAMES 3
+#define SIM_MAX_REG_REQUESTS 4
+#define SIM_REG_MAX_SIZE 8
+#define SIM_COMPLETE_MAX_SIZE 512
+#define SIM_COMPLETE_TIMEOUT_MS 1000
+// Step of the drive models if no time has elapsed yet
+#define SIM_DEFAULT_STEP_NS 1000000ULL
+#define SIM_MAX_STEP_NS 10000000ULL
+
+/****************************************************************************/
+
+typedef struct
+{
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t bit_length;
+	unsigned int bit_offset;
+}sim_entry_t;
+
+typedef struct
+{
+	bool configured;
+	ec_direction_t dir;
+	unsigned int n_entries;
+	sim_entry_t entries[SIM_MAX_ENTRIES];
+	unsigned int size;
+}sim_sync_t;
+
+struct ec_reg_request
+{
+	ec_slave_config_t* sc;
+	uint8_t data[SIM_REG_MAX_SIZE];
+	size_t mem_size;
+	uint16_t address;
+	size_t size;
+	ec_request_state_t state;
+	bool write;
+	unsigned int busy_frames;
+};
+
+struct ec_sdo_request
+{
+	ec_slave_config_t* sc;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t data[SIM_SDO_MAX_SIZE];
+	size_t mem_size;
+	size_t data_size;
+	uint32_t timeout_ms;
+	ec_request_state_t state;
+	bool write;
+	unsigned int busy_frames;
+};
+
+// Complete access download of ecrt_master_sdo_download_complete(), which blocks the calling
+// thread until the transfer is processed with the frames like a SDO request
+typedef struct
+{
+	atomic_int state;
+	uint16_t index;
+	uint8_t data[SIM_COMPLETE_MAX_SIZE];
+	size_t size;
+	uint32_t abort_code;
+	unsigned int busy_frames;
+}sim_complete_request_t;
+
+struct ec_slave_config
+{
+	ec_master_t* master;
+	uint16_t alias;
+	uint16_t position;
+	uint32_t vendor_id;
+	uint32_t product_code;
+	sim_sync_t syncs[SIM_MAX_SYNCS];
+	uint16_t dc_assign_activate;
+	uint32_t dc_sync0_cycle;
+	int32_t dc_sync0_shift;
+	ec_sdo_request_t sdo_requests[SIM_MAX_SDO_REQUESTS];
+	unsigned int n_sdo_requests;
+	ec_reg_request_t reg_requests[SIM_MAX_REG_REQUESTS];
+	unsigned int n_reg_requests;
+	// SYNC0 event the last frame was applied at and the events without a new frame
+	int64_t sync0_event;
+	bool sync0_event_valid;
+	uint16_t sm_event_missed;
+	sim_complete_request_t complete;
+	sim_drive_t drive;
+	uint64_t last_step_ns;
+	bool outputs_received;
+};
+
+typedef struct
+{
+	ec_slave_config_t* sc;
+	unsigned int sync_index;
+	unsigned int offset;
+}sim_area_t;
+
+struct ec_domain
+{
+	ec_master_t* master;
+	sim_area_t areas[SIM_MAX_AREAS];
+	unsigned int n_areas;
+	size_t size;
+	uint8_t* data;			// Process data image of the application
+	uint8_t* frame;			// Content of the frame on the wire
+	bool queued;
+	bool frame_pending;
+	bool frame_received;
+	uint64_t frame_sent_ns;
+	unsigned int expected_wc;
+	unsigned int received_wc;
+	atomic_uint working_counter;
+	atomic_int wc_state;
+};
+
+typedef struct
+{
+	uint64_t frame_latency_ns;
+	uint64_t send_cost_ns;
+	uint64_t spike_ns;
+	unsigned long spike_every;
+	double wc_fault_rate;
+	unsigned long wc_fault_every;
+	double dc_drift;
+	uint32_t slave_delay_ns;
+	uint32_t dc_diff_ns;
+	uint32_t calc_copy_ns;
+	sim_drive_params_t drive;
+}sim_params_t;
+
+struct ec_master
+{
+	ec_slave_config_t configs[SIM_MAX_CONFIGS];
+	unsigned int n_configs;
+	ec_domain_t domains[SIM_MAX_DOMAINS];
+	unsigned int n_domains;
+	atomic_bool active;
+	uint64_t app_time_ns;
+	// Time of the SYNC0 events without shift, the first application time after activation
+	uint64_t sync0_base_ns;
+	bool sync0_base_set;
+	// The reference clock runs with its own drift from reference_time_ns at host time reference_host_ns.
+	// The time read by the sync datagram of a frame is available after the frame was received.
+	uint64_t reference_time_ns;
+	uint64_t reference_host_ns;
+	bool reference_set;
+	bool sync_queued;
+	bool sync_pending;
+	bool sync_received;
+	uint32_t sync_frame_time;
+	uint32_t sync_received_time;
+	unsigned long frames;
+	// Timing of the frames sent, reported on release. A frame sent more than one SYNC0 cycle
+	// after its application time is late, e.g. of a burst catching up missed cycles.
+	uint64_t last_send_ns;
+	uint64_t longest_gap_ns;
+	uint64_t longest_lag_ns;
+	unsigned long late_frames;
+	uint32_t random;
+	sim_params_t params;
+};
+
+/****************************************************************************/
+
+static uint64_t sim_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t sim_reference_clock(const ec_master_t *master, uint64_t now_ns)
+{
+	double elapsed = (double)(now_ns - master->reference_host_ns);
+
+	return master->reference_time_ns + (uint64_t)(elapsed * (1.0 + master->params.dc_drift));
+}
+
+static void sim_set_reference_clock(ec_master_t *master, uint64_t time_ns)
+{
+	master->reference_time_ns = time_ns;
+	master->reference_host_ns = sim_now_ns();
+	master->reference_set = true;
+}
+
+static double sim_env(const char* name, double def)
+{
+	const char* value = getenv(name);
+
+	return value ? atof(value) : def;
+}
+
+// Linear congruential generator, good enough for fault injection and free of system calls
+static double sim_random(ec_master_t* master)
+{
+	master->random = master->random * 1664525U + 1013904223U;
+	return (master->random >> 8) / (double)(1U << 24);
+}
+
+static void sim_read_params(sim_params_t* params)
+{
+	params->frame_latency_ns = sim_env("ECT60_SIM_FRAME_LATENCY_US", 30.0) * 1000.0;
+	params->send_cost_ns = sim_env("ECT60_SIM_SEND_COST_US", 0.0) * 1000.0;
+	params->spike_ns = sim_env("ECT60_SIM_SPIKE_US", 0.0) * 1000.0;
+	params->spike_every = sim_env("ECT60_SIM_SPIKE_EVERY", 0.0);
+	params->wc_fault_rate = sim_env("ECT60_SIM_WC_FAULT_RATE", 0.0);
+	params->wc_fault_every = sim_env("ECT60_SIM_WC_FAULT_EVERY", 0.0);
+	params->dc_drift = sim_env("ECT60_SIM_DC_DRIFT_PPM", 50.0) / 1e6;
+	params->slave_delay_ns = sim_env("ECT60_SIM_SLAVE_DELAY_NS", 700.0);
+	params->dc_diff_ns = sim_env("ECT60_SIM_DC_DIFF_NS", 20.0);
+	params->calc_copy_ns = sim_env("ECT60_SIM_CALC_COPY_US", 5.0) * 1000.0;
+	params->drive.inertia = sim_env("ECT60_SIM_INERTIA", 1.0);
+	params->drive.lag_s = sim_env("ECT60_SIM_LAG_US", 1000.0) / 1e6;
+	params->drive.kp = sim_env("ECT60_SIM_KP", 300.0);
+	params->drive.ti_s = sim_env("ECT60_SIM_TI_US", 10000.0) / 1e6;
+	params->drive.torque_max = sim_env("ECT60_SIM_TORQUE_MAX", 1e6);
+	params->drive.friction = sim_env("ECT60_SIM_FRICTION", 0.5);
+	params->drive.ripple = sim_env("ECT60_SIM_RIPPLE", 0.0);
+	params->drive.ripple_hz = sim_env("ECT60_SIM_RIPPLE_HZ", 0.0);
+	params->drive.fault_period_s = sim_env("ECT60_SIM_FAULT_PERIOD_MS", 0.0) / 1e3;
+	params->drive.strict = sim_env("ECT60_SIM_STRICT", 0.0) != 0.0;
+	params->drive.complete_access = sim_env("ECT60_SIM_COMPLETE_ACCESS", 1.0) != 0.0;
+	if (params->drive.inertia <= 0.0)
+	{
+		params->drive.inertia = 1.0;
+	}
+}
+
+static ec_slave_config_t* sim_find_config(ec_master_t* master, uint16_t alias, uint16_t position,
+		uint32_t vendor_id, uint32_t product_code)
+{
+	for (unsigned int i = 0; i < master->n_configs; i++)
+	{
+		ec_slave_config_t* sc = &master->configs[i];
+
+		if ((sc->alias == alias) && (sc->position == position))
+		{
+			if ((sc->vendor_id != vendor_id) || (sc->product_code != product_code))
+			{
+				fprintf(stderr, "Slave %u:%u already configured with different identity.\n", alias, position);
+				return NULL;
+			}
+			return sc;
+		}
+	}
+	return NULL;
+}
+
+static const sim_entry_t* sim_find_entry(ec_slave_config_t* sc, uint16_t index, uint8_t subindex,
+		unsigned int* sync_index)
+{
+	for (unsigned int s = 0; s < SIM_MAX_SYNCS; s++)
+	{
+		for (unsigned int e = 0; e < sc->syncs[s].n_entries; e++)
+		{
+			if ((sc->syncs[s].entries[e].index == index) && (sc->syncs[s].entries[e].subindex == subindex))
+			{
+				*sync_index = s;
+				return &sc->syncs[s].entries[e];
+			}
+		}
+	}
+	return NULL;
+}
+
+static uint32_t sim_get_bits(const uint8_t* data, const sim_entry_t* entry)
+{
+	uint32_t value = 0;
+
+	for (unsigned int i = 0; i < (entry->bit_length + 7u) / 8u; i++)
+	{
+		value |= (uint32_t)data[(entry->bit_offset / 8) + i] << (8 * i);
+	}
+	return value;
+}
+
+static void sim_set_bits(uint8_t* data, const sim_entry_t* entry, uint32_t value)
+{
+	for (unsigned int i = 0; i < (entry->bit_length + 7u) / 8u; i++)
+	{
+		data[(entry->bit_offset / 8) + i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+// Processes the SDO requests of a slave. Called once per received frame.
+// Objects of the sync manager parameters 0x1C32, which the drive model does not know about
+static bool sim_sync_manager_object(ec_slave_config_t* sc, uint16_t index, uint8_t subindex, uint32_t* value)
+{
+	if (index != 0x1C32)
+	{
+		return false;
+	}
+	switch (subindex)
+	{
+	case 0x01: *value = sc->dc_sync0_cycle ? 2 : 0; break;		// Synchronised with SYNC0
+	case 0x02: *value = sc->dc_sync0_cycle; break;
+	case 0x06: *value = sc->master->params.calc_copy_ns; break;
+	case 0x0B: *value = sc->sm_event_missed; break;
+	default: return false;
+	}
+	return true;
+}
+
+static uint32_t sim_register(ec_slave_config_t* sc, uint16_t address)
+{
+	ec_master_t* master = sc->master;
+	unsigned int position = sc - master->configs;
+	double diff;
+
+	switch (address)
+	{
+	case 0x0910:
+		return (uint32_t)sim_reference_clock(master, sim_now_ns());
+	case 0x0928:
+		// System time delay from the reference clock, the first slave
+		return position * master->params.slave_delay_ns;
+	case 0x092C:
+		// System time difference, the sign is bit 31
+		if (position == 0)
+		{
+			return 0;
+		}
+		diff = (2.0 * sim_random(master) - 1.0) * master->params.dc_diff_ns;
+		return (diff < 0.0) ? (0x80000000U | (uint32_t)(-diff)) : (uint32_t)diff;
+	default:
+		return 0;
+	}
+}
+
+// Register requests take SIM_SDO_FRAMES frames like SDO requests, writes are ignored
+static void sim_reg_process(ec_slave_config_t* sc)
+{
+	for (unsigned int i = 0; i < sc->n_reg_requests; i++)
+	{
+		ec_reg_request_t* req = &sc->reg_requests[i];
+
+		if ((req->state != EC_REQUEST_BUSY) || (--req->busy_frames > 0))
+		{
+			continue;
+		}
+		if (!req->write)
+		{
+			uint32_t value = sim_register(sc, req->address);
+
+			for (size_t b = 0; b < req->size; b++)
+			{
+				req->data[b] = (b < sizeof(value)) ? (uint8_t)(value >> (8 * b)) : 0;
+			}
+		}
+		req->state = EC_REQUEST_SUCCESS;
+	}
+}
+
+// Assigns the frame sent at now_ns to the SYNC0 event of every slave it is applied at
+static void sim_sync0_frame(ec_master_t* master, uint64_t now_ns)
+{
+	for (unsigned int i = 0; i < master->n_configs; i++)
+	{
+		ec_slave_config_t* sc = &master->configs[i];
+		int64_t passed, event;
+
+		if (!sc->dc_assign_activate || !sc->dc_sync0_cycle || !master->sync0_base_set)
+		{
+			continue;
+		}
+		// Time the outputs are valid in the slave relative to the SYNC0 events
+		passed = (int64_t)(sim_reference_clock(master, now_ns + master->params.frame_latency_ns / 2) +
+				i * master->params.slave_delay_ns + master->params.calc_copy_ns - master->sync0_base_ns) -
+				sc->dc_sync0_shift;
+		// First event at or after that time
+		event = (passed >= 0) ? (passed + sc->dc_sync0_cycle - 1) / sc->dc_sync0_cycle :
+				-((-passed) / (int64_t)sc->dc_sync0_cycle);
+		if (sc->sync0_event_valid && (event > sc->sync0_event + 1))
+		{
+			sc->sm_event_missed += event - sc->sync0_event - 1;
+		}
+		sc->sync0_event = event;
+		sc->sync0_event_valid = true;
+	}
+}
+
+static void sim_sdo_process(ec_slave_config_t* sc)
+{
+	sim_complete_request_t* complete = &sc->complete;
+
+	if ((atomic_load_explicit(&complete->state, memory_order_acquire) == EC_REQUEST_BUSY) &&
+			(--complete->busy_frames == 0))
+	{
+		complete->abort_code = sim_drive_set_complete(&sc->drive, complete->index, complete->data, complete->size);
+		atomic_store_explicit(&complete->state, complete->abort_code ? EC_REQUEST_ERROR : EC_REQUEST_SUCCESS,
+				memory_order_release);
+	}
+	for (unsigned int i = 0; i < sc->n_sdo_requests; i++)
+	{
+		ec_sdo_request_t* req = &sc->sdo_requests[i];
+		uint32_t value = 0;
+
+		if ((req->state != EC_REQUEST_BUSY) || (--req->busy_frames > 0))
+		{
+			continue;
+		}
+		if (req->write)
+		{
+			for (size_t b = 0; b < req->data_size; b++)
+			{
+				value |= (uint32_t)req->data[b] << (8 * b);
+			}
+			req->state = sim_drive_set_object(&sc->drive, req->index, req->subindex, value) ?
+					EC_REQUEST_SUCCESS : EC_REQUEST_ERROR;
+		}
+		else if (sim_sync_manager_object(sc, req->index, req->subindex, &value) ||
+				sim_drive_get_object(&sc->drive, req->index, req->subindex, &value))
+		{
+			for (size_t b = 0; b < req->mem_size; b++)
+			{
+				req->data[b] = (uint8_t)(value >> (8 * b));
+			}
+			req->data_size = req->mem_size;
+			req->state = EC_REQUEST_SUCCESS;
+		}
+		else
+		{
+			req->state = EC_REQUEST_ERROR;
+		}
+	}
+}
+
+// Delivers the frame of a domain to the slaves and collects their inputs
+static void sim_domain_exchange(ec_domain_t* domain, uint64_t now_ns)
+{
+	ec_master_t* master = domain->master;
+
+	// Outputs
+	for (unsigned int a = 0; a < domain->n_areas; a++)
+	{
+		sim_area_t* area = &domain->areas[a];
+		sim_sync_t* sync = &area->sc->syncs[area->sync_index];
+
+		if (sync->dir != EC_DIR_OUTPUT)
+		{
+			continue;
+		}
+		for (unsigned int e = 0; e < sync->n_entries; e++)
+		{
+			sim_drive_set_object(&area->sc->drive, sync->entries[e].index, sync->entries[e].subindex,
+					sim_get_bits(domain->frame + area->offset, &sync->entries[e]));
+		}
+		area->sc->outputs_received = true;
+	}
+
+	// Advance every drive once per frame
+	for (unsigned int i = 0; i < master->n_configs; i++)
+	{
+		ec_slave_config_t* sc = &master->configs[i];
+		uint64_t dt_ns = sc->last_step_ns ? (now_ns - sc->last_step_ns) : SIM_DEFAULT_STEP_NS;
+
+		if (!sc->outputs_received)
+		{
+			continue;
+		}
+		sc->outputs_received = false;
+		if (dt_ns > SIM_MAX_STEP_NS)
+		{
+			dt_ns = SIM_MAX_STEP_NS;
+		}
+		sim_drive_step(&sc->drive, dt_ns / 1e9);
+		sc->last_step_ns = now_ns;
+		sim_sdo_process(sc);
+		sim_reg_process(sc);
+	}
+
+	// Inputs
+	for (unsigned int a = 0; a < domain->n_areas; a++)
+	{
+		sim_area_t* area = &domain->areas[a];
+		sim_sync_t* sync = &area->sc->syncs[area->sync_index];
+		uint32_t value;
+
+		if (sync->dir != EC_DIR_INPUT)
+		{
+			continue;
+		}
+		for (unsigned int e = 0; e < sync->n_entries; e++)
+		{
+			if (sim_drive_get_object(&area->sc->drive, sync->entries[e].index, sync->entries[e].subindex, &value))
+			{
+				sim_set_bits(domain->frame + area->offset, &sync->entries[e], value);
+			}
+		}
+	}
+}
+
+/****************************************************************************/
+
+ec_master_t *ecrt_request_master(unsigned int master_index)
+{
+	ec_master_t* master;
+
+	if (master_index != 0)
+	{
+		fprintf(stderr, "Simulated master %u does not exist.\n", master_index);
+		return NULL;
+	}
+	master = calloc(1, sizeof(ec_master_t));
+	if (!master)
+	{
+		return NULL;
+	}
+	sim_read_params(&master->params);
+	master->random = 0x12345678;
+	printf("Using simulated EtherCAT master: frame latency %llu us, WC fault rate %g, every %lu.\n",
+			(unsigned long long)master->params.frame_latency_ns / 1000, master->params.wc_fault_rate,
+			master->params.wc_fault_every);
+	return master;
+}
+
+void ecrt_release_master(ec_master_t *master)
+{
+	printf("Simulated frames: %lu, late %lu, longest lag %.1f us, longest gap %.1f us\n", master->frames,
+			master->late_frames, master->longest_lag_ns / 1000.0, master->longest_gap_ns / 1000.0);
+	for (unsigned int i = 0; i < master->n_domains; i++)
+	{
+		free(master->domains[i].data);
+		free(master->domains[i].frame);
+	}
+	free(master);
+}
+
+// The slaves are on the ring in the order of their configuration, an alias is set on the first one
+int ecrt_master(ec_master_t *master, ec_master_info_t *master_info)
+{
+	memset(master_info, 0, sizeof(ec_master_info_t));
+	master_info->slave_count = master->n_configs;
+	master_info->link_up = 1;
+	master_info->app_time = master->app_time_ns;
+	return 0;
+}
+
+int ecrt_master_get_slave(ec_master_t *master, uint16_t slave_position, ec_slave_info_t *slave_info)
+{
+	ec_slave_config_t* sc;
+
+	if (slave_position >= master->n_configs)
+	{
+		return -EINVAL;
+	}
+	sc = &master->configs[slave_position];
+	memset(slave_info, 0, sizeof(ec_slave_info_t));
+	slave_info->position = slave_position;
+	slave_info->vendor_id = sc->vendor_id;
+	slave_info->product_code = sc->product_code;
+	slave_info->alias = (sc->position == 0) ? sc->alias : 0;
+	slave_info->al_state = atomic_load(&master->active) ? 8 : 1;
+	snprintf(slave_info->name, sizeof(slave_info->name), "Simulated ECT60");
+	return 0;
+}
+
+// Called by a non real time thread while the cyclic task exchanges frames
+int ecrt_master_sdo_download_complete(ec_master_t *master, uint16_t slave_position, uint16_t index,
+		uint8_t *data, size_t data_size, uint32_t *abort_code)
+{
+	sim_complete_request_t* complete;
+	struct timespec poll = {0, 100000};
+	int state = EC_REQUEST_BUSY;
+
+	*abort_code = 0;
+	if ((slave_position >= master->n_configs) || !atomic_load(&master->active))
+	{
+		return -EINVAL;
+	}
+	complete = &master->configs[slave_position].complete;
+	if (data_size > SIM_COMPLETE_MAX_SIZE)
+	{
+		return -EOVERFLOW;
+	}
+	if (atomic_load_explicit(&complete->state, memory_order_acquire) == EC_REQUEST_BUSY)
+	{
+		return -EBUSY;
+	}
+	complete->index = index;
+	memcpy(complete->data, data, data_size);
+	complete->size = data_size;
+	complete->busy_frames = SIM_SDO_FRAMES;
+	atomic_store_explicit(&complete->state, EC_REQUEST_BUSY, memory_order_release);
+	for (unsigned int i = 0; (i < SIM_COMPLETE_TIMEOUT_MS * 10) && (state == EC_REQUEST_BUSY); i++)
+	{
+		nanosleep(&poll, NULL);
+		state = atomic_load_explicit(&complete->state, memory_order_acquire);
+	}
+	if (state == EC_REQUEST_BUSY)
+	{
+		return -ETIMEDOUT;
+	}
+	*abort_code = complete->abort_code;
+	atomic_store_explicit(&complete->state, EC_REQUEST_UNUSED, memory_order_relaxed);
+	return (state == EC_REQUEST_SUCCESS) ? 0 : -EIO;
+}
+
+ec_domain_t *ecrt_master_create_domain(ec_master_t *master)
+{
+	ec_domain_t* domain;
+
+	if (master->n_domains == SIM_MAX_DOMAINS)
+	{
+		return NULL;
+	}
+	domain = &master->domains[master->n_domains++];
+	domain->master = master;
+	return domain;
+}
+
+ec_slave_config_t *ecrt_master_slave_config(ec_master_t *master, uint16_t alias,
+        uint16_t position, uint32_t vendor_id, uint32_t product_code)
+{
+	ec_slave_config_t* sc;
+
+	for (unsigned int i = 0; i < master->n_configs; i++)
+	{
+		if ((master->configs[i].alias == alias) && (master->configs[i].position == position))
+		{
+			return sim_find_config(master, alias, position, vendor_id, product_code);
+		}
+	}
+	if (master->n_configs == SIM_MAX_CONFIGS)
+	{
+		return NULL;
+	}
+	sc = &master->configs[master->n_configs++];
+	sc->master = master;
+	sc->alias = alias;
+	sc->position = position;
+	sc->vendor_id = vendor_id;
+	sc->product_code = product_code;
+	sim_drive_init(&sc->drive, &master->params.drive);
+	return sc;
+}
+
+int ecrt_master_activate(ec_master_t *master)
+{
+	for (unsigned int i = 0; i < master->n_domains; i++)
+	{
+		ec_domain_t* domain = &master->domains[i];
+
+		domain->data = calloc(1, domain->size ? domain->size : 1);
+		domain->frame = calloc(1, domain->size ? domain->size : 1);
+		if (!domain->data || !domain->frame)
+		{
+			return -ENOMEM;
+		}
+	}
+	atomic_store(&master->active, true);
+	return 0;
+}
+
+int ecrt_master_send(ec_master_t *master)
+{
+	uint64_t now_ns = sim_now_ns();
+	uint64_t cost_ns = master->params.send_cost_ns;
+	uint32_t sync0_cycle = master->n_configs ? master->configs[0].dc_sync0_cycle : 0;
+
+	if (master->last_send_ns && (now_ns - master->last_send_ns > master->longest_gap_ns))
+	{
+		master->longest_gap_ns = now_ns - master->last_send_ns;
+	}
+	master->last_send_ns = now_ns;
+	if ((now_ns > master->app_time_ns) && (now_ns - master->app_time_ns > master->longest_lag_ns))
+	{
+		master->longest_lag_ns = now_ns - master->app_time_ns;
+	}
+	if (sync0_cycle && (now_ns > master->app_time_ns + sync0_cycle))
+	{
+		master->late_frames++;
+	}
+
+	// Model the time the network driver needs to send the frame
+	if ((master->params.spike_every > 0) && (((master->frames + 1) % master->params.spike_every) == 0))
+		cost_ns += master->params.spike_ns;
+	while ((cost_ns > 0) && ((sim_now_ns() - now_ns) < cost_ns));
+
+	for (unsigned int i = 0; i < master->n_domains; i++)
+	{
+		ec_domain_t* domain = &master->domains[i];
+
+		if (!domain->queued)
+		{
+			continue;
+		}
+		memcpy(domain->frame, domain->data, domain->size);
+		domain->queued = false;
+		sim_sync0_frame(master, now_ns);
+		domain->frame_pending = true;
+		domain->frame_sent_ns = now_ns;
+	}
+	// The reference clock is read when the frame passes the first slave, half way of the round trip
+	if (master->sync_queued)
+	{
+		master->sync_frame_time = (uint32_t)sim_reference_clock(master, now_ns + master->params.frame_latency_ns / 2);
+		master->sync_queued = false;
+		master->sync_pending = true;
+	}
+	master->frames++;
+	return 0;
+}
+
+int ecrt_master_receive(ec_master_t *master)
+{
+	uint64_t now_ns = sim_now_ns();
+
+	for (unsigned int i = 0; i < master->n_domains; i++)
+	{
+		ec_domain_t* domain = &master->domains[i];
+		bool lost;
+
+		if (!domain->frame_pending)
+		{
+			continue;
+		}
+		domain->frame_pending = false;
+		// A frame not returned yet is considered lost like a timed out datagram
+		lost = (now_ns - domain->frame_sent_ns) < master->params.frame_latency_ns;
+		lost |= (master->params.wc_fault_every > 0) && ((master->frames % master->params.wc_fault_every) == 0);
+		lost |= (master->params.wc_fault_rate > 0.0) && (sim_random(master) < master->params.wc_fault_rate);
+		if (lost)
+		{
+			domain->received_wc = 0;
+		}
+		else
+		{
+			sim_domain_exchange(domain, now_ns);
+			domain->received_wc = domain->expected_wc;
+		}
+		domain->frame_received = true;
+	}
+	if (master->sync_pending)
+	{
+		master->sync_received_time = master->sync_frame_time;
+		master->sync_received = true;
+		master->sync_pending = false;
+	}
+	return 0;
+}
+
+int ecrt_master_state(const ec_master_t *master, ec_master_state_t *state)
+{
+	bool active = atomic_load(&((ec_master_t*)master)->active);
+
+	state->slaves_responding = master->n_configs;
+	state->al_states = active ? 0x08 : 0x01;
+	state->link_up = 1;
+	return 0;
+}
+
+int ecrt_master_application_time(ec_master_t *master, uint64_t app_time)
+{
+	master->app_time_ns = app_time;
+	// Like the master does on activation, SYNC0 starts on the grid of the application time
+	if (atomic_load(&master->active) && !master->sync0_base_set)
+	{
+		master->sync0_base_ns = app_time;
+		master->sync0_base_set = true;
+	}
+	// Like the master does on activation, the system time of the reference clock starts at the application time
+	if (!master->reference_set)
+	{
+		sim_set_reference_clock(master, app_time);
+	}
+	return 0;
+}
+
+int ecrt_master_sync_reference_clock(ec_master_t *master)
+{
+	sim_set_reference_clock(master, master->app_time_ns);
+	return 0;
+}
+
+int ecrt_master_sync_reference_clock_to(ec_master_t *master, uint64_t sync_time)
+{
+	sim_set_reference_clock(master, sync_time);
+	return 0;
+}
+
+int ecrt_master_sync_slave_clocks(ec_master_t *master)
+{
+	master->sync_queued = master->reference_set;
+	return 0;
+}
+
+int ecrt_master_reference_clock_time(ec_master_t *master, uint32_t *time)
+{
+	if (!master->sync_received)
+	{
+		return -EIO;
+	}
+	*time = master->sync_received_time;
+	return 0;
+}
+
+/****************************************************************************/
+
+int ecrt_slave_config_pdos(ec_slave_config_t *sc, unsigned int n_syncs,
+        const ec_sync_info_t syncs[])
+{
+	for (unsigned int i = 0; (i < n_syncs) && (syncs[i].index != 0xff); i++)
+	{
+		sim_sync_t* sync;
+		unsigned int bit_offset = 0;
+
+		if (syncs[i].index >= SIM_MAX_SYNCS)
+		{
+			return -EINVAL;
+		}
+		sync = &sc->syncs[syncs[i].index];
+		sync->configured = true;
+		sync->dir = syncs[i].dir;
+		sync->n_entries = 0;
+		for (unsigned int p = 0; p < syncs[i].n_pdos; p++)
+		{
+			const ec_pdo_info_t* pdo = &syncs[i].pdos[p];
+
+			for (unsigned int e = 0; e < pdo->n_entries; e++)
+			{
+				if (sync->n_entries == SIM_MAX_ENTRIES)
+				{
+					return -ENOMEM;
+				}
+				sync->entries[sync->n_entries].index = pdo->entries[e].index;
+				sync->entries[sync->n_entries].subindex = pdo->entries[e].subindex;
+				sync->entries[sync->n_entries].bit_length = pdo->entries[e].bit_length;
+				sync->entries[sync->n_entries].bit_offset = bit_offset;
+				bit_offset += pdo->entries[e].bit_length;
+				sync->n_entries++;
+			}
+		}
+		sync->size = (bit_offset + 7) / 8;
+	}
+	return 0;
+}
+
+int ecrt_slave_config_dc(ec_slave_config_t *sc, uint16_t assign_activate,
+        uint32_t sync0_cycle, int32_t sync0_shift, uint32_t sync1_cycle,
+        int32_t sync1_shift)
+{
+	(void)sync1_cycle;
+	(void)sync1_shift;
+	sc->dc_assign_activate = assign_activate;
+	sc->dc_sync0_cycle = sync0_cycle;
+	sc->dc_sync0_shift = sync0_shift;
+	return 0;
+}
+
+ec_sdo_request_t *ecrt_slave_config_create_sdo_request(ec_slave_config_t *sc,
+        uint16_t index, uint8_t subindex, size_t size)
+{
+	ec_sdo_request_t* req;
+
+	if ((sc->n_sdo_requests == SIM_MAX_SDO_REQUESTS) || (size > SIM_SDO_MAX_SIZE))
+	{
+		return NULL;
+	}
+	req = &sc->sdo_requests[sc->n_sdo_requests++];
+	req->sc = sc;
+	req->index = index;
+	req->subindex = subindex;
+	req->mem_size = size;
+	req->data_size = size;
+	req->state = EC_REQUEST_UNUSED;
+	return req;
+}
+
+ec_reg_request_t *ecrt_slave_config_create_reg_request(ec_slave_config_t *sc,
+        size_t size)
+{
+	ec_reg_request_t* req;
+
+	if ((sc->n_reg_requests == SIM_MAX_REG_REQUESTS) || (size > SIM_REG_MAX_SIZE))
+	{
+		return NULL;
+	}
+	req = &sc->reg_requests[sc->n_reg_requests++];
+	req->sc = sc;
+	req->mem_size = size;
+	req->state = EC_REQUEST_UNUSED;
+	return req;
+}
+
+/****************************************************************************/
+
+int ecrt_domain_reg_pdo_entry_list(ec_domain_t *domain,
+        const ec_pdo_entry_reg_t *pdo_entry_regs)
+{
+	for (const ec_pdo_entry_reg_t* reg = pdo_entry_regs; reg->index; reg++)
+	{
+		ec_slave_config_t* sc;
+		const sim_entry_t* entry;
+		sim_area_t* area = NULL;
+		unsigned int sync_index;
+
+		sc = ecrt_master_slave_config(domain->master, reg->alias, reg->position,
+				reg->vendor_id, reg->product_code);
+		if (!sc)
+		{
+			return -ENOENT;
+		}
+		entry = sim_find_entry(sc, reg->index, reg->subindex, &sync_index);
+		if (!entry)
+		{
+			fprintf(stderr, "PDO entry 0x%04X:%02X is not mapped in slave %u:%u.\n",
+					reg->index, reg->subindex, reg->alias, reg->position);
+			return -ENOENT;
+		}
+		// Like the IgH master, the process data of a sync manager is placed into the domain
+		// in the order of the first registration of one of its entries
+		for (unsigned int a = 0; a < domain->n_areas; a++)
+		{
+			if ((domain->areas[a].sc == sc) && (domain->areas[a].sync_index == sync_index))
+			{
+				area = &domain->areas[a];
+			}
+		}
+		if (!area)
+		{
+			if (domain->n_areas == SIM_MAX_AREAS)
+			{
+				return -ENOMEM;
+			}
+			area = &domain->areas[domain->n_areas++];
+			area->sc = sc;
+			area->sync_index = sync_index;
+			area->offset = domain->size;
+			domain->size += sc->syncs[sync_index].size;
+			// Logical read/write counts 1 for inputs and 2 for outputs
+			domain->expected_wc += (sc->syncs[sync_index].dir == EC_DIR_OUTPUT) ? 2 : 1;
+		}
+		*reg->offset = area->offset + (entry->bit_offset / 8);
+		if (reg->bit_position)
+		{
+			*reg->bit_position = entry->bit_offset % 8;
+		}
+		else if (entry->bit_offset % 8)
+		{
+			fprintf(stderr, "PDO entry 0x%04X:%02X is not byte aligned.\n", reg->index, reg->subindex);
+			return -EFAULT;
+		}
+	}
+	return 0;
+}
+
+size_t ecrt_domain_size(const ec_domain_t *domain)
+{
+	return domain->size;
+}
+
+uint8_t *ecrt_domain_data(ec_domain_t *domain)
+{
+	return domain->data;
+}
+
+int ecrt_domain_process(ec_domain_t *domain)
+{
+	unsigned int wc = 0;
+
+	if (domain->frame_received)
+	{
+		domain->frame_received = false;
+		wc = domain->received_wc;
+		// Like the datagram of the master the returned frame replaces the whole domain, the outputs
+		// included: they are those sent, not those written since
+		if (wc)
+		{
+			memcpy(domain->data, domain->frame, domain->size);
+		}
+	}
+	atomic_store_explicit(&domain->working_counter, wc, memory_order_relaxed);
+	atomic_store_explicit(&domain->wc_state, (wc == 0) ? EC_WC_ZERO :
+			((wc < domain->expected_wc) ? EC_WC_INCOMPLETE : EC_WC_COMPLETE), memory_order_relaxed);
+	return 0;
+}
+
+int ecrt_domain_queue(ec_domain_t *domain)
+{
+	domain->queued = true;
+	return 0;
+}
+
+int ecrt_domain_state(const ec_domain_t *domain, ec_domain_state_t *state)
+{
+	ec_domain_t* d = (ec_domain_t*)domain;
+
+	state->working_counter = atomic_load_explicit(&d->working_counter, memory_order_relaxed);
+	state->wc_state = atomic_load_explicit(&d->wc_state, memory_order_relaxed);
+	state->redundancy_active = 0;
+	return 0;
+}
+
+/****************************************************************************/
+
+int ecrt_sdo_request_index(ec_sdo_request_t *req, uint16_t index, uint8_t subindex)
+{
+	req->index = index;
+	req->subindex = subindex;
+	return 0;
+}
+
+int ecrt_sdo_request_timeout(ec_sdo_request_t *req, uint32_t timeout)
+{
+	req->timeout_ms = timeout;
+	return 0;
+}
+
+uint8_t *ecrt_sdo_request_data(ec_sdo_request_t *req)
+{
+	return req->data;
+}
+
+size_t ecrt_sdo_request_data_size(const ec_sdo_request_t *req)
+{
+	return req->data_size;
+}
+
+ec_request_state_t ecrt_sdo_request_state(ec_sdo_request_t *req)
+{
+	return req->state;
+}
+
+int ecrt_sdo_request_write(ec_sdo_request_t *req)
+{
+	req->write = true;
+	req->data_size = req->mem_size;
+	req->busy_frames = SIM_SDO_FRAMES;
+	req->state = EC_REQUEST_BUSY;
+	return 0;
+}
+
+int ecrt_sdo_request_read(ec_sdo_request_t *req)
+{
+	req->write = false;
+	req->busy_frames = SIM_SDO_FRAMES;
+	req->state = EC_REQUEST_BUSY;
+	return 0;
+}
+
+/****************************************************************************/
+
+uint8_t *ecrt_reg_request_data(ec_reg_request_t *req)
+{
+	return req->data;
+}
+
+ec_request_state_t ecrt_reg_request_state(const ec_reg_request_t *req)
+{
+	return req->state;
+}
+
+int ecrt_reg_request_write(ec_reg_request_t *req, uint16_t address, size_t size)
+{
+	if (size > req->mem_size)
+	{
+		return -EINVAL;
+	}
+	req->write = true;
+	req->address = address;
+	req->size = size;
+	req->busy_frames = SIM_SDO_FRAMES;
+	req->state = EC_REQUEST_BUSY;
+	return 0;
+}
+
+int ecrt_reg_request_read(ec_reg_request_t *req, uint16_t address, size_t size)
+{
+	if (size > req->mem_size)
+	{
+		return -EINVAL;
+	}
+	req->write = false;
+	req->address = address;
+	req->size = size;
+	req->busy_frames = SIM_SDO_FRAMES;
+	req->state = EC_REQUEST_BUSY;
+	return 0;
+}
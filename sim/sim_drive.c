@@ -0,0 +1,394 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "sim_drive.h"
+
+// The model is integrated in steps of at most this size
+#define SIM_DRIVE_MAX_STEP_S 0.000125
+// Error code reported in 0x603f for an injected fault
+#define SIM_DRIVE_ERROR_INJECTED 0xff00
+
+/****************************************************************************/
+
+static uint16_t sim_drive_statusword(sim_drive_t* drive)
+{
+	static const uint16_t state_bits[] = {
+		[SIM_CIA402_NOT_READY_TO_SWITCH_ON] = 0x0000,
+		[SIM_CIA402_SWITCH_ON_DISABLED] = 0x0040,
+		[SIM_CIA402_READY_TO_SWITCH_ON] = 0x0031,
+		[SIM_CIA402_SWITCHED_ON] = 0x0033,
+		[SIM_CIA402_OPERATION_ENABLED] = 0x0037,
+		[SIM_CIA402_QUICK_STOP_ACTIVE] = 0x0017,
+		[SIM_CIA402_FAULT] = 0x0008
+	};
+	uint16_t statusword = state_bits[drive->state] | 0x0200;	// remote
+
+	// Target reached in profile velocity mode
+	if ((drive->mode_display == 3) && (fabs(drive->velocity_demand - drive->target_velocity) < 1.0))
+	{
+		statusword |= 0x0400;
+	}
+	return statusword;
+}
+
+// Evaluates the controlword on every step. Returns the new state.
+static sim_cia402_state_t sim_drive_transition(sim_drive_t* drive)
+{
+	uint16_t cw = drive->controlword;
+	bool shutdown = (cw & 0x87) == 0x06;
+	bool switch_on = (cw & 0x8f) == 0x07;
+	bool enable_operation = (cw & 0x8f) == 0x0f;
+	bool disable_voltage = (cw & 0x82) == 0x00;
+	bool quick_stop = (cw & 0x86) == 0x02;
+	bool fault_reset = (cw & 0x80) && !(drive->last_controlword & 0x80);
+
+	switch (drive->state)
+	{
+	case SIM_CIA402_NOT_READY_TO_SWITCH_ON:
+		// Self test passed
+		return SIM_CIA402_SWITCH_ON_DISABLED;
+	case SIM_CIA402_SWITCH_ON_DISABLED:
+		if (shutdown)
+			return SIM_CIA402_READY_TO_SWITCH_ON;
+		// Like the original cycle with its constant controlword 0x1f expects, enable
+		// operation is accepted directly from here unless strict transitions are requested
+		if (enable_operation && !drive->params.strict)
+			return SIM_CIA402_OPERATION_ENABLED;
+		break;
+	case SIM_CIA402_READY_TO_SWITCH_ON:
+		if (disable_voltage || quick_stop)
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		if (switch_on)
+			return SIM_CIA402_SWITCHED_ON;
+		// Switch on and enable operation are passed through automatically
+		if (enable_operation)
+			return SIM_CIA402_OPERATION_ENABLED;
+		break;
+	case SIM_CIA402_SWITCHED_ON:
+		if (disable_voltage || quick_stop)
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		if (shutdown)
+			return SIM_CIA402_READY_TO_SWITCH_ON;
+		if (enable_operation)
+			return SIM_CIA402_OPERATION_ENABLED;
+		break;
+	case SIM_CIA402_OPERATION_ENABLED:
+		if (disable_voltage)
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		if (quick_stop)
+			return SIM_CIA402_QUICK_STOP_ACTIVE;
+		if (shutdown)
+			return SIM_CIA402_READY_TO_SWITCH_ON;
+		if (switch_on)
+			return SIM_CIA402_SWITCHED_ON;
+		break;
+	case SIM_CIA402_QUICK_STOP_ACTIVE:
+		if (disable_voltage)
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		// Quick stop is left after standstill
+		if (fabs(drive->velocity) < 1.0)
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		break;
+	case SIM_CIA402_FAULT:
+		if (fault_reset)
+		{
+			drive->error_code = 0;
+			return SIM_CIA402_SWITCH_ON_DISABLED;
+		}
+		break;
+	}
+	return drive->state;
+}
+
+// Ramps the velocity demand towards target with the given acceleration and deceleration
+static void sim_drive_ramp(sim_drive_t* drive, double target, double accel, double decel, double dt_s)
+{
+	double delta = target - drive->velocity_demand;
+	// Moving away from zero accelerates, moving towards zero decelerates
+	double rate = ((drive->velocity_demand * delta) >= 0.0) ? accel : decel;
+	double step = rate * dt_s;
+
+	if (fabs(delta) <= step)
+	{
+		drive->velocity_demand = target;
+	}
+	else
+	{
+		drive->velocity_demand += (delta > 0.0) ? step : -step;
+	}
+}
+
+static void sim_drive_integrate(sim_drive_t* drive, double dt_s)
+{
+	const sim_drive_params_t* p = &drive->params;
+	double torque = 0.0;
+
+	switch (drive->state)
+	{
+	case SIM_CIA402_OPERATION_ENABLED:
+		if (drive->mode_display == 9)
+		{
+			// Cyclic synchronous velocity, the target is the demand of every cycle
+			drive->velocity_demand = drive->target_velocity;
+		}
+		else if (drive->mode_display == 3)
+		{
+			sim_drive_ramp(drive, drive->target_velocity, drive->profile_acceleration,
+					drive->profile_deceleration, dt_s);
+		}
+		break;
+	case SIM_CIA402_QUICK_STOP_ACTIVE:
+		sim_drive_ramp(drive, 0.0, drive->profile_deceleration, drive->profile_deceleration, dt_s);
+		break;
+	default:
+		// Power stage is off, the load coasts
+		drive->velocity_demand = drive->velocity;
+		drive->integral = 0.0;
+		break;
+	}
+
+	if ((drive->state == SIM_CIA402_OPERATION_ENABLED) || (drive->state == SIM_CIA402_QUICK_STOP_ACTIVE))
+	{
+		double error = drive->velocity_demand - drive->velocity;
+
+		torque = p->kp * (error + drive->integral);
+		if (torque > p->torque_max)
+		{
+			torque = p->torque_max;
+		}
+		else if (torque < -p->torque_max)
+		{
+			torque = -p->torque_max;
+		}
+		else if (p->ti_s > 0.0)
+		{
+			// Integrate only if not limited (anti windup)
+			drive->integral += error * dt_s / p->ti_s;
+		}
+	}
+
+	if (torque != 0.0)
+	{
+		torque += p->ripple * sin(2.0 * M_PI * p->ripple_hz * drive->time_s);
+	}
+	drive->time_s += dt_s;
+	drive->velocity += ((torque / p->inertia) - (p->friction * drive->velocity)) * dt_s;
+	if (p->lag_s > 0.0)
+	{
+		drive->velocity_measured += (drive->velocity - drive->velocity_measured) * (dt_s / (p->lag_s + dt_s));
+	}
+	else
+	{
+		drive->velocity_measured = drive->velocity;
+	}
+}
+
+// Returns the storage of a vendor specific object, which is created on demand
+static sim_drive_object_t* sim_drive_vendor_object(sim_drive_t* drive, uint16_t index, uint8_t subindex, bool create)
+{
+	if ((index < 0x2000) || (index > 0x2fff))
+	{
+		return NULL;
+	}
+	for (unsigned int i = 0; i < drive->n_vendor_objects; i++)
+	{
+		if ((drive->vendor_objects[i].index == index) && (drive->vendor_objects[i].subindex == subindex))
+		{
+			return &drive->vendor_objects[i];
+		}
+	}
+	if (!create || (drive->n_vendor_objects == SIM_DRIVE_VENDOR_OBJECTS))
+	{
+		return NULL;
+	}
+	drive->vendor_objects[drive->n_vendor_objects].index = index;
+	drive->vendor_objects[drive->n_vendor_objects].subindex = subindex;
+	drive->vendor_objects[drive->n_vendor_objects].value = 0;
+	return &drive->vendor_objects[drive->n_vendor_objects++];
+}
+
+/****************************************************************************/
+
+void sim_drive_init(sim_drive_t* drive, const sim_drive_params_t* params)
+{
+	memset(drive, 0, sizeof(sim_drive_t));
+	drive->params = *params;
+	drive->state = SIM_CIA402_NOT_READY_TO_SWITCH_ON;
+	drive->statusword = sim_drive_statusword(drive);
+}
+
+// Advances the model by dt_s using the RX objects as currently set
+void sim_drive_step(sim_drive_t* drive, double dt_s)
+{
+	sim_cia402_state_t state = sim_drive_transition(drive);
+	double remaining_s = dt_s;
+
+	if (state != drive->state)
+	{
+		drive->state = state;
+		drive->enabled_time_s = 0.0;
+	}
+	drive->last_controlword = drive->controlword;
+
+	// Only the supported modes are taken over to the mode display
+	if ((drive->mode_of_operation == 3) || (drive->mode_of_operation == 9))
+	{
+		drive->mode_display = drive->mode_of_operation;
+	}
+
+	while (remaining_s > 0.0)
+	{
+		double step = (remaining_s > SIM_DRIVE_MAX_STEP_S) ? SIM_DRIVE_MAX_STEP_S : remaining_s;
+
+		sim_drive_integrate(drive, step);
+		remaining_s -= step;
+	}
+
+	if (drive->state == SIM_CIA402_OPERATION_ENABLED)
+	{
+		drive->enabled_time_s += dt_s;
+		if ((drive->params.fault_period_s > 0.0) && (drive->enabled_time_s >= drive->params.fault_period_s))
+		{
+			drive->state = SIM_CIA402_FAULT;
+			drive->error_code = SIM_DRIVE_ERROR_INJECTED;
+		}
+	}
+
+	drive->velocity_actual = (int32_t)lround(drive->velocity_measured);
+	drive->statusword = sim_drive_statusword(drive);
+}
+
+// Object dictionary access for process data and SDO transfers
+bool sim_drive_get_object(sim_drive_t* drive, uint16_t index, uint8_t subindex, uint32_t* value)
+{
+	sim_drive_object_t* object;
+
+	if ((index == SIM_DRIVE_KP_INDEX) && (subindex == 0))
+	{
+		*value = lround(drive->params.kp);
+		return true;
+	}
+	if ((index == SIM_DRIVE_TI_INDEX) && (subindex == 0))
+	{
+		*value = lround(drive->params.ti_s * 1e6);
+		return true;
+	}
+	if ((index != 0x2006) && (object = sim_drive_vendor_object(drive, index, subindex, true)))
+	{
+		*value = object->value;
+		return true;
+	}
+	if (subindex != 0)
+	{
+		return false;
+	}
+	switch (index)
+	{
+	case 0x2006: *value = drive->digital_outputs; break;
+	case 0x603f: *value = drive->error_code; break;
+	case 0x6040: *value = drive->controlword; break;
+	case 0x6041: *value = drive->statusword; break;
+	case 0x6060: *value = (uint8_t)drive->mode_of_operation; break;
+	case 0x6061: *value = (uint8_t)drive->mode_display; break;
+	case 0x606c: *value = (uint32_t)drive->velocity_actual; break;
+	case 0x6083: *value = drive->profile_acceleration; break;
+	case 0x6084: *value = drive->profile_deceleration; break;
+	case 0x60fd: *value = drive->digital_inputs; break;
+	case 0x60ff: *value = (uint32_t)drive->target_velocity; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+bool sim_drive_set_object(sim_drive_t* drive, uint16_t index, uint8_t subindex, uint32_t value)
+{
+	sim_drive_object_t* object;
+
+	// The gains take effect immediately, the integral is kept
+	if ((index == SIM_DRIVE_KP_INDEX) && (subindex == 0))
+	{
+		drive->params.kp = value;
+		return true;
+	}
+	if ((index == SIM_DRIVE_TI_INDEX) && (subindex == 0))
+	{
+		drive->params.ti_s = value * 1e-6;
+		return true;
+	}
+	if ((index != 0x2006) && (object = sim_drive_vendor_object(drive, index, subindex, true)))
+	{
+		object->value = value;
+		return true;
+	}
+	if (subindex != 0)
+	{
+		return false;
+	}
+	switch (index)
+	{
+	case 0x2006: drive->digital_outputs = value; break;
+	case 0x6040: drive->controlword = value; break;
+	case 0x6060: drive->mode_of_operation = (int8_t)value; break;
+	case 0x6083: drive->profile_acceleration = value; break;
+	case 0x6084: drive->profile_deceleration = value; break;
+	case 0x60ff: drive->target_velocity = (int32_t)value; break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Download of a vendor specific object by complete access: subindex 0 as one byte padded to 16 bits,
+// followed by subindexes 1 .. n packed. The types of the subindexes are not modelled, so the data
+// has to split into n entries of equal size like an array. Returns 0 or the SDO abort code.
+uint32_t sim_drive_set_complete(sim_drive_t* drive, uint16_t index, const uint8_t* data, size_t size)
+{
+	unsigned int n, entry_size;
+	sim_drive_object_t* object;
+
+	if (!drive->params.complete_access || (index < 0x2000) || (index > 0x2fff) || (index == 0x2006))
+	{
+		return SIM_DRIVE_ABORT_UNSUPPORTED;
+	}
+	if ((size < 2) || ((n = data[0]) == 0) || ((size - 2) % n != 0))
+	{
+		return SIM_DRIVE_ABORT_LENGTH;
+	}
+	entry_size = (size - 2) / n;
+	if ((entry_size != 1) && (entry_size != 2) && (entry_size != 4))
+	{
+		return SIM_DRIVE_ABORT_LENGTH;
+	}
+	for (unsigned int s = 0; s <= n; s++)
+	{
+		uint32_t value = 0;
+
+		if (!(object = sim_drive_vendor_object(drive, index, s, true)))
+		{
+			return SIM_DRIVE_ABORT_NOT_EXISTING;
+		}
+		for (unsigned int b = 0; (s > 0) && (b < entry_size); b++)
+		{
+			value |= (uint32_t)data[2 + (s - 1) * entry_size + b] << (8 * b);
+		}
+		object->value = s ? value : n;
+	}
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIM_DRIVE_H_
+#define SIM_DRIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Model of a Rtelligent ECT60 servo drive as seen through its CiA402 objects.
+// The velocity loop is a PI controller with torque limit acting on a rigid inertia with
+// viscous friction, the actual velocity 0x606c is reported through a first order lag.
+
+typedef struct
+{
+	double inertia;			// Load inertia relative to the nominal motor inertia
+	double lag_s;			// Time constant of the velocity measurement
+	double kp;				// Proportional gain of the velocity loop [1/s]
+	double ti_s;			// Integral time of the velocity loop
+	double torque_max;		// Torque limit as acceleration of the nominal inertia [units/s^2]
+	double friction;		// Viscous friction [1/s]
+	double ripple;			// Amplitude of a sinusoidal torque disturbance [units/s^2], e.g. cogging
+	double ripple_hz;		// Frequency of the torque disturbance
+	double fault_period_s;	// Inject a fault after this time in operation enabled, 0 disables
+	bool complete_access;	// Vendor specific objects can be downloaded by complete access
+	bool strict;			// Only accept the transitions of the CiA402 state machine
+}sim_drive_params_t;
+
+typedef enum
+{
+	SIM_CIA402_NOT_READY_TO_SWITCH_ON = 0,
+	SIM_CIA402_SWITCH_ON_DISABLED,
+	SIM_CIA402_READY_TO_SWITCH_ON,
+	SIM_CIA402_SWITCHED_ON,
+	SIM_CIA402_OPERATION_ENABLED,
+	SIM_CIA402_QUICK_STOP_ACTIVE,
+	SIM_CIA402_FAULT
+}sim_cia402_state_t;
+
+// Vendor specific objects of the velocity loop gains, see autotune.h
+#define SIM_DRIVE_KP_INDEX 0x2101		// Proportional gain [1/s]
+#define SIM_DRIVE_TI_INDEX 0x2102		// Integral time [us]
+
+// SDO abort codes
+#define SIM_DRIVE_ABORT_UNSUPPORTED 0x06010000
+#define SIM_DRIVE_ABORT_NOT_EXISTING 0x06020000
+#define SIM_DRIVE_ABORT_LENGTH 0x06070010
+
+// Number of vendor specific objects (0x2000..0x2fff) which can be stored by SDO transfers
+#define SIM_DRIVE_VENDOR_OBJECTS 128
+
+typedef struct
+{
+	uint16_t index;
+	uint8_t subindex;
+	uint32_t value;
+}sim_drive_object_t;
+
+typedef struct
+{
+	sim_drive_params_t params;
+	sim_cia402_state_t state;
+	// RX objects
+	uint16_t controlword;			// 0x6040
+	int8_t mode_of_operation;		// 0x6060
+	uint32_t profile_acceleration;	// 0x6083
+	uint32_t profile_deceleration;	// 0x6084
+	int32_t target_velocity;		// 0x60ff
+	uint16_t digital_outputs;		// 0x2006
+	// TX objects
+	uint16_t statusword;			// 0x6041
+	int8_t mode_display;			// 0x6061
+	int32_t velocity_actual;		// 0x606c
+	uint32_t digital_inputs;		// 0x60fd
+	uint16_t error_code;			// 0x603f
+	// Model state
+	uint16_t last_controlword;
+	double velocity_demand;			// Output of the profile generator
+	double velocity;				// Velocity of the load
+	double velocity_measured;		// Lagged velocity as reported in 0x606c
+	double integral;
+	double enabled_time_s;
+	double time_s;					// Time of the model, phase of the torque disturbance
+	// Storage of vendor specific objects
+	sim_drive_object_t vendor_objects[SIM_DRIVE_VENDOR_OBJECTS];
+	unsigned int n_vendor_objects;
+}sim_drive_t;
+
+void sim_drive_init(sim_drive_t* drive, const sim_drive_params_t* params);
+void sim_drive_step(sim_drive_t* drive, double dt_s);
+bool sim_drive_get_object(sim_drive_t* drive, uint16_t index, uint8_t subindex, uint32_t* value);
+bool sim_drive_set_object(sim_drive_t* drive, uint16_t index, uint8_t subindex, uint32_t value);
+uint32_t sim_drive_set_complete(sim_drive_t* drive, uint16_t index, const uint8_t* data, size_t size);
+
+#endif /* SIM_DRIVE_H_ */
@@ -0,0 +1,140 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "cycle_stats.h"
+#include "sync0_shift.h"
+
+/****************************************************************************/
+
+void sync0_run_start(sync0_run_t* run, uint32_t period_ns, bool send_first)
+{
+	run->count = 0;
+	run->period_ns = period_ns;
+	run->send_first = send_first;
+	run->app_time_ns = 0;
+}
+
+void sync0_shift_evaluate(const sync0_run_t* run, int32_t shift_ns, uint32_t delay_ns, sync0_result_t* result)
+{
+	static cycle_hist_t frame_hist, sent_hist;
+	int64_t period = run->period_ns;
+	int64_t phase = ((shift_ns % period) + period) % period;
+	double latency_sum = 0.0;
+	unsigned long latencies = 0;
+
+	memset(result, 0, sizeof(sync0_result_t));
+	memset(&frame_hist, 0, sizeof(frame_hist));
+	memset(&sent_hist, 0, sizeof(sent_hist));
+	frame_hist.min = UINT32_MAX;
+	sent_hist.min = UINT32_MAX;
+	result->frame_max_ns = INT32_MIN;
+
+	// The last sample has no frame result
+	for (unsigned long i = 0; i + 1 < run->count; i++)
+	{
+		const sync0_sample_t* sample = &run->samples[i];
+		int64_t ready, event, written;
+
+		cycle_hist_record(&sent_hist, sample->sent_ns);
+		if (!sample->wc_complete)
+		{
+			result->wc_incomplete++;
+		}
+		if (!sample->frame_valid)
+		{
+			continue;
+		}
+		result->frames++;
+		cycle_hist_record(&frame_hist, (sample->frame_ns > 0) ? sample->frame_ns : 0);
+		if (sample->frame_ns > result->frame_max_ns)
+		{
+			result->frame_max_ns = sample->frame_ns;
+		}
+
+		// First SYNC0 event after the outputs are valid in the last slave
+		ready = (int64_t)sample->frame_ns + delay_ns;
+		event = phase;
+		if (ready > phase)
+		{
+			event += ((ready - phase + period - 1) / period) * period;
+			result->late++;
+			if (ready >= period)
+			{
+				result->overrun++;
+			}
+		}
+		// In send-first layout the frame carries the outputs written in the cycle before
+		if (run->send_first)
+		{
+			if (i == 0)
+			{
+				continue;
+			}
+			written = (int64_t)run->samples[i - 1].written_ns - period;
+		}
+		else
+		{
+			written = sample->written_ns;
+		}
+		latency_sum += event - written;
+		latencies++;
+		if (event - written > result->latency_max_ns)
+		{
+			result->latency_max_ns = event - written;
+		}
+	}
+	if (result->frames)
+	{
+		result->frame_p999_ns = cycle_hist_percentile(&frame_hist, 99.9);
+	}
+	else
+	{
+		result->frame_max_ns = 0;
+	}
+	if (sent_hist.count)
+	{
+		result->sent_p999_ns = cycle_hist_percentile(&sent_hist, 99.9);
+	}
+	result->latency_mean_ns = latencies ? latency_sum / latencies : 0.0;
+}
+
+int32_t sync0_shift_select(const sync0_run_t* run, uint32_t delay_ns, uint32_t margin_ns, double percentile)
+{
+	static cycle_hist_t frame_hist;
+	int64_t shift;
+
+	memset(&frame_hist, 0, sizeof(frame_hist));
+	frame_hist.min = UINT32_MAX;
+	for (unsigned long i = 0; i + 1 < run->count; i++)
+	{
+		const sync0_sample_t* sample = &run->samples[i];
+
+		if (sample->frame_valid && ((int64_t)sample->frame_ns + delay_ns < run->period_ns))
+		{
+			cycle_hist_record(&frame_hist, (sample->frame_ns > 0) ? sample->frame_ns : 0);
+		}
+	}
+	if (frame_hist.count == 0)
+	{
+		return -1;
+	}
+	shift = (int64_t)cycle_hist_percentile(&frame_hist, percentile) + delay_ns + margin_ns;
+	shift = ((shift + SYNC0_SHIFT_STEP_NS - 1) / SYNC0_SHIFT_STEP_NS) * SYNC0_SHIFT_STEP_NS;
+	return (shift < run->period_ns) ? (int32_t)shift : -1;
+}
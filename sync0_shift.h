@@ -0,0 +1,134 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNC0_SHIFT_H_
+#define SYNC0_SHIFT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Calibration of the SYNC0 shift. SYNC0 fires periodically, so only the shift modulo the period
+// (its phase) matters: the drives apply the outputs of a frame at the first SYNC0 event after the
+// frame has passed them. The dead time from writing a setpoint until the drive applies it is the
+// phase of SYNC0 minus the time the setpoint was written within the cycle, plus a period if the
+// frame is sent in the next cycle or passes the drive too late.
+//
+// Every cycle of a run records when the outputs were written and the frame was sent relative to
+// the wakeup, and when the frame passed the reference clock relative to the application time of
+// its cycle. The latter is read back from the reference clock by the sync datagram of the frame
+// and is the time of the frame on the clock SYNC0 is generated from. Any shift is evaluated on
+// these samples afterwards: a frame is late if it passes the reference clock later than the phase
+// minus the delay to the last slave, its system time difference and calc and copy time.
+#define SYNC0_SHIFT_CAL_SECONDS 2
+// The shift covers this percentile of the frames within the period, by default all of them. A lower
+// one keeps a single late wakeup from pushing the phase of SYNC0 and so the dead time of every cycle
+// towards a whole period. The verification accepts late frames up to the share left out.
+#define SYNC0_SHIFT_PERCENTILE_DEFAULT 100.0
+// Added to the percentile of the frames for the jitter not covered by the run
+#define SYNC0_SHIFT_MARGIN_NS_DEFAULT 25000
+// The shift is selected in steps of
+#define SYNC0_SHIFT_STEP_NS 1000
+
+typedef struct
+{
+	int32_t frame_ns;			// Frame at the reference clock - application time, valid if frame_valid
+	uint32_t written_ns;		// Outputs written, from the wakeup
+	uint32_t sent_ns;			// Frame sent, from the wakeup
+	bool frame_valid;
+	bool wc_complete;
+}sync0_sample_t;
+
+typedef struct
+{
+	sync0_sample_t* samples;	// Allocated by the caller before the cycle starts
+	unsigned long capacity;
+	unsigned long count;		// The last sample has no frame result yet
+	uint32_t period_ns;
+	bool send_first;			// Outputs of a cycle are sent with the frame of the next
+	uint64_t app_time_ns;		// Of the current cycle
+}sync0_run_t;
+
+typedef struct
+{
+	unsigned long frames;
+	unsigned long late;			// Passed the slaves after the SYNC0 event of their cycle
+	unsigned long overrun;		// Of these later than a period, late with any shift
+	unsigned long wc_incomplete;
+	int32_t frame_p999_ns;
+	int32_t frame_max_ns;
+	uint32_t sent_p999_ns;
+	double latency_mean_ns;		// Outputs written until applied at SYNC0
+	uint32_t latency_max_ns;
+}sync0_result_t;
+
+void sync0_run_start(sync0_run_t* run, uint32_t period_ns, bool send_first);
+
+// Called by cyclic_task after receiving with the reference clock read by the frame of the last
+// cycle, then once the outputs are written and once the frame is sent. Constant time.
+static inline void sync0_run_received(sync0_run_t* run, uint64_t app_time_ns, bool reference_valid,
+		uint32_t reference_time, bool wc_complete)
+{
+	if (run->count == run->capacity)
+	{
+		return;
+	}
+	if (run->count)
+	{
+		sync0_sample_t* last = &run->samples[run->count - 1];
+		int64_t half = run->period_ns / 2;
+		int64_t frame = (int32_t)(reference_time - (uint32_t)run->app_time_ns) - (int64_t)last->sent_ns;
+
+		// Whole periods are ambiguous, the frame passes the reference clock shortly after it was sent
+		// even if the cycle woke up late
+		last->frame_ns = last->sent_ns + ((((frame + half) % run->period_ns) + run->period_ns) % run->period_ns) - half;
+		last->frame_valid = reference_valid;
+		last->wc_complete = wc_complete;
+	}
+	run->samples[run->count++] = (sync0_sample_t){0};
+	run->app_time_ns = app_time_ns;
+}
+
+static inline void sync0_run_written(sync0_run_t* run, uint32_t written_ns)
+{
+	if (run->count)
+	{
+		run->samples[run->count - 1].written_ns = written_ns;
+	}
+}
+
+static inline void sync0_run_sent(sync0_run_t* run, uint32_t sent_ns)
+{
+	if (run->count)
+	{
+		run->samples[run->count - 1].sent_ns = sent_ns;
+	}
+}
+
+// Evaluates the run for the shift. delay_ns is the time after passing the reference clock until
+// the outputs are valid in the last slave.
+void sync0_shift_evaluate(const sync0_run_t* run, int32_t shift_ns, uint32_t delay_ns, sync0_result_t* result);
+// Smallest shift within one period the percentile of the frames of the run are in time with, plus
+// the margin. Frames later than a period, e.g. of a cycle woken up too late, are left out.
+// Returns -1 if the frames are too late within the period for any shift.
+int32_t sync0_shift_select(const sync0_run_t* run, uint32_t delay_ns, uint32_t margin_ns, double percentile);
+// Decodes the system time difference register 0x092C, the sign is bit 31
+static inline int32_t sync0_time_difference(uint32_t reg)
+{
+	return (reg & 0x80000000U) ? -(int32_t)(reg & 0x7fffffffU) : (int32_t)reg;
+}
+
+#endif /* SYNC0_SHIFT_H_ */
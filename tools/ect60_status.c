@@ -0,0 +1,60 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Polls the process image published by ECT60ctrl -H and prints the master and domain state
+// and the values of every axis, once or at the given interval.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "process_image.h"
+
+int main(int argc, char **argv)
+{
+    process_image_shm_t *shm;
+    static process_image_t image;
+    unsigned long interval_ms = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0;
+    struct timespec interval = {interval_ms / 1000, (interval_ms % 1000) * 1000000};
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [interval_ms]\n", argv[0]);
+        return -1;
+    }
+    if (!(shm = process_image_attach())) {
+        fprintf(stderr, "No process image of version %u, is ECT60ctrl running with -H?\n", PROCESS_IMAGE_VERSION);
+        return -1;
+    }
+    do {
+        if (!process_image_read(shm, &image)) {
+            fprintf(stderr, "No consistent snapshot\n");
+        } else {
+            printf("cycle %" PRIu64 " slaves %u al 0x%02x link %s wc %u state %u\n", image.cycle,
+                    image.slaves_responding, image.al_states, image.link_up ? "up" : "down",
+                    image.working_counter, image.wc_state);
+            for (uint32_t a = 0; (a < image.axes) && (a < PROCESS_IMAGE_MAX_AXES); a++) {
+                const process_image_axis_t *axis = &image.axis[a];
+
+                printf("  axis %2u statusword 0x%04x mode %d velocity %8d demand %8d inputs 0x%08x\n", a + 1,
+                        axis->statusword, axis->mode_display, axis->velocity_actual, axis->velocity_demand,
+                        axis->digital_inputs);
+            }
+            fflush(stdout);
+        }
+    } while (interval_ms && (clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, NULL) == 0));
+    return 0;
+}
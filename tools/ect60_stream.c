@@ -0,0 +1,207 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Streams a velocity trajectory to ECT60ctrl -x socket, one entry per cycle: a sine of the given
+// amplitude and period, or the velocities read from stdin, one line of whitespace separated values
+// per cycle. The queue of ECT60ctrl is kept filled by lead_ms ahead of the cycle.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "cmd_stream.h"
+
+static union
+{
+    cmd_stream_batch_t batch;
+    uint8_t bytes[sizeof(cmd_stream_batch_t) + CMD_STREAM_BATCH_MAX * sizeof(cmd_stream_entry_t)];
+} message;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec time = {ns / 1000000000ULL, ns % 1000000000ULL};
+
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &time, NULL);
+}
+
+// Sends the batch and waits for its ack
+static int exchange(int fd, unsigned int count, uint32_t flags, uint64_t start_ns, cmd_stream_ack_t *ack)
+{
+    size_t size = sizeof(cmd_stream_batch_t) + count * sizeof(cmd_stream_entry_t);
+
+    message.batch = (cmd_stream_batch_t){CMD_STREAM_MAGIC, CMD_STREAM_VERSION, count, flags, 0, now_ns(), start_ns};
+    if ((send(fd, &message, size, 0) != (ssize_t)size) || (recv(fd, ack, sizeof(*ack), 0) != sizeof(*ack)) ||
+            (ack->magic != CMD_STREAM_MAGIC)) {
+        perror("command stream exchange failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-n axes] [-m mode] [-l lead_ms] [-b batch] [-t seconds] [amplitude [period_ms]]\n"
+            "  -s socket   Socket of ECT60ctrl -x (default %s)\n"
+            "  -n axes     Axes enabled and streamed (default 1)\n"
+            "  -m mode     Mode of operation (default 9)\n"
+            "  -l lead_ms  Time the queue is kept filled ahead of the cycle (default 50)\n"
+            "  -b batch    Entries per batch (default 10)\n"
+            "  -t seconds  Duration of the sine (default 10)\n"
+            "Without amplitude one line of velocities per cycle is read from stdin.\n", name,
+            CMD_STREAM_SOCKET_DEFAULT);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    const char *path = CMD_STREAM_SOCKET_DEFAULT;
+    unsigned int axes = 1, batch_size = 10, lead_ms = 50, lead, count;
+    int mode = 9, opt, fd;
+    double seconds = 10.0, amplitude = 0.0, period_ms = 1000.0;
+    bool from_stdin, end = false;
+    unsigned long cycle = 0, cycles, batches = 0, full = 0;
+    uint64_t start_ns;
+    cmd_stream_ack_t ack;
+    cmd_stream_entry_t *entries = (cmd_stream_entry_t *)(message.bytes + sizeof(cmd_stream_batch_t));
+    char line[1024];
+
+    while ((opt = getopt(argc, argv, "s:n:m:l:b:t:h")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'n':
+            axes = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            mode = atoi(optarg);
+            break;
+        case 'l':
+            lead_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch_size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    from_stdin = (optind >= argc);
+    if (!from_stdin)
+        amplitude = atof(argv[optind]);
+    if (optind + 1 < argc)
+        period_ms = atof(argv[optind + 1]);
+    if ((axes < 1) || (axes > CMD_STREAM_MAX_AXES) || (batch_size < 1) || (batch_size > CMD_STREAM_BATCH_MAX) ||
+            (strlen(path) >= sizeof(addr.sun_path))) {
+        usage(argv[0]);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if (((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)) {
+        perror("connect to command stream failed");
+        return -1;
+    }
+    // The period is taken from the answer to an empty batch
+    if (exchange(fd, 0, 0, 0, &ack))
+        return -1;
+    lead = (lead_ms * 1000000ULL) / ack.period_ns;
+    if (lead < batch_size)
+        lead = batch_size;
+    cycles = lround(seconds * 1e9 / ack.period_ns);
+    // The stream starts when the lead is queued
+    start_ns = now_ns() + (uint64_t)lead * ack.period_ns;
+
+    while (!end) {
+        for (count = 0; (count < batch_size) && !end; count++, cycle++) {
+            cmd_stream_entry_t *entry = &entries[count];
+
+            memset(entry, 0, sizeof(*entry));
+            entry->enable_mask = (1U << axes) - 1;
+            for (unsigned int a = 0; a < axes; a++)
+                entry->mode_of_operation[a] = mode;
+            if (from_stdin) {
+                char *next = line;
+
+                if (!fgets(line, sizeof(line), stdin)) {
+                    // The last entry keeps the axes at rest
+                    end = true;
+                    break;
+                }
+                for (unsigned int a = 0; a < axes; a++)
+                    entry->velocity_setpoint[a] = strtol(next, &next, 0);
+            } else if (cycle < cycles) {
+                for (unsigned int a = 0; a < axes; a++)
+                    entry->velocity_setpoint[a] = lround(amplitude * sin(2.0 * M_PI * cycle * (ack.period_ns / 1e6) / period_ms));
+            } else {
+                end = true;
+                break;
+            }
+        }
+        if (end) {
+            // One entry at rest ends the stream
+            memset(&entries[count], 0, sizeof(entries[count]));
+            entries[count].enable_mask = (1U << axes) - 1;
+            for (unsigned int a = 0; a < axes; a++)
+                entries[count].mode_of_operation[a] = mode;
+            count++;
+        }
+        for (;;) {
+            if (exchange(fd, count, end ? CMD_STREAM_FLAG_END : 0, batches ? 0 : start_ns, &ack))
+                return -1;
+            if (ack.status == CMD_STREAM_OK)
+                break;
+            if (ack.status != CMD_STREAM_FULL) {
+                fprintf(stderr, "batch refused, status %u\n", ack.status);
+                return -1;
+            }
+            full++;
+            sleep_ns((uint64_t)count * ack.period_ns);
+        }
+        batches++;
+        // Keep the queue filled by the lead
+        if (ack.depth > lead)
+            sleep_ns((uint64_t)(ack.depth - lead) * ack.period_ns);
+    }
+    // Wait until the stream has been played
+    do {
+        sleep_ns((uint64_t)(ack.depth + 1) * ack.period_ns);
+        if (exchange(fd, 0, 0, 0, &ack))
+            return -1;
+    } while (ack.depth);
+    printf("%lu entries in %lu batches, %lu times full, applied %llu, underrun cycles %llu, state %u\n",
+            cycle, batches, full, (unsigned long long)ack.applied, (unsigned long long)ack.underrun_cycles, ack.state);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Converts a recording of ECT60ctrl -r into CSV. Only the records of the trigger window are
+// written if the recording was triggered, otherwise all records in the ring. Times are relative
+// to the trigger record or to the first record written.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pdo_recorder.h"
+
+int main(int argc, char **argv)
+{
+    const pdo_recorder_header_t *header;
+    const uint8_t *records;
+    uint64_t written, trigger, first, last, origin_ns;
+    struct stat st;
+    FILE *out = stdout;
+    int fd;
+
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "Usage: %s recording [output.csv]\n", argv[0]);
+        return -1;
+    }
+    fd = open(argv[1], O_RDONLY);
+    if ((fd == -1) || (fstat(fd, &st) == -1)) {
+        perror(argv[1]);
+        return -1;
+    }
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (((size_t)st.st_size < PDO_RECORDER_HEADER_SIZE) || (header->magic != PDO_RECORDER_MAGIC) ||
+            (header->version != PDO_RECORDER_VERSION) ||
+            ((size_t)st.st_size < PDO_RECORDER_HEADER_SIZE + header->capacity * header->record_size)) {
+        fprintf(stderr, "%s is no recording of version %u\n", argv[1], PDO_RECORDER_VERSION);
+        return -1;
+    }
+    records = (const uint8_t *)header + PDO_RECORDER_HEADER_SIZE;
+
+    written = atomic_load_explicit(&header->written, memory_order_acquire);
+    trigger = atomic_load_explicit(&header->trigger_record, memory_order_relaxed);
+    first = (written > header->capacity) ? (written - header->capacity) : 0;
+    last = written;
+    if (trigger && ((trigger - 1) > header->pre_trigger) && ((trigger - 1 - header->pre_trigger) > first)) {
+        first = trigger - 1 - header->pre_trigger;
+    }
+    if (!atomic_load_explicit(&header->stopped, memory_order_relaxed) && (written >= header->capacity)) {
+        // Still recording into a wrapped ring, keep a margin to the records overwritten while converting
+        first += header->capacity / 10;
+        if (first > last)
+            first = last;
+    }
+    if (first == last) {
+        fprintf(stderr, "%s contains no records\n", argv[1]);
+        return -1;
+    }
+
+    if ((argc == 3) && !(out = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        return -1;
+    }
+    fprintf(out, "cycle,time_us,latency_ns");
+    for (uint32_t a = 1; a <= header->axes; a++) {
+        fprintf(out, ",statusword_%u,mode_display_%u,velocity_actual_%u,digital_inputs_%u,target_velocity_%u",
+                a, a, a, a, a);
+    }
+    fprintf(out, "\n");
+
+    origin_ns = ((const pdo_record_t *)(records + ((trigger ? trigger - 1 : first) % header->capacity) *
+            header->record_size))->wakeup_ns;
+    for (uint64_t n = first; n < last; n++) {
+        const pdo_record_t *record = (const pdo_record_t *)(records + (n % header->capacity) * header->record_size);
+
+        fprintf(out, "%" PRIu64 ",%.3f,%" PRId64, record->cycle,
+                ((int64_t)(record->wakeup_ns - origin_ns)) / 1000.0, (int64_t)(record->start_ns - record->wakeup_ns));
+        for (uint32_t a = 0; a < header->axes; a++) {
+            const pdo_record_axis_t *axis = &record->axis[a];
+
+            fprintf(out, ",0x%04x,%d,%d,0x%08x,%d", axis->statusword, axis->mode_display,
+                    axis->velocity_actual, axis->digital_inputs, axis->target_velocity);
+        }
+        fprintf(out, "\n");
+    }
+    if (out != stdout)
+        fclose(out);
+
+    fprintf(stderr, "%" PRIu64 " records%s\n", last - first, trigger ? " around trigger" : "");
+    return 0;
+}
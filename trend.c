@@ -0,0 +1,72 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <ecrt.h>
+#include "trend.h"
+
+/****************************************************************************/
+
+void trend_init(trend_t* trend, unsigned int cycle_hz)
+{
+	memset(trend, 0, sizeof(trend_t));
+	trend->samples_per_bin = ((uint64_t)cycle_hz * TREND_SPAN_MS + (TREND_BINS * 1000 / 2)) / (TREND_BINS * 1000);
+	if (trend->samples_per_bin == 0)
+	{
+		trend->samples_per_bin = 1;
+	}
+}
+
+// The bins are mapped to the columns anew for every call, so a changed width only re-bins the history
+void trend_columns(const trend_t* trend, unsigned int axis, trend_series_t series, unsigned int columns,
+		int32_t* min, int32_t* max, int32_t* range_min, int32_t* range_max)
+{
+	const trend_axis_t* history = &trend->axis[axis];
+	// Bins not completed yet are at the oldest end of the span
+	unsigned long missing = (history->completed < TREND_BINS) ? TREND_BINS - history->completed : 0;
+
+	*range_min = INT32_MAX;
+	*range_max = INT32_MIN;
+	for (unsigned int c = 0; c < columns; c++)
+	{
+		unsigned long first = ((unsigned long)c * TREND_BINS) / columns;
+		unsigned long last = ((unsigned long)(c + 1) * TREND_BINS) / columns;
+
+		// A column narrower than a bin shows the bin it lies in
+		if (last == first)
+		{
+			last = first + 1;
+		}
+		min[c] = INT32_MAX;
+		max[c] = INT32_MIN;
+		for (unsigned long b = (first > missing) ? first : missing; b < last; b++)
+		{
+			// Bin b of the span, 0 is the oldest
+			const trend_bin_t* bin = &history->bins[(history->completed + b) % TREND_BINS];
+
+			if (bin->min[series] < min[c])
+				min[c] = bin->min[series];
+			if (bin->max[series] > max[c])
+				max[c] = bin->max[series];
+		}
+		if (min[c] < *range_min)
+			*range_min = min[c];
+		if (max[c] > *range_max)
+			*range_max = max[c];
+	}
+}
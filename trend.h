@@ -0,0 +1,88 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREND_H_
+#define TREND_H_
+
+#include <stdint.h>
+#include "servo_gui.h"
+
+// History of the velocity demand, the actual velocity and the following error of every axis for
+// the trend plot of the gui. Every sample drained from the ring updates min and max of the current
+// bin of its axis, a bin covers a fixed time of TREND_SPAN_MS / TREND_BINS. The completed bins are
+// kept in a ring of fixed size. A plot column merges the bins it covers, so a spike of a single
+// cycle is never lost and drawing costs the same at any cycle rate and for any plot width.
+#define TREND_BINS 1024
+#define TREND_SPAN_MS 10000
+
+typedef enum
+{
+	TREND_DEMAND = 0,			// 0x60ff as written
+	TREND_ACTUAL,				// 0x606c
+	TREND_ERROR,				// Demand - actual
+	TREND_SERIES
+}trend_series_t;
+
+typedef struct
+{
+	int32_t min[TREND_SERIES];
+	int32_t max[TREND_SERIES];
+}trend_bin_t;
+
+typedef struct
+{
+	trend_bin_t bins[TREND_BINS];
+	unsigned long completed;	// Bins completed, the newest is bins[(completed - 1) % TREND_BINS]
+	trend_bin_t current;
+	unsigned int samples;		// Samples in the current bin
+}trend_axis_t;
+
+typedef struct
+{
+	unsigned int samples_per_bin;
+	trend_axis_t axis[MAX_AXES];
+}trend_t;
+
+void trend_init(trend_t* trend, unsigned int cycle_hz);
+
+// Adds the sample of one cycle of an axis
+static inline void trend_add(trend_t* trend, unsigned int axis, int32_t demand, int32_t actual)
+{
+	trend_axis_t* history = &trend->axis[axis];
+	int32_t values[TREND_SERIES] = {demand, actual, demand - actual};
+
+	for (unsigned int s = 0; s < TREND_SERIES; s++)
+	{
+		if ((history->samples == 0) || (values[s] < history->current.min[s]))
+			history->current.min[s] = values[s];
+		if ((history->samples == 0) || (values[s] > history->current.max[s]))
+			history->current.max[s] = values[s];
+	}
+	if (++history->samples == trend->samples_per_bin)
+	{
+		history->bins[history->completed % TREND_BINS] = history->current;
+		history->completed++;
+		history->samples = 0;
+	}
+}
+
+// Merges the bins of the whole span into columns, the newest one is the last. A column without
+// data yet has min > max. Returns the range over all columns of the series.
+void trend_columns(const trend_t* trend, unsigned int axis, trend_series_t series, unsigned int columns,
+		int32_t* min, int32_t* max, int32_t* range_min, int32_t* range_max);
+
+#endif /* TREND_H_ */
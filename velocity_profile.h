@@ -0,0 +1,76 @@
+/*
+ * This file is part of ECT60ctrl (https://github.com/millerfield/ECT60ctrl).
+ * Copyright (c) 2022 Stephan Meyer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VELOCITY_PROFILE_H_
+#define VELOCITY_PROFILE_H_
+
+#include <math.h>
+
+// Jerk limited velocity setpoint generator for cyclic synchronous velocity mode. Every cycle
+// the acceleration is changed by at most jerk * dt, choosing the one of increase, hold or
+// decrease which lets the velocity come to rest closest to the target if the acceleration
+// was brought to zero with maximum jerk from then on. The cost per cycle is constant.
+typedef struct
+{
+	double velocity;			// Setpoint of the last cycle [units/s]
+	double acceleration;		// [units/s^2]
+}velocity_profile_t;
+
+// Starts the profile at the given velocity at rest, e.g. the actual velocity of the drive
+static inline void velocity_profile_reset(velocity_profile_t* profile, double velocity)
+{
+	profile->velocity = velocity;
+	profile->acceleration = 0.0;
+}
+
+// Velocity reached if the acceleration is brought to zero with maximum jerk
+static inline double velocity_profile_rest(double velocity, double acceleration, double jerk)
+{
+	return velocity + (acceleration * fabs(acceleration)) / (2.0 * jerk);
+}
+
+// Advances the profile by one cycle of dt seconds towards target. Returns the new setpoint.
+static inline double velocity_profile_step(velocity_profile_t* profile, double target, double accel_max,
+		double jerk_max, double dt)
+{
+	double jerk_dt = jerk_max * dt;
+	double candidates[3] = {profile->acceleration + jerk_dt, profile->acceleration, profile->acceleration - jerk_dt};
+	double best = 0.0, best_error = INFINITY;
+
+	// Within one step of the target at nearly no acceleration, the target is taken over
+	if ((fabs(target - profile->velocity) <= (jerk_dt * dt)) && (fabs(profile->acceleration) <= jerk_dt))
+	{
+		velocity_profile_reset(profile, target);
+		return target;
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		double acceleration = fmin(fmax(candidates[i], -accel_max), accel_max);
+		double error = fabs(target - velocity_profile_rest(profile->velocity + acceleration * dt, acceleration, jerk_max));
+
+		if (error < best_error)
+		{
+			best_error = error;
+			best = acceleration;
+		}
+	}
+	profile->acceleration = best;
+	profile->velocity += best * dt;
+	return profile->velocity;
+}
+
+#endif /* VELOCITY_PROFILE_H_ */